@@ -0,0 +1,258 @@
+#pragma once
+
+//
+// Allocators
+//
+// Arena: bump allocator for everything an import creates,
+// freed in one shot once the data is no longer needed
+//
+// frame allocator: arena that resets at every presentFrame,
+// for transient per-frame data (command lists, batched quads);
+// main thread only
+//
+// Pool: fixed-size slots on a free list for small objects
+// created and destroyed all the time
+//
+
+#define HL_ARENA_BLOCK (1 << 20)
+#define HL_POOL_BLOCK 64 // objects per pool block
+
+struct AllocStats
+{
+	u64 allocs; // allocations since creation
+	u64 bytes; // bytes currently handed out
+	u64 peak; // high-water mark of 'bytes'
+	u64 reserved; // bytes held from malloc
+};
+
+inline
+void countAlloc(AllocStats* stats, u64 size)
+{
+	stats->allocs++;
+	stats->bytes += size;
+	if (stats->bytes > stats->peak) stats->peak = stats->bytes;
+}
+
+void printAllocStats(const char* name, AllocStats* stats, FILE* f = stderr)
+{
+	fprintf(f, "[Alloc] %-12s %8llu allocs  %8llu KiB used  %8llu KiB peak  %8llu KiB reserved\n", name,
+		(unsigned long long)stats->allocs, (unsigned long long)(stats->bytes >> 10),
+		(unsigned long long)(stats->peak >> 10), (unsigned long long)(stats->reserved >> 10));
+}
+
+//
+// Arena
+//
+
+struct ArenaBlock
+{
+	ArenaBlock* next;
+	u64 size;
+	u64 used;
+};
+
+struct Arena
+{
+	ArenaBlock* head; // block being allocated from
+	u64 blockSize;
+	AllocStats stats;
+};
+
+Arena createArena(u64 blockSize = HL_ARENA_BLOCK)
+{
+	Arena ret;
+	memset(&ret, 0, sizeof(ret));
+	ret.blockSize = blockSize;
+	return ret;
+}
+
+ArenaBlock* newArenaBlock(Arena* arena, u64 size)
+{
+	if (size < arena->blockSize) size = arena->blockSize;
+
+	ArenaBlock* ret = (ArenaBlock*) malloc(sizeof(ArenaBlock) + size);
+	if (!ret) return 0;
+
+	ret->next = arena->head;
+	ret->size = size;
+	ret->used = 0;
+
+	arena->head = ret;
+	arena->stats.reserved += sizeof(ArenaBlock) + size;
+	return ret;
+}
+
+// offset of the next 'align'ed byte in the block
+inline
+u64 arenaOffset(ArenaBlock* block, u64 align)
+{
+	u64 at = (u64)((u8*)(block + 1) + block->used);
+	return block->used + (((at + align - 1) & ~(align - 1)) - at);
+}
+
+// align must be a power of two
+void* arenaAlloc(Arena* arena, u64 size, u64 align = 16)
+{
+	ArenaBlock* block = arena->head;
+
+	u64 offset = 0;
+	if (block) offset = arenaOffset(block, align);
+
+	if (!block || offset + size > block->size)
+	{
+		block = newArenaBlock(arena, size + align);
+		if (!block)
+		{
+			fprintf(stderr, "[Alloc] Arena out of memory (%llu bytes)\n", (unsigned long long)size);
+			return 0;
+		}
+		offset = arenaOffset(block, align);
+	}
+
+	block->used = offset + size;
+	countAlloc(&arena->stats, size);
+	return (u8*)(block + 1) + offset;
+}
+
+inline
+void* arenaCalloc(Arena* arena, u64 size, u64 align = 16)
+{
+	void* ret = arenaAlloc(arena, size, align);
+	if (ret) memset(ret, 0, size);
+	return ret;
+}
+
+// give everything back to malloc
+void freeArena(Arena* arena)
+{
+	ArenaBlock* block = arena->head;
+	while (block)
+	{
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->head = 0;
+	arena->stats.bytes = 0;
+	arena->stats.reserved = 0;
+}
+
+// drop all allocations but keep memory around; if the arena
+// spilled into several blocks, they're merged into one block sized
+// from what they actually held (alignment padding included) plus
+// a quarter for slack, so it settles at one block
+void resetArena(Arena* arena)
+{
+	ArenaBlock* block = arena->head;
+	if (block && block->next)
+	{
+		u64 used = 0;
+		for (ArenaBlock* b = block; b; b = b->next) used += b->used;
+
+		freeArena(arena);
+		newArenaBlock(arena, used + used / 4);
+		block = arena->head;
+	}
+
+	if (block) block->used = 0;
+	arena->stats.bytes = 0;
+}
+
+//
+// Frame allocator
+//
+
+Arena hl_frameArena = createArena();
+
+inline
+void* frameAlloc(u64 size, u64 align = 16)
+{
+	return arenaAlloc(&hl_frameArena, size, align);
+}
+
+// called once per frame from presentFrame;
+// anything from frameAlloc is gone after this
+void resetFrameAllocator()
+{
+	resetArena(&hl_frameArena);
+}
+
+//
+// Pool
+//
+
+struct Pool
+{
+	u64 objectSize;
+	void* freeList; // next free slot, linked through the slots themselves
+	void* blocks; // linked through the first word of each block
+	AllocStats stats;
+};
+
+Pool createPool(u64 objectSize)
+{
+	Pool ret;
+	memset(&ret, 0, sizeof(ret));
+
+	// room for the free list link, and keep slots aligned
+	if (objectSize < sizeof(void*)) objectSize = sizeof(void*);
+	ret.objectSize = (objectSize + 15) & ~(u64)15;
+	return ret;
+}
+
+void* poolAlloc(Pool* pool)
+{
+	if (!pool->freeList)
+	{
+		u64 header = 16;
+		u8* block = (u8*) malloc(header + pool->objectSize * HL_POOL_BLOCK);
+		if (!block)
+		{
+			fprintf(stderr, "[Alloc] Pool out of memory\n");
+			return 0;
+		}
+
+		*(void**)block = pool->blocks;
+		pool->blocks = block;
+		pool->stats.reserved += header + pool->objectSize * HL_POOL_BLOCK;
+
+		for (int i = HL_POOL_BLOCK - 1; i >= 0; i--)
+		{
+			void* slot = block + header + i * pool->objectSize;
+			*(void**)slot = pool->freeList;
+			pool->freeList = slot;
+		}
+	}
+
+	void* ret = pool->freeList;
+	pool->freeList = *(void**)ret;
+
+	countAlloc(&pool->stats, pool->objectSize);
+	return ret;
+}
+
+void poolFree(Pool* pool, void* object)
+{
+	if (!object) return;
+
+	*(void**)object = pool->freeList;
+	pool->freeList = object;
+	pool->stats.bytes -= pool->objectSize;
+}
+
+void freePool(Pool* pool)
+{
+	void* block = pool->blocks;
+	while (block)
+	{
+		void* next = *(void**)block;
+		free(block);
+		block = next;
+	}
+
+	pool->blocks = 0;
+	pool->freeList = 0;
+	pool->stats.bytes = 0;
+	pool->stats.reserved = 0;
+}
\ No newline at end of file
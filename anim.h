@@ -0,0 +1,792 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+//
+// Skeletal animation
+//
+// a model with bones gets a Skeleton: the scene nodes that are bones
+// or hold bones below them, flattened so parents come before children
+// mesh vertices carry up to four bone indices and weights packed in
+// 8 bytes (SkinVertex), uploaded as a stream next to the vertices
+//
+// clips are resampled at import to HL_ANIM_RATE frames per second,
+// one 32 byte sample per joint per frame, so playback never searches
+// for keys and a pose is two sample reads per joint
+//
+// per frame, poseCharacters samples and blends every character's
+// layers (SIMD per joint, characters spread over the job system) into
+// one palette of 3x4 bone matrices, and animateCharacters uploads it
+// to a texture buffer; the vertex shader skins from that buffer at
+// the character's boneBase (see HL_SKINNING_GLSL)
+//
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HL_MAX_JOINTS 256 // also the most bones a model can have
+#define HL_ANIM_LAYERS 4 // clips blended per character
+#define HL_ANIM_RATE 30.0f // samples per second clips are stored at
+#define HL_ANIM_GRAIN 16 // characters per job
+
+// attribute locations of the skinning stream
+#define HL_JOINTS_LOCATION 5
+#define HL_WEIGHTS_LOCATION 6
+
+struct SkinVertex
+{
+	u8 joints[4]; // bone indices
+	u8 weights[4]; // normalized, sum to 255
+};
+
+// a local transform, each part padded to 4 floats for SIMD
+struct JointPose
+{
+	float rotation[4]; // quaternion x, y, z, w
+	float translation[4];
+	float scale[4];
+};
+
+// one joint at one frame of a clip; the floats come first so
+// vector loads of either stay inside the sample
+struct JointSample
+{
+	float translation[3];
+	float scale[3];
+	short rotation[4]; // quaternion, snorm16
+};
+
+struct Skeleton
+{
+	int numJoints;
+	int* parents; // -1 for the root
+	JointPose* rest; // node transforms, for joints no clip animates
+	char (*names)[64];
+
+	// bones are the joints meshes are skinned to
+	int numBones;
+	int* boneJoint;
+	mat4* inverseBind; // mesh space to the bone's rest space
+};
+
+struct AnimationClip
+{
+	char name[64];
+	int numFrames;
+	float duration; // seconds
+	JointSample* samples; // numFrames * numJoints, frame after frame
+};
+
+struct AnimationLayer
+{
+	AnimationClip* clip;
+	float time; // seconds
+	float weight;
+	int loop;
+};
+
+// one animated instance of a skinned model
+struct Animator
+{
+	Skeleton* skeleton;
+	AnimationLayer layers[HL_ANIM_LAYERS];
+	int numLayers;
+
+	int boneBase; // first bone in this frame's palette, set by poseCharacters
+};
+
+struct
+{
+	uint buffer;
+	Texture bones; // GL_TEXTURE_BUFFER over 'buffer', RGBA32F
+	u64 capacity;
+}
+hl_skinning;
+
+//
+// Import
+//
+
+inline
+mat4 toMat4(const aiMatrix4x4& m)
+{
+	// assimp is row major
+	return mat4(m.a1, m.b1, m.c1, m.d1,
+	            m.a2, m.b2, m.c2, m.d2,
+	            m.a3, m.b3, m.c3, m.d3,
+	            m.a4, m.b4, m.c4, m.d4);
+}
+
+int findJoint(Skeleton* skeleton, const char* name)
+{
+	for (int i = 0; i < skeleton->numJoints; i++)
+		if (!strcmp(skeleton->names[i], name)) return i;
+	return -1;
+}
+
+int findBone(Skeleton* skeleton, const char* name)
+{
+	for (int i = 0; i < skeleton->numBones; i++)
+		if (!strcmp(skeleton->names[skeleton->boneJoint[i]], name)) return i;
+	return -1;
+}
+
+int isBoneNode(const aiScene* scene, aiNode* node)
+{
+	for (uint m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		for (uint b = 0; b < mesh->mNumBones; b++)
+			if (mesh->mBones[b]->mName == node->mName) return 1;
+	}
+	return 0;
+}
+
+// depth first, so parents get their index before their children;
+// returns the number of joints in this subtree
+int collectJoints(const aiScene* scene, aiNode* node, int parent, Skeleton* skeleton, aiNode** nodes)
+{
+	int index = skeleton->numJoints;
+	if (index == HL_MAX_JOINTS) return 0;
+
+	skeleton->numJoints++;
+	nodes[index] = node;
+	skeleton->parents[index] = parent;
+
+	int count = 1;
+	for (uint i = 0; i < node->mNumChildren; i++)
+		count += collectJoints(scene, node->mChildren[i], index, skeleton, nodes);
+
+	// drop subtrees without bones (they were appended last)
+	if (count == 1 && !isBoneNode(scene, node))
+	{
+		skeleton->numJoints--;
+		return 0;
+	}
+	return count;
+}
+
+void setPose(JointPose* pose, aiVector3D t, aiQuaternion r, aiVector3D s)
+{
+	pose->rotation[0] = r.x; pose->rotation[1] = r.y; pose->rotation[2] = r.z; pose->rotation[3] = r.w;
+	pose->translation[0] = t.x; pose->translation[1] = t.y; pose->translation[2] = t.z; pose->translation[3] = 0;
+	pose->scale[0] = s.x; pose->scale[1] = s.y; pose->scale[2] = s.z; pose->scale[3] = 0;
+}
+
+// 0 if no mesh in the scene has bones
+Skeleton* createSkeleton(const aiScene* scene, Arena* arena)
+{
+	int bones = 0;
+	for (uint m = 0; m < scene->mNumMeshes; m++) bones += scene->mMeshes[m]->mNumBones;
+	if (!bones) return 0;
+
+	Skeleton* ret = (Skeleton*) arenaCalloc(arena, sizeof(Skeleton));
+	ret->parents = (int*) arenaAlloc(arena, HL_MAX_JOINTS * sizeof(int));
+	ret->rest = (JointPose*) arenaAlloc(arena, HL_MAX_JOINTS * sizeof(JointPose));
+	ret->names = (char(*)[64]) arenaAlloc(arena, HL_MAX_JOINTS * 64);
+	ret->boneJoint = (int*) arenaAlloc(arena, HL_MAX_JOINTS * sizeof(int));
+	ret->inverseBind = (mat4*) arenaAlloc(arena, HL_MAX_JOINTS * sizeof(mat4));
+
+	aiNode* nodes[HL_MAX_JOINTS];
+	collectJoints(scene, scene->mRootNode, -1, ret, nodes);
+
+	for (int i = 0; i < ret->numJoints; i++)
+	{
+		snprintf(ret->names[i], 64, "%s", nodes[i]->mName.C_Str());
+
+		aiVector3D t, s;
+		aiQuaternion r;
+		nodes[i]->mTransformation.Decompose(s, r, t);
+		setPose(&ret->rest[i], t, r, s);
+	}
+
+	// bones shared between meshes are matched by name
+	for (uint m = 0; m < scene->mNumMeshes; m++)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+		for (uint b = 0; b < mesh->mNumBones; b++)
+		{
+			aiBone* bone = mesh->mBones[b];
+			if (findBone(ret, bone->mName.C_Str()) >= 0) continue;
+
+			int joint = findJoint(ret, bone->mName.C_Str());
+			if (joint < 0 || ret->numBones == HL_MAX_JOINTS)
+			{
+				fprintf(stderr, "[Anim] Bone '%s' dropped (more than %i joints?)\n", bone->mName.C_Str(), HL_MAX_JOINTS);
+				continue;
+			}
+
+			ret->boneJoint[ret->numBones] = joint;
+			ret->inverseBind[ret->numBones] = toMat4(bone->mOffsetMatrix);
+			ret->numBones++;
+		}
+	}
+
+	return ret;
+}
+
+// the four heaviest influences per vertex, renormalized and packed
+void convertSkin(aiMesh* mesh, Skeleton* skeleton, SkinVertex* out)
+{
+	float* weights = (float*) calloc((u64)mesh->mNumVertices * 4, sizeof(float));
+	memset(out, 0, mesh->mNumVertices * sizeof(SkinVertex));
+
+	for (uint b = 0; b < mesh->mNumBones; b++)
+	{
+		aiBone* bone = mesh->mBones[b];
+		int index = findBone(skeleton, bone->mName.C_Str());
+		if (index < 0) continue;
+
+		for (uint i = 0; i < bone->mNumWeights; i++)
+		{
+			uint v = bone->mWeights[i].mVertexId;
+			float w = bone->mWeights[i].mWeight;
+
+			// take the lightest slot if this one is heavier
+			float* slots = &weights[v * 4];
+			int lightest = 0;
+			for (int s = 1; s < 4; s++)
+				if (slots[s] < slots[lightest]) lightest = s;
+
+			if (w > slots[lightest])
+			{
+				slots[lightest] = w;
+				out[v].joints[lightest] = index;
+			}
+		}
+	}
+
+	for (uint v = 0; v < mesh->mNumVertices; v++)
+	{
+		float* slots = &weights[v * 4];
+		float sum = slots[0] + slots[1] + slots[2] + slots[3];
+		if (sum <= 0)
+		{
+			out[v].weights[0] = 255;
+			continue;
+		}
+
+		// rounding error goes to the heaviest, so the sum stays 255
+		int total = 0, heaviest = 0;
+		for (int s = 0; s < 4; s++)
+		{
+			out[v].weights[s] = (u8)(slots[s] / sum * 255.0f + 0.5f);
+			total += out[v].weights[s];
+			if (slots[s] > slots[heaviest]) heaviest = s;
+		}
+		out[v].weights[heaviest] += 255 - total;
+	}
+
+	free(weights);
+}
+
+inline
+aiVector3D lerpKeys(aiVectorKey* keys, uint count, double tick, uint* cursor)
+{
+	while (*cursor + 1 < count && keys[*cursor + 1].mTime <= tick) (*cursor)++;
+	if (*cursor + 1 >= count) return keys[*cursor].mValue;
+
+	aiVectorKey* a = &keys[*cursor];
+	aiVectorKey* b = &keys[*cursor + 1];
+	float f = (float)((tick - a->mTime) / (b->mTime - a->mTime));
+	return a->mValue + (b->mValue - a->mValue) * f;
+}
+
+inline
+aiQuaternion slerpKeys(aiQuatKey* keys, uint count, double tick, uint* cursor)
+{
+	while (*cursor + 1 < count && keys[*cursor + 1].mTime <= tick) (*cursor)++;
+	if (*cursor + 1 >= count) return keys[*cursor].mValue;
+
+	aiQuatKey* a = &keys[*cursor];
+	aiQuatKey* b = &keys[*cursor + 1];
+	float f = (float)((tick - a->mTime) / (b->mTime - a->mTime));
+
+	aiQuaternion ret;
+	aiQuaternion::Interpolate(ret, a->mValue, b->mValue, f);
+	return ret.Normalize();
+}
+
+inline
+short quantizeUnit(float x)
+{
+	x = (x < -1) ? -1 : (x > 1) ? 1 : x;
+	return (short)lrintf(x * 32767.0f);
+}
+
+// resample every animation in the scene; clips are allocated from 'arena'
+AnimationClip* createClips(const aiScene* scene, Skeleton* skeleton, Arena* arena, int* count)
+{
+	*count = 0;
+	if (!skeleton || !scene->mNumAnimations) return 0;
+
+	AnimationClip* ret = (AnimationClip*) arenaCalloc(arena, scene->mNumAnimations * sizeof(AnimationClip));
+	int joints = skeleton->numJoints;
+
+	for (uint a = 0; a < scene->mNumAnimations; a++)
+	{
+		aiAnimation* anim = scene->mAnimations[a];
+		AnimationClip* clip = &ret[a];
+
+		double ticksPerSecond = (anim->mTicksPerSecond > 0) ? anim->mTicksPerSecond : 25.0;
+		snprintf(clip->name, sizeof(clip->name), "%s", anim->mName.C_Str());
+		clip->duration = (float)(anim->mDuration / ticksPerSecond);
+		clip->numFrames = (int)ceilf(clip->duration * HL_ANIM_RATE) + 1;
+		clip->samples = (JointSample*) arenaAlloc(arena, (u64)clip->numFrames * joints * sizeof(JointSample));
+
+		// joints nothing animates hold their rest pose
+		for (int f = 0; f < clip->numFrames; f++)
+		{
+			for (int j = 0; j < joints; j++)
+			{
+				JointSample* s = &clip->samples[f * joints + j];
+				JointPose* rest = &skeleton->rest[j];
+				for (int i = 0; i < 3; i++)
+				{
+					s->translation[i] = rest->translation[i];
+					s->scale[i] = rest->scale[i];
+				}
+				for (int i = 0; i < 4; i++) s->rotation[i] = quantizeUnit(rest->rotation[i]);
+			}
+		}
+
+		for (uint c = 0; c < anim->mNumChannels; c++)
+		{
+			aiNodeAnim* channel = anim->mChannels[c];
+			int j = findJoint(skeleton, channel->mNodeName.C_Str());
+			if (j < 0) continue;
+
+			uint pos = 0, rot = 0, scl = 0;
+			for (int f = 0; f < clip->numFrames; f++)
+			{
+				double tick = fmin(f / HL_ANIM_RATE * ticksPerSecond, anim->mDuration);
+				JointSample* s = &clip->samples[f * joints + j];
+
+				if (channel->mNumPositionKeys)
+				{
+					aiVector3D t = lerpKeys(channel->mPositionKeys, channel->mNumPositionKeys, tick, &pos);
+					s->translation[0] = t.x; s->translation[1] = t.y; s->translation[2] = t.z;
+				}
+				if (channel->mNumScalingKeys)
+				{
+					aiVector3D v = lerpKeys(channel->mScalingKeys, channel->mNumScalingKeys, tick, &scl);
+					s->scale[0] = v.x; s->scale[1] = v.y; s->scale[2] = v.z;
+				}
+				if (channel->mNumRotationKeys)
+				{
+					aiQuaternion r = slerpKeys(channel->mRotationKeys, channel->mNumRotationKeys, tick, &rot);
+					s->rotation[0] = quantizeUnit(r.x);
+					s->rotation[1] = quantizeUnit(r.y);
+					s->rotation[2] = quantizeUnit(r.z);
+					s->rotation[3] = quantizeUnit(r.w);
+				}
+			}
+		}
+	}
+
+	*count = scene->mNumAnimations;
+	return ret;
+}
+
+AnimationClip* findClip(AnimationClip* clips, int count, const char* name)
+{
+	for (int i = 0; i < count; i++)
+		if (!strcmp(clips[i].name, name)) return &clips[i];
+	return 0;
+}
+
+//
+// Sampling
+//
+
+// frames either side of 'time' and how far between them
+inline
+void clipFrames(AnimationClip* clip, float time, int loop, int* f0, int* f1, float* frac)
+{
+	float f = time * HL_ANIM_RATE;
+	int last = clip->numFrames - 1;
+
+	// the last frame is the same instant as the first when looping
+	if (loop && last > 0) f = fmodf(f, (float)last);
+	if (f < 0) f += (loop) ? last : -f;
+	if (f > last) f = (float)last;
+
+	*f0 = (int)f;
+	*f1 = (*f0 < last) ? *f0 + 1 : last;
+	*frac = f - *f0;
+}
+
+// weighted sum of the layers' poses into 'out', then normalized;
+// scalar version, used without SSE and by bench/
+void sampleLayersScalar(Skeleton* skeleton, AnimationLayer* layers, int numLayers, JointPose* out)
+{
+	int joints = skeleton->numJoints;
+	memset(out, 0, joints * sizeof(JointPose));
+	float total = 0;
+
+	for (int l = 0; l < numLayers; l++)
+	{
+		AnimationLayer* layer = &layers[l];
+		if (layer->weight <= 0 || !layer->clip) continue;
+		total += layer->weight;
+
+		int f0, f1;
+		float frac;
+		clipFrames(layer->clip, layer->time, layer->loop, &f0, &f1, &frac);
+
+		JointSample* a = &layer->clip->samples[f0 * joints];
+		JointSample* b = &layer->clip->samples[f1 * joints];
+
+		for (int j = 0; j < joints; j++)
+		{
+			JointPose* p = &out[j];
+			float w = layer->weight;
+
+			float qa[4], qb[4], d = 0, acc = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				qa[i] = a[j].rotation[i] * (1.0f / 32767.0f);
+				qb[i] = b[j].rotation[i] * (1.0f / 32767.0f);
+				d += qa[i] * qb[i];
+			}
+			if (d < 0) for (int i = 0; i < 4; i++) qb[i] = -qb[i];
+
+			float q[4];
+			for (int i = 0; i < 4; i++)
+			{
+				q[i] = qa[i] + (qb[i] - qa[i]) * frac;
+				acc += q[i] * p->rotation[i];
+			}
+			if (acc < 0) w = -w;
+
+			for (int i = 0; i < 4; i++) p->rotation[i] += q[i] * w;
+
+			w = layer->weight;
+			for (int i = 0; i < 3; i++)
+			{
+				p->translation[i] += (a[j].translation[i] + (b[j].translation[i] - a[j].translation[i]) * frac) * w;
+				p->scale[i] += (a[j].scale[i] + (b[j].scale[i] - a[j].scale[i]) * frac) * w;
+			}
+		}
+	}
+
+	if (total <= 0)
+	{
+		memcpy(out, skeleton->rest, joints * sizeof(JointPose));
+		return;
+	}
+
+	for (int j = 0; j < joints; j++)
+	{
+		JointPose* p = &out[j];
+		float* q = p->rotation;
+		float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		for (int i = 0; i < 4; i++)
+		{
+			q[i] /= len;
+			p->translation[i] /= total;
+			p->scale[i] /= total;
+		}
+	}
+}
+
+#ifdef __SSE2__
+// dot product in every lane
+inline
+__m128 dot4(__m128 a, __m128 b)
+{
+	__m128 m = _mm_mul_ps(a, b);
+	m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+inline
+__m128 loadRotation(const short* q)
+{
+	__m128i s = _mm_loadl_epi64((const __m128i*)q);
+	s = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+	return _mm_mul_ps(_mm_cvtepi32_ps(s), _mm_set1_ps(1.0f / 32767.0f));
+}
+
+// flip 'q' where 'd' is negative (the other hemisphere)
+inline
+__m128 alignHemisphere(__m128 q, __m128 d)
+{
+	__m128 sign = _mm_and_ps(_mm_cmplt_ps(d, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+	return _mm_xor_ps(q, sign);
+}
+#endif
+
+void sampleLayers(Skeleton* skeleton, AnimationLayer* layers, int numLayers, JointPose* out)
+{
+#ifdef __SSE2__
+	int joints = skeleton->numJoints;
+	memset(out, 0, joints * sizeof(JointPose));
+	float total = 0;
+	__m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+	for (int l = 0; l < numLayers; l++)
+	{
+		AnimationLayer* layer = &layers[l];
+		if (layer->weight <= 0 || !layer->clip) continue;
+		total += layer->weight;
+
+		int f0, f1;
+		float frac;
+		clipFrames(layer->clip, layer->time, layer->loop, &f0, &f1, &frac);
+
+		JointSample* a = &layer->clip->samples[f0 * joints];
+		JointSample* b = &layer->clip->samples[f1 * joints];
+		__m128 t = _mm_set1_ps(frac);
+		__m128 w = _mm_set1_ps(layer->weight);
+
+		for (int j = 0; j < joints; j++)
+		{
+			float* p = out[j].rotation;
+
+			__m128 qa = loadRotation(a[j].rotation);
+			__m128 qb = loadRotation(b[j].rotation);
+			qb = alignHemisphere(qb, dot4(qa, qb));
+			__m128 q = _mm_add_ps(qa, _mm_mul_ps(_mm_sub_ps(qb, qa), t));
+
+			__m128 acc = _mm_load_ps(p);
+			q = alignHemisphere(q, dot4(q, acc));
+			_mm_store_ps(p, _mm_add_ps(acc, _mm_mul_ps(q, w)));
+
+			// the fourth lane reads the neighbouring field; it's masked off,
+			// since rotation bits read as floats can be denormals (slow)
+			__m128 ta = _mm_and_ps(_mm_loadu_ps(a[j].translation), xyz);
+			__m128 tb = _mm_and_ps(_mm_loadu_ps(b[j].translation), xyz);
+			__m128 sa = _mm_and_ps(_mm_loadu_ps(a[j].scale), xyz);
+			__m128 sb = _mm_and_ps(_mm_loadu_ps(b[j].scale), xyz);
+			__m128 tr = _mm_add_ps(ta, _mm_mul_ps(_mm_sub_ps(tb, ta), t));
+			__m128 sc = _mm_add_ps(sa, _mm_mul_ps(_mm_sub_ps(sb, sa), t));
+
+			_mm_store_ps(p + 4, _mm_add_ps(_mm_load_ps(p + 4), _mm_mul_ps(tr, w)));
+			_mm_store_ps(p + 8, _mm_add_ps(_mm_load_ps(p + 8), _mm_mul_ps(sc, w)));
+		}
+	}
+
+	if (total <= 0)
+	{
+		memcpy(out, skeleton->rest, joints * sizeof(JointPose));
+		return;
+	}
+
+	__m128 inv = _mm_set1_ps(1.0f / total);
+	for (int j = 0; j < joints; j++)
+	{
+		float* p = out[j].rotation;
+		__m128 q = _mm_load_ps(p);
+		_mm_store_ps(p, _mm_div_ps(q, _mm_sqrt_ps(dot4(q, q))));
+		_mm_store_ps(p + 4, _mm_mul_ps(_mm_load_ps(p + 4), inv));
+		_mm_store_ps(p + 8, _mm_mul_ps(_mm_load_ps(p + 8), inv));
+	}
+#else
+	sampleLayersScalar(skeleton, layers, numLayers, out);
+#endif
+}
+
+//
+// Palette
+//
+
+// column major TRS matrix of a pose
+inline
+void poseMatrix(JointPose* pose, float* m)
+{
+	float x = pose->rotation[0], y = pose->rotation[1], z = pose->rotation[2], w = pose->rotation[3];
+	float* s = pose->scale;
+
+	m[0] = (1 - 2 * (y * y + z * z)) * s[0];
+	m[1] = (2 * (x * y + w * z)) * s[0];
+	m[2] = (2 * (x * z - w * y)) * s[0];
+	m[3] = 0;
+
+	m[4] = (2 * (x * y - w * z)) * s[1];
+	m[5] = (1 - 2 * (x * x + z * z)) * s[1];
+	m[6] = (2 * (y * z + w * x)) * s[1];
+	m[7] = 0;
+
+	m[8] = (2 * (x * z + w * y)) * s[2];
+	m[9] = (2 * (y * z - w * x)) * s[2];
+	m[10] = (1 - 2 * (x * x + y * y)) * s[2];
+	m[11] = 0;
+
+	m[12] = pose->translation[0];
+	m[13] = pose->translation[1];
+	m[14] = pose->translation[2];
+	m[15] = 1;
+}
+
+// out = a * b, column major, 'out' may not alias 'b'
+inline
+void mulMatrix(const float* a, const float* b, float* out)
+{
+#ifdef __SSE__
+	__m128 c0 = _mm_loadu_ps(a), c1 = _mm_loadu_ps(a + 4), c2 = _mm_loadu_ps(a + 8), c3 = _mm_loadu_ps(a + 12);
+	for (int i = 0; i < 4; i++)
+	{
+		const float* col = b + i * 4;
+		__m128 r = _mm_mul_ps(c0, _mm_set1_ps(col[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(col[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(col[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(col[3])));
+		_mm_storeu_ps(out + i * 4, r);
+	}
+#else
+	float r[16];
+	for (int i = 0; i < 4; i++)
+		for (int k = 0; k < 4; k++)
+			r[i * 4 + k] = a[k] * b[i * 4] + a[4 + k] * b[i * 4 + 1] + a[8 + k] * b[i * 4 + 2] + a[12 + k] * b[i * 4 + 3];
+	memcpy(out, r, sizeof(r));
+#endif
+}
+
+// skinning matrices of one pose, as the top three rows of each
+// (12 floats per bone, the layout HL_SKINNING_GLSL reads)
+void writePalette(Skeleton* skeleton, JointPose* local, float* out)
+{
+	float global[HL_MAX_JOINTS][16];
+
+	for (int j = 0; j < skeleton->numJoints; j++)
+	{
+		float m[16];
+		poseMatrix(&local[j], m);
+
+		int parent = skeleton->parents[j];
+		if (parent < 0) memcpy(global[j], m, sizeof(m));
+		else mulMatrix(global[parent], m, global[j]);
+	}
+
+	for (int b = 0; b < skeleton->numBones; b++)
+	{
+		float skin[16];
+		mulMatrix(global[skeleton->boneJoint[b]], &skeleton->inverseBind[b][0][0], skin);
+
+		float* row = out + b * 12;
+		for (int r = 0; r < 3; r++)
+		{
+			row[r * 4 + 0] = skin[r];
+			row[r * 4 + 1] = skin[4 + r];
+			row[r * 4 + 2] = skin[8 + r];
+			row[r * 4 + 3] = skin[12 + r];
+		}
+	}
+}
+
+struct PoseJob
+{
+	Animator* characters;
+	float* palette;
+	int scalar;
+};
+
+void poseJob(void* user, int begin, int end)
+{
+	PoseJob* job = (PoseJob*)user;
+	alignas(16) JointPose local[HL_MAX_JOINTS];
+
+	for (int i = begin; i < end; i++)
+	{
+		Animator* a = &job->characters[i];
+		if (!a->skeleton) continue;
+
+		if (job->scalar) sampleLayersScalar(a->skeleton, a->layers, a->numLayers, local);
+		else sampleLayers(a->skeleton, a->layers, a->numLayers, local);
+
+		writePalette(a->skeleton, local, job->palette + (u64)a->boneBase * 12);
+	}
+}
+
+// sample, blend and build the palette of every character, in parallel;
+// returns the palette (from frameAlloc, 12 floats per bone) and its bone count
+float* poseCharacters(Animator* characters, int count, int* numBones, int scalar = false)
+{
+	int total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		characters[i].boneBase = total;
+		if (characters[i].skeleton) total += characters[i].skeleton->numBones;
+	}
+
+	float* palette = (float*) frameAlloc((u64)total * 12 * sizeof(float) + 16);
+
+	PoseJob job = {characters, palette, scalar};
+	parallelFor(count, HL_ANIM_GRAIN, poseJob, &job);
+
+	*numBones = total;
+	return palette;
+}
+
+// pose every character and upload the palette;
+// then per character, useSkinning before drawing its model
+void animateCharacters(Animator* characters, int count)
+{
+	int bones;
+	float* palette = poseCharacters(characters, count, &bones);
+	u64 size = (u64)bones * 12 * sizeof(float);
+	if (!size) return;
+
+	if (!hl_skinning.buffer)
+	{
+		glGenBuffers(1, &hl_skinning.buffer);
+		glGenTextures(1, &hl_skinning.bones.id);
+		hl_skinning.bones.type = GL_TEXTURE_BUFFER;
+		hl_skinning.bones.format = GL_RGBA32F;
+		hl_skinning.bones.residency = -1;
+		hl_skinning.bones.stream = -1;
+	}
+
+	// orphan, so last frame's draws keep their copy
+	glBindBuffer(GL_TEXTURE_BUFFER, hl_skinning.buffer);
+	if (size > hl_skinning.capacity) hl_skinning.capacity = size * 2;
+	glBufferData(GL_TEXTURE_BUFFER, hl_skinning.capacity, 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, size, palette);
+
+	glBindTexture(GL_TEXTURE_BUFFER, hl_skinning.bones.id);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, hl_skinning.buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// move every layer along by 'dt' seconds
+void advanceAnimator(Animator* animator, float dt)
+{
+	for (int i = 0; i < animator->numLayers; i++)
+		animator->layers[i].time += dt;
+}
+
+// set the uniforms HL_SKINNING_GLSL expects on the active shader
+void useSkinning(Animator* animator)
+{
+	Shader* shader = activeShader;
+
+	shader->setTexture("hlBones", hl_skinning.bones);
+	shader->setInt("hlBoneBase", animator->boneBase);
+}
+
+// skinMatrix() blends the vertex's bones; apply it to position
+// and normal before the model transform
+#define HL_SKINNING_GLSL "\
+\n layout(location = 5) in uvec4 hlJoints;\
+\n layout(location = 6) in vec4 hlWeights;\
+\n uniform samplerBuffer hlBones; // 3 rows per bone\
+\n uniform int hlBoneBase;\
+\n \
+\n mat4 skinMatrix()\
+\n {\
+\n 	vec4 r0 = vec4(0.0), r1 = vec4(0.0), r2 = vec4(0.0);\
+\n 	for (int i = 0; i < 4; i++)\
+\n 	{\
+\n 		int b = (hlBoneBase + int(hlJoints[i])) * 3;\
+\n 		float w = hlWeights[i];\
+\n 		r0 += texelFetch(hlBones, b) * w;\
+\n 		r1 += texelFetch(hlBones, b + 1) * w;\
+\n 		r2 += texelFetch(hlBones, b + 2) * w;\
+\n 	}\
+\n 	return transpose(mat4(r0, r1, r2, vec4(0.0, 0.0, 0.0, 1.0)));\
+\n }\
+"
+"
\ No newline at end of file
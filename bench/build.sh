@@ -0,0 +1,6 @@
+#!/bin/bash
+
+clang++ -O2 main.cc -o bench -isystem ~/include -lglad -lglfw -lassimp -lpthread
+RETURN=$?
+
+[[ -z "$RETURN" ]] && bench
\ No newline at end of file
@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../hl.h"
+
+#define USAGE "\n\
+Usage:\n\
+bench [--threads N] [--stress ROUNDS] [TEST]... [MODEL_FILE]...\n\
+TEST is jobs, commands, anim, lights or hdr; without any,\n\
+all of them run. Every MODEL_FILE times vertex conversion\n\
+on its biggest mesh.\n\
+--threads is the most threads a sweep goes up to,\n\
+and what the stress test and vertex conversion run on\n\
+(default: the core count).\n\
+--stress runs the job system stress test ROUNDS times.\n"
+
+#define HELP_MESSAGE "\
+bench - hl benchmark utility\n\
+Times the CPU side paths of the library (jobs, command recording,\n\
+posing, light clustering, HDR packing, vertex conversion) headless,\n\
+and checks their fast paths agree with the reference ones.\n"
+
+//
+// Timing
+//
+
+// best wall time of 'runs' calls of 'func', in ms
+template <typename F>
+double timeBest(F func, int runs = 5)
+{
+	double best = 1e30;
+	for (int run = 0; run < runs; run++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		func();
+		auto t1 = std::chrono::steady_clock::now();
+		best = fmin(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+	}
+	return best;
+}
+
+// calls 'func' with the job system on 1, 2, 4, ... threads, up to 'maxThreads'
+template <typename F>
+void sweepThreads(int maxThreads, F func)
+{
+	for (int threads = 1;; threads *= 2)
+	{
+		if (threads > maxThreads) threads = maxThreads;
+		startJobs(threads);
+		func(threads);
+		stopJobs();
+		if (threads == maxThreads) break;
+	}
+}
+
+//
+// Jobs
+//
+
+struct JobStress
+{
+	std::atomic<u64> sum;
+	std::atomic<int> stage; // checks continuation ordering
+	std::atomic<int> errors;
+	int* marks;
+};
+
+void stressSum(void* user, int begin, int end)
+{
+	JobStress* s = (JobStress*)user;
+	u64 local = 0;
+	for (int i = begin; i < end; i++)
+	{
+		s->marks[i]++;
+		local += i;
+	}
+	s->sum += local;
+}
+
+void stressInner(void* user, int begin, int end)
+{
+	JobStress* s = (JobStress*)user;
+	u64 local = 0;
+	for (int i = begin; i < end; i++) local += i;
+	s->sum += local;
+}
+
+void stressNested(void* user, int begin, int end)
+{
+	// jobs submitting and waiting on jobs from inside workers
+	JobStress* s = (JobStress*)user;
+	for (int i = begin; i < end; i++)
+		parallelFor(1000, 7, stressInner, s);
+}
+
+void stressStage(void* user, int begin, int end)
+{
+	JobStress* s = (JobStress*)user;
+	if (s->stage.fetch_add(1) != begin) s->errors++;
+}
+
+// runs mixed workloads and checks every index ran exactly once,
+// nested waits don't deadlock and dependencies run in order;
+// returns the number of failures
+int stressJobs(int rounds)
+{
+	int failures = 0;
+	int n = 100000;
+
+	JobStress s;
+	s.marks = (int*) malloc(n * sizeof(int));
+
+	for (int r = 0; r < rounds; r++)
+	{
+		// flat, with an odd grain
+		memset(s.marks, 0, n * sizeof(int));
+		s.sum = 0;
+		parallelFor(n, 1 + r % 97, stressSum, &s);
+
+		int marksOk = 1;
+		for (int i = 0; i < n; i++) if (s.marks[i] != 1) marksOk = 0;
+		if (!marksOk || s.sum != (u64)n * (n - 1) / 2) failures++;
+
+		// nested
+		s.sum = 0;
+		parallelFor(16, 1, stressNested, &s);
+		if (s.sum != (u64)16 * 1000 * 999 / 2) failures++;
+
+		// dependency chain: each stage waits on the previous one's counter
+		JobCounter stages[8];
+		s.stage = 0;
+		s.errors = 0;
+		runJob(stressStage, &s, 0, 1, &stages[0]);
+		for (int k = 1; k < 8; k++) runJobAfter(&stages[k - 1], stressStage, &s, k, k + 1, &stages[k]);
+		waitJobs(&stages[7]);
+		if (s.errors || s.stage != 8) failures++;
+	}
+
+	free(s.marks);
+
+	fprintf(stderr, "[Jobs] Stress: %i rounds on %i threads, %i failures\n", rounds, jobThreads(), failures);
+	return failures;
+}
+
+void benchmarkKernel(void* user, int begin, int end)
+{
+	float* data = (float*)user;
+	for (int i = begin; i < end; i++)
+	{
+		float x = data[i];
+		for (int k = 0; k < 64; k++) x = x * 0.999f + 0.5f / (1.0f + x * x);
+		data[i] = x;
+	}
+}
+
+// the same parallelFor on every thread count
+void benchmarkJobs(int maxThreads, int count = 1 << 20, int grain = 1024)
+{
+	float* data = (float*) malloc(count * sizeof(float));
+	double base = 0;
+
+	sweepThreads(maxThreads, [&](int threads)
+	{
+		hl_jobs.steals = 0;
+		for (int i = 0; i < count; i++) data[i] = i * 0.001f;
+
+		double best = timeBest([&]() { parallelFor(count, grain, benchmarkKernel, data); });
+		if (threads == 1) base = best;
+
+		fprintf(stderr, "[Jobs] %2i threads: %8.3f ms  (%.2fx, %llu steals)\n", threads, best, base / best,
+			(unsigned long long)hl_jobs.steals.load());
+	});
+
+	free(data);
+}
+
+//
+// Commands
+//
+
+struct CommandBenchmark
+{
+	Model* model;
+	mat4 viewProj;
+};
+
+void benchmarkRecord(void* user, int begin, int end)
+{
+	CommandBenchmark* b = (CommandBenchmark*)user;
+	int meshes = b->model->meshes.size;
+
+	for (int i = begin; i < end; i++)
+	{
+		// roughly what a scene walk does per object
+		vec3 position = vec3(i % 100, (i / 100) % 100, i / 10000);
+		mat4 transform = b->viewProj * translate(position) * rotate(i * 0.01f, vec3(0, 1, 0));
+		recordMesh(b->model, i % meshes, transform, i, i & 1);
+	}
+}
+
+// recording 'count' mesh commands on every thread count,
+// and the merge and sort after
+void benchmarkCommandRecording(int maxThreads, int count = 100000)
+{
+	// stand-in model: meshes only need a material and a VAO name for their key
+	Model model;
+	model.numTextureArrays = 0;
+	model.meshes.allocate(64);
+	for (int i = 0; i < 64; i++)
+	{
+		Mesh m = createMesh();
+		m.vao = i + 1;
+		m.materialId = i % 8;
+		model.meshes.append(m);
+	}
+
+	CommandBenchmark b;
+	b.model = &model;
+	b.viewProj = perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+
+	u64 firstHash = 0;
+	double base = 0;
+
+	sweepThreads(maxThreads, [&](int threads)
+	{
+		double record = 1e30, merge = 1e30;
+		int deterministic = 1;
+		for (int run = 0; run < 5; run++)
+		{
+			beginCommands();
+			record = fmin(record, timeBest([&]() { parallelFor(count, 256, benchmarkRecord, &b); }, 1));
+
+			int merged;
+			DrawCommand* commands;
+			merge = fmin(merge, timeBest([&]() { commands = mergeCommands(&merged); }, 1));
+
+			// same order on every thread count
+			u64 hash = 0;
+			for (int i = 0; i < merged; i++) hash = hash * 31 + commands[i].order;
+			if (!firstHash) firstHash = hash;
+			if (hash != firstHash) deterministic = 0;
+		}
+		if (threads == 1) base = record;
+
+		fprintf(stderr, "[Commands] %2i threads: record %8.3f ms (%.2fx), merge+sort %8.3f ms%s\n",
+			threads, record, base / record, merge, (deterministic) ? "" : "  ORDER DIFFERS");
+	});
+
+	beginCommands();
+}
+
+//
+// Animation
+//
+
+// posing 'count' characters of a 64 joint chain blending two clips,
+// scalar and SIMD on 1 thread, then SIMD on every thread count
+void benchmarkAnimation(int maxThreads, int count = 1000)
+{
+	Arena arena = createArena();
+	int joints = 64;
+
+	Skeleton skeleton;
+	skeleton.numJoints = joints;
+	skeleton.numBones = joints;
+	skeleton.parents = (int*) arenaAlloc(&arena, joints * sizeof(int));
+	skeleton.rest = (JointPose*) arenaCalloc(&arena, joints * sizeof(JointPose));
+	skeleton.names = 0;
+	skeleton.boneJoint = (int*) arenaAlloc(&arena, joints * sizeof(int));
+	skeleton.inverseBind = (mat4*) arenaAlloc(&arena, joints * sizeof(mat4));
+
+	for (int j = 0; j < joints; j++)
+	{
+		skeleton.parents[j] = j - 1;
+		skeleton.boneJoint[j] = j;
+		skeleton.inverseBind[j] = translate(vec3(0, -j, 0));
+		skeleton.rest[j].rotation[3] = 1;
+		skeleton.rest[j].scale[0] = skeleton.rest[j].scale[1] = skeleton.rest[j].scale[2] = 1;
+	}
+
+	AnimationClip clips[2];
+	for (int c = 0; c < 2; c++)
+	{
+		clips[c].numFrames = 61;
+		clips[c].duration = 2;
+		clips[c].samples = (JointSample*) arenaAlloc(&arena, 61 * joints * sizeof(JointSample));
+
+		for (int f = 0; f < 61; f++)
+		{
+			for (int j = 0; j < joints; j++)
+			{
+				JointSample* s = &clips[c].samples[f * joints + j];
+				float angle = sinf(f * 0.1f + j + c) * 0.5f;
+				s->translation[0] = 0; s->translation[1] = 1; s->translation[2] = 0;
+				s->scale[0] = s->scale[1] = s->scale[2] = 1;
+				s->rotation[0] = quantizeUnit(sinf(angle)); s->rotation[1] = 0; s->rotation[2] = 0;
+				s->rotation[3] = quantizeUnit(cosf(angle));
+			}
+		}
+	}
+
+	Animator* characters = (Animator*) arenaCalloc(&arena, count * sizeof(Animator));
+	for (int i = 0; i < count; i++)
+	{
+		Animator* a = &characters[i];
+		a->skeleton = &skeleton;
+		a->numLayers = 2;
+		a->layers[0] = {&clips[0], i * 0.013f, 0.7f, 1};
+		a->layers[1] = {&clips[1], i * 0.029f, 0.3f, 1};
+	}
+
+	// scalar and SIMD should agree
+	int bones;
+	float maxError = 0;
+	double scalar = 1e30, simd = 1e30;
+	for (int run = 0; run < 5; run++)
+	{
+		resetFrameAllocator();
+		float* a;
+		float* b;
+		scalar = fmin(scalar, timeBest([&]() { a = poseCharacters(characters, count, &bones, true); }, 1));
+		simd = fmin(simd, timeBest([&]() { b = poseCharacters(characters, count, &bones); }, 1));
+
+		for (int i = 0; i < bones * 12; i++) maxError = fmaxf(maxError, fabsf(a[i] - b[i]));
+	}
+
+	fprintf(stderr, "[Anim] %i characters, %i bones: scalar %8.3f ms, SIMD %8.3f ms (%.2fx), max difference %g\n",
+		count, bones, scalar, simd, scalar / simd, maxError);
+
+	double base = 0;
+	sweepThreads(maxThreads, [&](int threads)
+	{
+		double best = timeBest([&]()
+		{
+			resetFrameAllocator();
+			poseCharacters(characters, count, &bones);
+		});
+		if (threads == 1) base = best;
+
+		fprintf(stderr, "[Anim] %2i threads: %8.3f ms (%.2fx)\n", threads, best, base / best);
+	});
+
+	resetFrameAllocator();
+	freeArena(&arena);
+}
+
+//
+// Lights
+//
+
+// assigning 'count' random lights, scalar and SIMD on 1 thread, then
+// SIMD on every thread count; checks both give the same lists
+void benchmarkLightClustering(int maxThreads, int count = 1024)
+{
+	Light* lights = (Light*) malloc(count * sizeof(Light));
+	srand(1);
+	for (int i = 0; i < count; i++)
+	{
+		vec3 p = vec3(rand() % 200 - 100, rand() % 20, -(rand() % 200));
+		float radius = 2 + rand() % 10;
+		if (i & 3) lights[i] = pointLight(p, radius, vec3(1));
+		else lights[i] = spotLight(p, vec3(0, -1, 0), radius, vec3(1), 0.3f, 0.5f);
+	}
+
+	setLightView(identity<mat4>(), 1.0f, 16.0f / 9.0f, 0.1f, 200.0f);
+
+	double scalar = 1e30, simd = 1e30;
+	int same = 1;
+	for (int run = 0; run < 5; run++)
+	{
+		resetFrameAllocator();
+		u32 *gridA, *gridB;
+		u16 *indicesA, *indicesB;
+		scalar = fmin(scalar, timeBest([&]() { assignLights(lights, count, &gridA, &indicesA, true); }, 1));
+		simd = fmin(simd, timeBest([&]() { assignLights(lights, count, &gridB, &indicesB); }, 1));
+
+		if (memcmp(gridA, gridB, HL_CLUSTERS * sizeof(u32))
+			|| memcmp(indicesA, indicesB, hl_lights.stats.indices * sizeof(u16))) same = 0;
+	}
+
+	LightStats stats = hl_lights.stats;
+	fprintf(stderr, "[Lights] %i lights: scalar %8.3f ms, SIMD %8.3f ms (%.2fx)%s\n",
+		count, scalar, simd, scalar / simd, (same) ? "" : "  LISTS DIFFER");
+	fprintf(stderr, "[Lights] %.2f lights per cluster on average, %i at most, %i dropped\n",
+		(float)stats.indices / HL_CLUSTERS, stats.maxPerCluster, stats.overflowed);
+
+	double base = 0;
+	sweepThreads(maxThreads, [&](int threads)
+	{
+		double best = timeBest([&]()
+		{
+			resetFrameAllocator();
+			u32* grid;
+			u16* indices;
+			assignLights(lights, count, &grid, &indices);
+		});
+		if (threads == 1) base = best;
+
+		fprintf(stderr, "[Lights] %2i threads: %8.3f ms (%.2fx)\n", threads, best, base / best);
+	});
+
+	resetFrameAllocator();
+	free(lights);
+}
+
+//
+// HDR
+//
+
+// the scalar and SIMD packers over 'pixels' RGB pixels
+// spanning the half range; checks they agree bit for bit
+void benchmarkHdrPacking(int pixels = 1 << 20)
+{
+	float* in = (float*) malloc((size_t)pixels * 3 * sizeof(float));
+	unsigned int* a = (unsigned int*) malloc((size_t)pixels * 3 * sizeof(unsigned int));
+	unsigned int* b = (unsigned int*) malloc((size_t)pixels * 3 * sizeof(unsigned int));
+
+	// exponents from 2^-20 to 2^17, a few negatives, denormals and NaNs
+	unsigned int seed = 1;
+	for (int i = 0; i < pixels * 3; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		HdrBits v;
+		v.u = (seed & 0x807fffff) | ((107 + (seed >> 8) % 38) << 23);
+		if (i % 97 == 0) v.u = 0x7fc00000;
+		if (i % 89 == 0) v.u = seed & 0x007fffff;
+		in[i] = v.f;
+	}
+
+	const char* names[] = {"RGB9_E5", "R11F_G11F_B10F", "RGB16F"};
+	for (int f = 0; f < 3; f++)
+	{
+		double times[2];
+		for (int simd = 0; simd < 2; simd++)
+		{
+			unsigned int* out = (simd) ? b : a;
+			times[simd] = timeBest([&]()
+			{
+				if (f == 0) ((simd) ? packRGB9E5 : packRGB9E5Scalar)(in, out, pixels);
+				if (f == 1) ((simd) ? packR11G11B10F : packR11G11B10FScalar)(in, out, pixels);
+				if (f == 2) ((simd) ? packHalf : packHalfScalar)(in, (unsigned short*)out, pixels * 3);
+			});
+		}
+
+		size_t bytes = (f == 2) ? (size_t)pixels * 6 : (size_t)pixels * 4;
+		fprintf(stderr, "[HDR] %-15s scalar %8.3f ms, simd %8.3f ms (%.2fx)%s\n", names[f],
+			times[0], times[1], times[0] / times[1], memcmp(a, b, bytes) ? "  RESULTS DIFFER" : "");
+	}
+
+	free(in);
+	free(a);
+	free(b);
+}
+
+//
+// Mesh
+//
+
+// per-vertex loop as createMesh used to do it, to compare convertMesh against
+void convertMeshScalar(aiMesh* mesh, Vertex* out, uint* indices)
+{
+	for (uint i = 0; i < mesh->mNumVertices; i++)
+	{
+		out[i].position.x = mesh->mVertices[i].x;
+		out[i].position.y = mesh->mVertices[i].y;
+		out[i].position.z = mesh->mVertices[i].z;
+
+		if (mesh->HasNormals())
+		{
+			out[i].normal.x = mesh->mNormals[i].x;
+			out[i].normal.y = mesh->mNormals[i].y;
+			out[i].normal.z = mesh->mNormals[i].z;
+		}
+		else out[i].normal = {0,1,0};
+
+		if (mesh->mTextureCoords[0])
+		{
+			out[i].uv1.u = mesh->mTextureCoords[0][i].x;
+			out[i].uv1.v = mesh->mTextureCoords[0][i].y;
+		}
+		else
+		{
+			out[i].uv1.u = 0.0;
+			out[i].uv1.v = 0.0;
+		}
+
+		if (mesh->HasVertexColors(0))
+		{
+			out[i].color.r = mesh->mColors[0][i].r;
+			out[i].color.g = mesh->mColors[0][i].g;
+			out[i].color.b = mesh->mColors[0][i].b;
+			out[i].color.a = mesh->mColors[0][i].a;
+		}
+		else out[i].color = {255u,255u,255u,255u};
+	}
+
+	for (uint i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+
+		indices[i * 3 + 0] = face.mIndices[0];
+		indices[i * 3 + 1] = face.mIndices[1];
+		indices[i * 3 + 2] = face.mIndices[2];
+	}
+}
+
+// the per-vertex loop against convertMesh on the biggest mesh of a model
+int benchmarkVertexConversion(const char* path, int runs = 10)
+{
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
+	if (!scene || !scene->mNumMeshes)
+	{
+		fprintf(stderr, "[Mesh] Failed to load '%s'\n", path);
+		return 1;
+	}
+
+	aiMesh* mesh = scene->mMeshes[0];
+	for (uint i = 1; i < scene->mNumMeshes; i++)
+		if (scene->mMeshes[i]->mNumVertices > mesh->mNumVertices) mesh = scene->mMeshes[i];
+
+	Vertex* out = (Vertex*) malloc((u64)mesh->mNumVertices * sizeof(Vertex));
+	uint* indices = (uint*) malloc((u64)mesh->mNumFaces * 3 * sizeof(uint));
+
+	double scalar = timeBest([&]() { convertMeshScalar(mesh, out, indices); }, runs);
+	double bulk = timeBest([&]() { convertMesh(mesh, out, indices); }, runs);
+
+	fprintf(stderr, "[Mesh] %u vertices: per-vertex loop %.3f ms, bulk %.3f ms (%.1fx)\n",
+		mesh->mNumVertices, scalar, bulk, scalar / bulk);
+
+	free(out);
+	free(indices);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int maxThreads = std::thread::hardware_concurrency();
+	int stressRounds = 0;
+	int tests = 0;
+	int failures = 0;
+
+	const char* names[] = {"jobs", "commands", "anim", "lights", "hdr"};
+	int run[5] = {};
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--help"))
+		{
+			fprintf(stderr, HELP_MESSAGE USAGE);
+			return 0;
+		}
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) maxThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--stress") && i + 1 < argc) stressRounds = atoi(argv[++i]);
+		else
+		{
+			int k = 0;
+			while (k < 5 && strcmp(argv[i], names[k])) k++;
+			if (k < 5) run[k] = 1;
+			tests++;
+		}
+	}
+	if (maxThreads < 1) maxThreads = 1;
+
+	// nothing picked runs everything headless
+	if (!tests && !stressRounds) for (int k = 0; k < 5; k++) run[k] = 1;
+
+	if (run[0]) benchmarkJobs(maxThreads);
+	if (run[1]) benchmarkCommandRecording(maxThreads);
+	if (run[2]) benchmarkAnimation(maxThreads);
+	if (run[3]) benchmarkLightClustering(maxThreads);
+	if (run[4]) benchmarkHdrPacking();
+
+	// the rest run on all the threads asked for
+	startJobs(maxThreads);
+
+	if (stressRounds) failures += stressJobs(stressRounds);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--threads") || !strcmp(argv[i], "--stress")) { i++; continue; }
+
+		int k = 0;
+		while (k < 5 && strcmp(argv[i], names[k])) k++;
+		if (k == 5) failures += benchmarkVertexConversion(argv[i]);
+	}
+
+	stopJobs();
+	return (failures) ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+
+//
+// Draw commands
+//
+// draws are recorded as plain data (what Mesh::draw and drawTexture
+// would do) into one command buffer per recording thread, so recording
+// runs in parallel without locks; the GL thread then merges the
+// buffers, sorts them and submits
+//
+// order is deterministic no matter which thread recorded what:
+// commands sort by key (layer, kind, then GL state for meshes) and
+// ties by the 'order' value the caller passes, which should be
+// unique per frame, e.g. the item index of a parallelFor
+//
+// quads keep their recording order within a layer, like drawTexture,
+// since they usually overlap; meshes are grouped by material and VAO
+//
+// job workers use the buffer of their index; any other thread
+// (main, render, upload...) claims one of HL_CMD_THREADS the first
+// time it records
+//
+
+#define HL_CMD_THREADS 8 // recording threads outside the job system
+#define HL_CMD_BUFFERS (HL_MAX_WORKERS + 1 + HL_CMD_THREADS)
+
+#define HL_CMD_MESH 0
+#define HL_CMD_QUAD 1
+
+struct DrawCommand
+{
+	u64 key;
+	u32 order;
+	int type;
+
+	union
+	{
+		struct
+		{
+			Model* model;
+			int mesh;
+			float transform[16]; // mat4, kept plain so the union stays trivially copyable
+		}
+		mesh;
+
+		struct
+		{
+			Texture texture;
+			int x, y, width, height;
+			Color color;
+		}
+		quad;
+	};
+};
+
+struct CommandBuffer
+{
+	DrawCommand* commands;
+	int count;
+	int capacity;
+	char pad[64]; // keep neighbouring buffers off each other's cache line
+};
+
+struct
+{
+	CommandBuffer buffers[HL_CMD_BUFFERS]; // 0 unused, then workers, then other threads
+	std::atomic<int> threads; // buffers claimed by other threads
+
+	DrawCommand* merged;
+	int numMerged;
+	int mergedCapacity;
+}
+hl_commands;
+
+thread_local int hl_commandBuffer = -1;
+
+inline
+u64 commandKey(int layer, int type, u64 state)
+{
+	return ((u64)(layer & 0xFF) << 56) | ((u64)type << 48) | (state & 0xFFFFFFFFFFFF);
+}
+
+DrawCommand* recordCommand()
+{
+	if (hl_commandBuffer < 0)
+	{
+		if (hl_jobWorker > 0) hl_commandBuffer = hl_jobWorker;
+		else
+		{
+			int thread = hl_commands.threads++;
+			if (thread >= HL_CMD_THREADS)
+			{
+				fprintf(stderr, "[Commands] Too many recording threads (max %i besides job workers)\n", HL_CMD_THREADS);
+				hl_commands.threads--;
+				return 0;
+			}
+			hl_commandBuffer = HL_MAX_WORKERS + 1 + thread;
+		}
+	}
+
+	CommandBuffer* buffer = &hl_commands.buffers[hl_commandBuffer];
+	if (buffer->count == buffer->capacity)
+	{
+		int capacity = (buffer->capacity) ? buffer->capacity * 2 : 1024;
+		DrawCommand* commands = (DrawCommand*) realloc(buffer->commands, capacity * sizeof(DrawCommand));
+		if (!commands)
+		{
+			fprintf(stderr, "[Commands] Out of memory\n");
+			return 0;
+		}
+		buffer->commands = commands;
+		buffer->capacity = capacity;
+	}
+	return &buffer->commands[buffer->count++];
+}
+
+// empty every thread's buffer (storage is kept)
+void beginCommands()
+{
+	for (int i = 0; i < HL_CMD_BUFFERS; i++) hl_commands.buffers[i].count = 0;
+	hl_commands.numMerged = 0;
+}
+
+// one mesh of a model; 'transform' goes to the hlDraw block
+void recordMesh(Model* model, int mesh, mat4 transform, u32 order, int layer = 0)
+{
+	DrawCommand* cmd = recordCommand();
+	if (!cmd) return;
+
+	Mesh* m = &model->meshes[mesh];
+	cmd->key = commandKey(layer, HL_CMD_MESH, ((u64)(m->materialId & 0xFFFF) << 32) | m->vao);
+	cmd->order = order;
+	cmd->type = HL_CMD_MESH;
+	cmd->mesh.model = model;
+	cmd->mesh.mesh = mesh;
+	memcpy(cmd->mesh.transform, &transform[0][0], sizeof(cmd->mesh.transform));
+}
+
+void recordQuad(Texture texture, int x, int y, int width, int height, Color color, u32 order, int layer = 0)
+{
+	DrawCommand* cmd = recordCommand();
+	if (!cmd) return;
+
+	cmd->key = commandKey(layer, HL_CMD_QUAD, order);
+	cmd->order = order;
+	cmd->type = HL_CMD_QUAD;
+	cmd->quad.texture = texture;
+	cmd->quad.x = x;
+	cmd->quad.y = y;
+	cmd->quad.width = width;
+	cmd->quad.height = height;
+	cmd->quad.color = color;
+}
+
+inline
+bool commandBefore(const DrawCommand& a, const DrawCommand& b)
+{
+	if (a.key != b.key) return a.key < b.key;
+	return a.order < b.order;
+}
+
+// gather every thread's commands into one sorted list
+DrawCommand* mergeCommands(int* count)
+{
+	int total = 0;
+	for (int i = 0; i < HL_CMD_BUFFERS; i++) total += hl_commands.buffers[i].count;
+
+	if (total > hl_commands.mergedCapacity)
+	{
+		free(hl_commands.merged);
+		hl_commands.merged = (DrawCommand*) malloc(total * sizeof(DrawCommand));
+		hl_commands.mergedCapacity = total;
+	}
+
+	int at = 0;
+	for (int i = 0; i < HL_CMD_BUFFERS; i++)
+	{
+		CommandBuffer* buffer = &hl_commands.buffers[i];
+		memcpy(hl_commands.merged + at, buffer->commands, buffer->count * sizeof(DrawCommand));
+		at += buffer->count;
+	}
+
+	std::sort(hl_commands.merged, hl_commands.merged + total, commandBefore);
+
+	hl_commands.numMerged = total;
+	*count = total;
+	return hl_commands.merged;
+}
+
+// merge, sort and draw; meshes are drawn with 'meshShader'
+// (which needs the hlDraw block for its transform)
+void submitCommands(Shader* meshShader)
+{
+	int count;
+	DrawCommand* commands = mergeCommands(&count);
+
+	Model* boundModel = 0;
+	Shader* bound = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		DrawCommand* cmd = &commands[i];
+
+		if (cmd->type == HL_CMD_QUAD)
+		{
+			// drawTexture switches to the texture shader itself
+			clearTextures();
+			drawTexture(cmd->quad.texture, cmd->quad.x, cmd->quad.y, cmd->quad.width, cmd->quad.height, cmd->quad.color);
+			bound = &hl_textureShader;
+			boundModel = 0;
+			continue;
+		}
+
+		if (bound != meshShader)
+		{
+			useShader(meshShader);
+			bound = meshShader;
+			boundModel = 0;
+		}
+
+		Model* model = cmd->mesh.model;
+		// texture units restart for every model's arrays and every unpacked
+		// mesh, or they'd run past GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS
+		if (model != boundModel && model->numTextureArrays > 0)
+		{
+			clearTextures();
+			char name[32];
+			for (int t = 0; t < model->numTextureArrays; t++)
+			{
+				snprintf(name, sizeof(name), "hlTextureArray%i", t);
+				meshShader->setTexture(name, model->textureArrays[t]);
+			}
+		}
+		boundModel = model;
+
+		DrawBlock draw;
+		memcpy(&draw.transform[0][0], cmd->mesh.transform, sizeof(cmd->mesh.transform));
+		draw.diffuse = vec4(1.0);
+		if (!bindUniforms(pushUniforms(&draw, sizeof(draw)), HL_DRAW_BINDING)) continue;
+
+		if (!model->numTextureArrays) clearTextures();
+		model->meshes[cmd->mesh.mesh].draw(model->materials, &model->materialBuffer, model->numTextureArrays > 0);
+	}
+
+	clearTextures();
+}
\ No newline at end of file
@@ -23,6 +23,9 @@ struct
 	// window (onscreen drawing)
 	uint wwidth = 1280;
 	uint wheight = 720;
+	
+	// GL belongs to the render thread (see render.h)
+	int renderThread = 0;
 }
 hl;
 
@@ -66,7 +69,13 @@ int shouldRender()
 	return 0;
 }
 
-void init()
+void startJobs(int threads);
+void stopJobs();
+
+// 'jobThreads' starts the job system with that many threads, main
+// included (0 = one per core); by default there are no workers
+// and jobs run on the thread submitting them
+void init(int jobThreads = 1)
 {
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -77,10 +86,23 @@ void init()
 	hl.thisFrameTime = glfwGetTime();
 	hl.delta = 0;
 	hl.accumulator = 0;
+	
+	if (jobThreads != 1) startJobs(jobThreads);
 }
 
+void stopRenderThread();
+void stopReadbackWorker();
+void stopStreaming();
+void stopUploadThread();
+void stopTrace();
 void deinit()
 {
+	stopRenderThread();
+	stopReadbackWorker();
+	stopStreaming();
+	stopUploadThread();
+	stopTrace();
+	stopJobs();
 	glfwTerminate();
 }
 
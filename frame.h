@@ -1,5 +1,31 @@
 #pragma once
 
+#define HL_MAX_COLORS 8 // color attachments per frame
+#define HL_SHARED_DEPTH (1 << HL_MAX_COLORS) // Frame::shared bit of the depth attachment
+
+// one texture of a frame: a sized internal format
+// (GL_RGBA8, GL_RGB10_A2, GL_RG16F, GL_R11F_G11F_B10F, GL_DEPTH_COMPONENT24, ...)
+// or another frame's texture to share, e.g. one depth buffer
+// for the G-buffer and the lighting pass; shared textures
+// must be the same size and aren't deleted with this frame
+struct Attachment
+{
+	uint format;
+	Texture* shared;
+};
+
+inline
+Attachment attachment(uint format)
+{
+	return {format, 0};
+}
+
+inline
+Attachment sharedAttachment(Texture* texture)
+{
+	return {0, texture};
+}
+
 struct Frame
 {
 	uint fbo;
@@ -7,9 +33,14 @@ struct Frame
 	int width;
 	int height;
 	
-	Texture color;
+	Texture color; // colors[0]
 	Texture depth;
 	
+	// color attachments in glDrawBuffers order (fragment outputs 0..n)
+	Texture colors[HL_MAX_COLORS];
+	int numColors;
+	int shared; // bit i: colors[i] belongs to another frame, HL_SHARED_DEPTH: depth does
+	
 	int ops;
 	
 	uint minFilter;
@@ -32,86 +63,215 @@ void defaultFrame()
 	glDisable(GL_DEPTH_TEST);
 }
 
-// stencil buffer does not work yet!
-Frame createFrame(int write, int read, int width, int height, int color = 1, int depth = 1, int stencil = 0, uint magFilter = GL_LINEAR, uint minFilter = GL_LINEAR)
+// pixel format, type and size of a sized internal format;
+// returns the attachment point it goes to, 0 if unsupported
+uint attachmentFormat(uint internal, uint* format, uint* type, int* bytes)
+{
+	switch (internal)
+	{
+	case GL_R8: *format = GL_RED; *type = GL_UNSIGNED_BYTE; *bytes = 1; break;
+	case GL_RG8: *format = GL_RG; *type = GL_UNSIGNED_BYTE; *bytes = 2; break;
+	case GL_RGBA8: *format = GL_RGBA; *type = GL_UNSIGNED_BYTE; *bytes = 4; break;
+	case GL_RGB10_A2: *format = GL_RGBA; *type = GL_UNSIGNED_INT_2_10_10_10_REV; *bytes = 4; break;
+	case GL_R11F_G11F_B10F: *format = GL_RGB; *type = GL_UNSIGNED_INT_10F_11F_11F_REV; *bytes = 4; break;
+	case GL_R16F: *format = GL_RED; *type = GL_HALF_FLOAT; *bytes = 2; break;
+	case GL_RG16F: *format = GL_RG; *type = GL_HALF_FLOAT; *bytes = 4; break;
+	case GL_RGBA16F: *format = GL_RGBA; *type = GL_HALF_FLOAT; *bytes = 8; break;
+	case GL_R32F: *format = GL_RED; *type = GL_FLOAT; *bytes = 4; break;
+	case GL_RG32F: *format = GL_RG; *type = GL_FLOAT; *bytes = 8; break;
+	case GL_RGBA32F: *format = GL_RGBA; *type = GL_FLOAT; *bytes = 16; break;
+	case GL_R32UI: *format = GL_RED_INTEGER; *type = GL_UNSIGNED_INT; *bytes = 4; break;
+	
+	case GL_DEPTH_COMPONENT16: *format = GL_DEPTH_COMPONENT; *type = GL_UNSIGNED_SHORT; *bytes = 2; return GL_DEPTH_ATTACHMENT;
+	case GL_DEPTH_COMPONENT24: *format = GL_DEPTH_COMPONENT; *type = GL_UNSIGNED_INT; *bytes = 4; return GL_DEPTH_ATTACHMENT;
+	case GL_DEPTH_COMPONENT32F: *format = GL_DEPTH_COMPONENT; *type = GL_FLOAT; *bytes = 4; return GL_DEPTH_ATTACHMENT;
+	case GL_DEPTH24_STENCIL8: *format = GL_DEPTH_STENCIL; *type = GL_UNSIGNED_INT_24_8; *bytes = 4; return GL_DEPTH_STENCIL_ATTACHMENT;
+	case GL_DEPTH32F_STENCIL8: *format = GL_DEPTH_STENCIL; *type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; *bytes = 8; return GL_DEPTH_STENCIL_ATTACHMENT;
+	
+	default: return 0;
+	}
+	return GL_COLOR_ATTACHMENT0;
+}
+
+// a frame from a list of attachments; color attachments are drawn to in
+// list order, at most one depth (or depth-stencil) attachment
+// 'ops' is GL_DRAW_FRAMEBUFFER, GL_READ_FRAMEBUFFER or GL_FRAMEBUFFER
+Frame createFrame(int width, int height, Attachment* attachments, int count, uint magFilter = GL_LINEAR, uint minFilter = GL_LINEAR, uint ops = GL_FRAMEBUFFER)
 {
 	Frame ret;
 	ret.width = width;
 	ret.height = height;
-	ret.color.type = GL_TEXTURE_2D;
-	ret.depth.type = GL_TEXTURE_2D;
-	
+	ret.numColors = 0;
+	ret.shared = 0;
+	ret.ops = ops;
 	ret.minFilter = minFilter;
 	ret.magFilter = magFilter;
 	
+	Texture none;
+	none.id = 0;
+	none.format = 0;
+	none.type = GL_TEXTURE_2D;
+	none.slot = 0;
+	none.residency = -1;
+	none.stream = -1;
+	ret.depth = none;
+	for (int i = 0; i < HL_MAX_COLORS; i++) ret.colors[i] = none;
+	
 	glGenFramebuffers(1, &ret.fbo);
+	glBindFramebuffer(ret.ops, ret.fbo);
 	
-	if (color)
-	{
-		ret.color.format = GL_RGBA;
-		glGenTextures(1, &ret.color.id);
-		glBindTexture(GL_TEXTURE_2D, ret.color.id);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-	}
+	uint drawBuffers[HL_MAX_COLORS];
 	
-	if (depth)
+	for (int i = 0; i < count; i++)
 	{
-		glGenTextures(1, &ret.depth.id);
-		glBindTexture(GL_TEXTURE_2D, ret.depth.id);
+		Attachment* a = &attachments[i];
+		Texture tex = none;
+		uint point;
 		
-		if (stencil)
+		if (a->shared)
 		{
-			ret.depth.format = GL_DEPTH_STENCIL;
-			glTexImage2D(GL_TEXTURE_2D, 0, ret.depth.format, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_BYTE, 0);
+			tex = *a->shared;
+			
+			// shared depth keeps the attachment point it was made for
+			if (tex.format == GL_DEPTH_STENCIL) point = GL_DEPTH_STENCIL_ATTACHMENT;
+			else if (tex.format == GL_DEPTH_COMPONENT) point = GL_DEPTH_ATTACHMENT;
+			else point = GL_COLOR_ATTACHMENT0;
 		}
 		else
 		{
-			ret.depth.format = GL_DEPTH_COMPONENT;
-			glTexImage2D(GL_TEXTURE_2D, 0, ret.depth.format, width, height, 0, ret.depth.format, GL_UNSIGNED_BYTE, 0);
+			uint format, type;
+			int bytes;
+			point = attachmentFormat(a->format, &format, &type, &bytes);
+			if (!point)
+			{
+				fprintf(stderr, "[Frame] Unsupported attachment format %X\n", a->format);
+				continue;
+			}
+			
+			tex.format = format;
+			glGenTextures(1, &tex.id);
+			glBindTexture(GL_TEXTURE_2D, tex.id);
+			glTexImage2D(GL_TEXTURE_2D, 0, a->format, width, height, 0, format, type, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			tex.residency = trackResource(HL_RES_FRAME, tex.id, (u64)width * height * bytes);
 		}
 		
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-	}
-	
-	ret.ops = GL_DRAW_FRAMEBUFFER;
-	if (read && write) ret.ops = GL_FRAMEBUFFER;
-	else if (read) ret.ops = GL_READ_FRAMEBUFFER;
-	 
-	glBindFramebuffer(ret.ops, ret.fbo);
-	if (color)
-	{
-		glFramebufferTexture2D(ret.ops, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ret.color.id, 0);
-	}
-	if (depth)
-	{
-		if (stencil)
+		if (point == GL_COLOR_ATTACHMENT0)
 		{
-			glFramebufferTexture2D(ret.ops, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, ret.depth.id, 0);
+			if (ret.numColors == HL_MAX_COLORS)
+			{
+				fprintf(stderr, "[Frame] More than %i color attachments\n", HL_MAX_COLORS);
+				continue;
+			}
+			
+			int c = ret.numColors++;
+			if (a->shared) ret.shared |= 1 << c;
+			ret.colors[c] = tex;
+			drawBuffers[c] = GL_COLOR_ATTACHMENT0 + c;
+			glFramebufferTexture2D(ret.ops, drawBuffers[c], GL_TEXTURE_2D, tex.id, 0);
 		}
 		else
 		{
-			glFramebufferTexture2D(ret.ops, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, ret.depth.id, 0);
+			if (a->shared) ret.shared |= HL_SHARED_DEPTH;
+			ret.depth = tex;
+			glFramebufferTexture2D(ret.ops, point, GL_TEXTURE_2D, tex.id, 0);
 		}
 	}
 	
-	fprintf(stderr, "Framebuffer creation status: %X\n", glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	ret.color = ret.colors[0];
 	
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	// draw buffers are framebuffer state, so this holds whenever it's bound
+	if (ret.numColors > 0)
+	{
+		if (ret.ops != GL_READ_FRAMEBUFFER) glDrawBuffers(ret.numColors, drawBuffers);
+	}
+	else
+	{
+		if (ret.ops != GL_READ_FRAMEBUFFER) glDrawBuffer(GL_NONE);
+		if (ret.ops != GL_DRAW_FRAMEBUFFER) glReadBuffer(GL_NONE);
+	}
+	
+	uint status = glCheckFramebufferStatus(ret.ops);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "[Frame] Framebuffer incomplete (%X)\n", status);
+	
+	glBindFramebuffer(ret.ops, 0);
 	
 	return ret;
 }
 
+// one RGBA8 color texture and a 24 bit depth (with stencil) texture
+Frame createFrame(int write, int read, int width, int height, int color = 1, int depth = 1, int stencil = 0, uint magFilter = GL_LINEAR, uint minFilter = GL_LINEAR)
+{
+	Attachment list[2];
+	int count = 0;
+	
+	if (color) list[count++] = attachment(GL_RGBA8);
+	if (depth) list[count++] = attachment((stencil) ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24);
+	
+	uint ops = GL_DRAW_FRAMEBUFFER;
+	if (read && write) ops = GL_FRAMEBUFFER;
+	else if (read) ops = GL_READ_FRAMEBUFFER;
+	
+	return createFrame(width, height, list, count, magFilter, minFilter, ops);
+}
+
+// release the framebuffer and the attachments it owns
+void deleteFrame(Frame* frame)
+{
+	if (currentFrame == frame) defaultFrame();
+	
+	for (int i = 0; i < frame->numColors; i++)
+	{
+		Texture* tex = &frame->colors[i];
+		if (!(frame->shared & (1 << i)) && tex->id)
+		{
+			glDeleteTextures(1, &tex->id);
+			untrackResource(tex->residency);
+		}
+		tex->id = 0;
+	}
+	
+	if (!(frame->shared & HL_SHARED_DEPTH) && frame->depth.id)
+	{
+		glDeleteTextures(1, &frame->depth.id);
+		untrackResource(frame->depth.residency);
+	}
+	glDeleteFramebuffers(1, &frame->fbo);
+	
+	frame->color.id = 0;
+	frame->depth.id = 0;
+	frame->numColors = 0;
+	frame->fbo = 0;
+}
+
 void clearFrame(float r, float g, float b, float a)
 {
 	glClearColor(r, g, b, a);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 }
 
+void updateReadbacks();
+void advanceUniformRing();
+void updateResidency();
+void updateStreaming();
+void updateUploads();
+void trimFramePool();
 void presentFrame()
 {
-	glfwPollEvents();
+	updateReadbacks();
+	advanceUniformRing();
+	updateResidency();
+	updateStreaming();
+	updateUploads();
+	trimFramePool();
+	resetFrameAllocator();
+	updateTrace();
+	
+	// with a render thread, the app thread polls
+	if (!hl.renderThread) glfwPollEvents();
 	glfwSwapBuffers(hl.window);
 }
\ No newline at end of file
@@ -0,0 +1,463 @@
+#pragma once
+
+//
+// Transient frame pool
+//
+// frames are keyed by size and attachment layout;
+// a released frame is handed to the next request
+// with the same key instead of allocating a new one
+//
+
+struct FrameDesc
+{
+	int width;
+	int height;
+
+	int color;
+	int depth;
+	int stencil;
+
+	uint magFilter;
+	uint minFilter;
+};
+
+FrameDesc frameDesc(int width, int height, int color = 1, int depth = 1, int stencil = 0, uint magFilter = GL_LINEAR, uint minFilter = GL_LINEAR)
+{
+	FrameDesc ret;
+	ret.width = width;
+	ret.height = height;
+	ret.color = color;
+	ret.depth = depth;
+	ret.stencil = stencil;
+	ret.magFilter = magFilter;
+	ret.minFilter = minFilter;
+	return ret;
+}
+
+int frameDescEqual(FrameDesc a, FrameDesc b)
+{
+	return a.width == b.width && a.height == b.height
+		&& a.color == b.color && a.depth == b.depth && a.stencil == b.stencil
+		&& a.magFilter == b.magFilter && a.minFilter == b.minFilter;
+}
+
+struct PooledFrame
+{
+	Frame frame;
+	FrameDesc desc;
+
+	int inUse;
+	int alive; // 0 once trimmed; the slot is reused by the next allocation
+	uint lastUsed; // pool tick of the last acquire
+};
+
+// frames not acquired for this many frames are freed
+#define HL_FRAME_POOL_MAX_AGE 4
+
+Array<PooledFrame> hl_framePool;
+uint hl_framePoolTick = 0;
+
+// returns a pool slot; the frame stays valid until released
+int acquireFrame(FrameDesc desc)
+{
+	int freeSlot = -1;
+
+	for (int i = 0; i < hl_framePool.size; i++)
+	{
+		PooledFrame* entry = &hl_framePool[i];
+
+		if (!entry->alive)
+		{
+			if (freeSlot < 0) freeSlot = i;
+			continue;
+		}
+
+		if (entry->inUse || !frameDescEqual(entry->desc, desc))
+			continue;
+
+		entry->inUse = 1;
+		entry->lastUsed = hl_framePoolTick;
+		return i;
+	}
+
+	PooledFrame entry;
+	entry.frame = createFrame(1, 1, desc.width, desc.height, desc.color, desc.depth, desc.stencil, desc.magFilter, desc.minFilter);
+	entry.desc = desc;
+	entry.inUse = 1;
+	entry.alive = 1;
+	entry.lastUsed = hl_framePoolTick;
+
+	if (freeSlot >= 0)
+	{
+		hl_framePool[freeSlot] = entry;
+		return freeSlot;
+	}
+
+	hl_framePool.append(entry);
+	return hl_framePool.size - 1;
+}
+
+// NOTE: acquiring may grow the pool,
+// so don't hold on to this pointer across acquires
+inline
+Frame* pooledFrame(int slot)
+{
+	return &hl_framePool[slot].frame;
+}
+
+inline
+void releaseFrame(int slot)
+{
+	hl_framePool[slot].inUse = 0;
+}
+
+// advance the pool clock and free frames that have sat unused
+// for too long; called once per frame from presentFrame, so
+// any number of graphs per frame share a tick
+void trimFramePool()
+{
+	hl_framePoolTick++;
+
+	for (int i = 0; i < hl_framePool.size; i++)
+	{
+		PooledFrame* entry = &hl_framePool[i];
+		if (!entry->alive || entry->inUse) continue;
+
+		if (hl_framePoolTick - entry->lastUsed > HL_FRAME_POOL_MAX_AGE)
+		{
+			deleteFrame(&entry->frame);
+			entry->alive = 0;
+		}
+	}
+}
+
+//
+// Render graph
+//
+// passes declare the frame attachments they read and the frame they write;
+// passes whose output nothing consumes are culled, and transient targets
+// whose lifetimes don't overlap share the same pooled frame
+//
+// a pass that writes no target (readbacks, uploads, buffer work) is
+// there for its side effects, so it's always kept, and so is
+// everything it reads
+//
+
+#define HL_ATTACH_COLOR 1
+#define HL_ATTACH_DEPTH 2
+
+#define HL_GRAPH_MAX_PASSES 64
+#define HL_GRAPH_MAX_RESOURCES 64
+#define HL_GRAPH_MAX_READS 8
+
+struct RenderGraph;
+typedef void (*PassFunc)(RenderGraph* graph, void* user);
+
+struct GraphResource
+{
+	FrameDesc desc;
+
+	int imported;
+	Frame* external; // imported frame, 0 for the default framebuffer
+
+	int slot; // pool slot while alive, -1 otherwise
+	int producer; // pass that writes this (transient only)
+
+	int firstPass, lastPass;
+	int refs; // live passes reading this
+	int readMask; // attachments read by any live pass
+};
+
+struct GraphPass
+{
+	char name[32];
+	PassFunc execute;
+	void* user;
+
+	int reads[HL_GRAPH_MAX_READS];
+	int readMasks[HL_GRAPH_MAX_READS];
+	int numReads;
+
+	int write; // -1 if the pass has no target (never culled)
+
+	int refs;
+	int culled;
+};
+
+struct RenderGraph
+{
+	GraphPass passes[HL_GRAPH_MAX_PASSES];
+	int numPasses;
+
+	GraphResource resources[HL_GRAPH_MAX_RESOURCES];
+	int numResources;
+
+	int compiled;
+
+	// clear passes and resources,
+	// graphs are meant to be rebuilt every frame
+	void reset()
+	{
+		numPasses = 0;
+		numResources = 0;
+		compiled = 0;
+	}
+
+	int createTarget(FrameDesc desc)
+	{
+		if (numResources >= HL_GRAPH_MAX_RESOURCES)
+		{
+			fprintf(stderr, "[Graph] Too many resources (max %i)\n", HL_GRAPH_MAX_RESOURCES);
+			return -1;
+		}
+
+		GraphResource* res = &resources[numResources];
+		res->desc = desc;
+		res->imported = 0;
+		res->external = 0;
+		res->slot = -1;
+		res->producer = -1;
+
+		return numResources++;
+	}
+
+	// passes writing an imported frame are never culled
+	// pass 0 to target the default framebuffer
+	int importFrame(Frame* frame)
+	{
+		int ret = createTarget(frameDesc(0, 0));
+		if (ret < 0) return ret;
+
+		resources[ret].imported = 1;
+		resources[ret].external = frame;
+
+		return ret;
+	}
+
+	int addPass(const char* name, PassFunc execute, void* user = 0)
+	{
+		if (numPasses >= HL_GRAPH_MAX_PASSES)
+		{
+			fprintf(stderr, "[Graph] Too many passes (max %i)\n", HL_GRAPH_MAX_PASSES);
+			return -1;
+		}
+
+		GraphPass* pass = &passes[numPasses];
+
+		int i = 0;
+		for (; name[i] != 0 && i < 31; i++) pass->name[i] = name[i];
+		pass->name[i] = 0;
+
+		pass->execute = execute;
+		pass->user = user;
+		pass->numReads = 0;
+		pass->write = -1;
+
+		compiled = 0;
+		return numPasses++;
+	}
+
+	void read(int pass, int resource, int attachments = HL_ATTACH_COLOR)
+	{
+		GraphPass* p = &passes[pass];
+		if (p->numReads >= HL_GRAPH_MAX_READS)
+		{
+			fprintf(stderr, "[Graph] Pass '%s' reads too many resources\n", p->name);
+			return;
+		}
+
+		p->reads[p->numReads] = resource;
+		p->readMasks[p->numReads] = attachments;
+		p->numReads++;
+		compiled = 0;
+	}
+
+	void write(int pass, int resource)
+	{
+		GraphResource* res = &resources[resource];
+		if (!res->imported && res->producer >= 0)
+		{
+			fprintf(stderr, "[Graph] Pass '%s' writes a target already written by '%s'\n",
+				passes[pass].name, passes[res->producer].name);
+			return;
+		}
+
+		passes[pass].write = resource;
+		if (!res->imported) res->producer = pass;
+		compiled = 0;
+	}
+
+	// physical frame behind a resource
+	// only valid while the graph is executing
+	Frame* frame(int resource)
+	{
+		GraphResource* res = &resources[resource];
+		if (res->imported) return res->external;
+		if (res->slot < 0) return 0;
+		return pooledFrame(res->slot);
+	}
+
+	void compile()
+	{
+		for (int i = 0; i < numResources; i++)
+		{
+			resources[i].refs = 0;
+			resources[i].readMask = 0;
+			resources[i].firstPass = -1;
+			resources[i].lastPass = -1;
+		}
+
+		for (int i = 0; i < numPasses; i++)
+		{
+			GraphPass* pass = &passes[i];
+			pass->culled = 0;
+
+			for (int r = 0; r < pass->numReads; r++)
+			{
+				GraphResource* res = &resources[pass->reads[r]];
+				res->refs++;
+
+				if (!res->imported && res->producer >= i)
+				{
+					fprintf(stderr, "[Graph] Pass '%s' reads a target before it is written\n", pass->name);
+				}
+			}
+		}
+
+		//
+		// Cull passes nothing depends on,
+		// walking backwards so that a culled pass
+		// releases the passes feeding it in the same sweep
+		//
+
+		for (int i = 0; i < numPasses; i++)
+		{
+			GraphPass* pass = &passes[i];
+			if (pass->write < 0) pass->refs = 1;
+			else if (resources[pass->write].imported) pass->refs = 1;
+			else pass->refs = resources[pass->write].refs;
+		}
+
+		for (int i = numPasses - 1; i >= 0; i--)
+		{
+			GraphPass* pass = &passes[i];
+			if (pass->refs > 0) continue;
+
+			pass->culled = 1;
+
+			for (int r = 0; r < pass->numReads; r++)
+			{
+				GraphResource* res = &resources[pass->reads[r]];
+				res->refs--;
+
+				if (!res->imported && res->refs == 0 && res->producer >= 0)
+					passes[res->producer].refs = 0;
+			}
+		}
+
+		//
+		// Lifetimes of the surviving resources
+		//
+
+		for (int i = 0; i < numPasses; i++)
+		{
+			GraphPass* pass = &passes[i];
+			if (pass->culled) continue;
+
+			for (int r = 0; r <= pass->numReads; r++)
+			{
+				int id = (r < pass->numReads) ? pass->reads[r] : pass->write;
+				if (id < 0) continue;
+
+				GraphResource* res = &resources[id];
+				if (res->firstPass < 0) res->firstPass = i;
+				res->lastPass = i;
+
+				if (r < pass->numReads) res->readMask |= pass->readMasks[r];
+			}
+		}
+
+		compiled = 1;
+	}
+
+	void invalidate(Frame* frame, int attachments)
+	{
+		// glInvalidateFramebuffer is GL 4.3 / ARB_invalidate_subdata
+		if (!glInvalidateFramebuffer || !frame) return;
+
+		uint list[HL_MAX_COLORS + 1];
+		int count = 0;
+
+		if (attachments & HL_ATTACH_COLOR)
+		{
+			for (int i = 0; i < frame->numColors; i++)
+				if (frame->colors[i].id) list[count++] = GL_COLOR_ATTACHMENT0 + i;
+		}
+
+		if ((attachments & HL_ATTACH_DEPTH) && frame->depth.id)
+			list[count++] = (frame->depth.format == GL_DEPTH_STENCIL)
+				? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+
+		if (count == 0) return;
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frame->fbo);
+		glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, count, list);
+	}
+
+	void execute()
+	{
+		if (!compiled) compile();
+
+		for (int i = 0; i < numPasses; i++)
+		{
+			GraphPass* pass = &passes[i];
+			if (pass->culled) continue;
+
+			// targets first used here come out of the pool
+			// (anything released earlier this frame may be handed back)
+			if (pass->write >= 0)
+			{
+				GraphResource* res = &resources[pass->write];
+				if (!res->imported && res->firstPass == i)
+					res->slot = acquireFrame(res->desc);
+			}
+
+			Frame* target = (pass->write >= 0) ? frame(pass->write) : 0;
+			if (target) enableFrame(target);
+			else if (pass->write >= 0) defaultFrame();
+
+			pass->execute(this, pass->user);
+
+			// attachments nobody reads never need to leave the GPU
+			if (pass->write >= 0)
+			{
+				GraphResource* res = &resources[pass->write];
+				if (!res->imported && res->lastPass > i)
+					invalidate(target, ~res->readMask);
+			}
+
+			// resources whose lifetime ends here go back to the pool
+			for (int r = 0; r <= pass->numReads; r++)
+			{
+				int id = (r < pass->numReads) ? pass->reads[r] : pass->write;
+				if (id < 0) continue;
+
+				GraphResource* res = &resources[id];
+				if (res->imported || res->lastPass != i || res->slot < 0) continue;
+
+				invalidate(pooledFrame(res->slot), HL_ATTACH_COLOR | HL_ATTACH_DEPTH);
+				releaseFrame(res->slot);
+				res->slot = -1;
+			}
+		}
+
+		defaultFrame();
+	}
+};
+
+RenderGraph createRenderGraph()
+{
+	RenderGraph ret;
+	ret.reset();
+	return ret;
+}
\ No newline at end of file
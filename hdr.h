@@ -0,0 +1,330 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//
+// HDR pixel formats
+//
+// float pixels packed into formats GL samples directly, at a quarter
+// or half the size of RGBA32F:
+//  GL_RGB9_E5        4 bytes, three 9 bit mantissas and one shared exponent
+//  GL_R11F_G11F_B10F 4 bytes, unsigned 6+5 / 6+5 / 5+5 bit floats
+//  16F               2 bytes per channel, any channel count
+//
+// negative values and NaNs become 0 in the two packed formats
+// (they can't hold them); half floats keep them, and round to
+// nearest even like GPUs do
+//
+// no GL calls, so texturecomp shares this with the library
+//
+
+#ifndef GL_RGB9_E5
+#define GL_FLOAT 0x1406
+#define GL_HALF_FLOAT 0x140B
+#define GL_R16F 0x822D
+#define GL_RG16F 0x822F
+#define GL_RGB16F 0x881B
+#define GL_RGBA16F 0x881A
+#define GL_R32F 0x822E
+#define GL_RG32F 0x8230
+#define GL_RGB32F 0x8815
+#define GL_RGBA32F 0x8814
+#define GL_RGB9_E5 0x8C3D
+#define GL_R11F_G11F_B10F 0x8C3A
+#endif
+
+#define HL_RGB9E5_MAX 65408.0f // (511/512) * 2^16
+#define HL_R11G11B10F_MAX 65000.0f // rounds to the largest finite 11 and 10 bit floats
+
+// the sized internal format for packing 'channels' channels as 'format':
+// GL_RGB9_E5 or GL_R11F_G11F_B10F (always 3 channels),
+// GL_HALF_FLOAT or GL_FLOAT (16F or 32F with as many channels)
+inline
+unsigned int hdrInternalFormat(unsigned int format, int channels)
+{
+	if (format == GL_RGB9_E5 || format == GL_R11F_G11F_B10F) return format;
+
+	unsigned int half[] = {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F};
+	unsigned int full[] = {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F};
+
+	if (channels < 1 || channels > 4) return 0;
+	if (format == GL_HALF_FLOAT) return half[channels - 1];
+	if (format == GL_FLOAT) return full[channels - 1];
+	return 0;
+}
+
+inline
+int hdrPixelBytes(unsigned int internal, int channels)
+{
+	if (internal == GL_RGB9_E5 || internal == GL_R11F_G11F_B10F) return 4;
+	if (internal == GL_R16F || internal == GL_RG16F || internal == GL_RGB16F || internal == GL_RGBA16F) return 2 * channels;
+	return 4 * channels;
+}
+
+//
+// Scalar
+//
+
+union HdrBits
+{
+	float f;
+	unsigned int u;
+};
+
+inline
+unsigned short floatToHalf(float value)
+{
+	HdrBits f, o;
+	f.f = value;
+	o.u = 0;
+
+	unsigned int sign = f.u & 0x80000000;
+	f.u ^= sign;
+
+	if (f.u >= (127 + 16) << 23) o.u = (f.u > 255 << 23) ? 0x7e00 : 0x7c00; // Inf or NaN
+	else if (f.u < (127 - 14) << 23)
+	{
+		// half subnormal or zero: let the FPU round it into place
+		HdrBits magic;
+		magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+		f.f += magic.f;
+		o.u = f.u - magic.u;
+	}
+	else
+	{
+		unsigned int odd = (f.u >> 13) & 1;
+		f.u += ((unsigned int)(15 - 127) << 23) + 0xfff + odd;
+		o.u = f.u >> 13;
+	}
+
+	return o.u | (sign >> 16);
+}
+
+void packHalfScalar(const float* in, unsigned short* out, int count)
+{
+	for (int i = 0; i < count; i++) out[i] = floatToHalf(in[i]);
+}
+
+// 11 and 10 bit floats are halves with the sign and low mantissa bits dropped
+inline
+unsigned int packR11G11B10FPixel(const float* rgb)
+{
+	unsigned int ret = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		float v = (rgb[c] > 0) ? rgb[c] : 0; // catches NaN too
+		if (v > HL_R11G11B10F_MAX) v = HL_R11G11B10F_MAX;
+
+		unsigned int h = floatToHalf(v);
+		int drop = (c == 2) ? 5 : 4;
+		unsigned int max = (c == 2) ? 0x3df : 0x7bf;
+
+		unsigned int bits = (h + (1 << (drop - 1)) - 1 + ((h >> drop) & 1)) >> drop;
+		if (bits > max) bits = max;
+		ret |= bits << (c * 11);
+	}
+	return ret;
+}
+
+void packR11G11B10FScalar(const float* in, unsigned int* out, int pixels)
+{
+	for (int i = 0; i < pixels; i++) out[i] = packR11G11B10FPixel(in + i * 3);
+}
+
+// as in EXT_texture_shared_exponent, with floor(log2) read off the exponent bits
+inline
+unsigned int packRGB9E5Pixel(const float* rgb)
+{
+	float c[3];
+	for (int i = 0; i < 3; i++)
+	{
+		c[i] = (rgb[i] > 0) ? rgb[i] : 0;
+		if (c[i] > HL_RGB9E5_MAX) c[i] = HL_RGB9E5_MAX;
+	}
+
+	HdrBits max;
+	max.f = (c[0] > c[1]) ? c[0] : c[1];
+	if (c[2] > max.f) max.f = c[2];
+
+	int exp = (int)(max.u >> 23) - 127 + 16;
+	if (exp < 0) exp = 0;
+
+	// 2^-(exp - 15 - 9)
+	HdrBits scale;
+	scale.u = (151 - exp) << 23;
+
+	if ((int)(max.f * scale.f + 0.5f) == 512)
+	{
+		exp++;
+		scale.u = (151 - exp) << 23;
+	}
+
+	unsigned int ret = (unsigned int)exp << 27;
+	for (int i = 0; i < 3; i++) ret |= (unsigned int)(int)(c[i] * scale.f + 0.5f) << (i * 9);
+	return ret;
+}
+
+void packRGB9E5Scalar(const float* in, unsigned int* out, int pixels)
+{
+	for (int i = 0; i < pixels; i++) out[i] = packRGB9E5Pixel(in + i * 3);
+}
+
+//
+// SIMD
+//
+
+#ifdef __SSE2__
+
+// four floats to halves in the low 16 bits of each lane, sign extended
+// so _mm_packs_epi32 narrows them without saturating
+inline
+__m128i floatToHalf4(__m128 f)
+{
+	__m128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+	__m128 absf = _mm_xor_ps(f, sign);
+	__m128i bits = _mm_castps_si128(absf);
+
+	__m128i regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), bits);
+	__m128i nan = _mm_castps_si128(_mm_cmpunord_ps(absf, absf));
+	__m128i special = _mm_or_si128(_mm_and_si128(nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+	// half subnormal or zero
+	__m128i magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(magic))), magic);
+	__m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), bits);
+
+	// normal: rebias, round to nearest even
+	__m128i odd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+	__m128i normal = _mm_add_epi32(bits, _mm_set1_epi32(0xfff - ((127 - 15) << 23)));
+	normal = _mm_srli_epi32(_mm_sub_epi32(normal, odd), 13);
+
+	__m128i ret = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+	ret = _mm_or_si128(_mm_and_si128(regular, ret), _mm_andnot_si128(regular, special));
+	return _mm_or_si128(ret, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+void packHalf(const float* in, unsigned short* out, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo = floatToHalf4(_mm_loadu_ps(in + i));
+		__m128i hi = floatToHalf4(_mm_loadu_ps(in + i + 4));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+	}
+	packHalfScalar(in + i, out + i, count - i);
+}
+
+// each load takes a pixel and the next one's red, which the transpose
+// leaves in the unused 4th row; so the last group of 4 has to have one
+// more pixel after it, and the rest goes scalar
+#define HL_LOAD_RGB4(in, r, g, b) \
+	__m128 r = _mm_loadu_ps(in); \
+	__m128 g = _mm_loadu_ps(in + 3); \
+	__m128 b = _mm_loadu_ps(in + 6); \
+	__m128 r##_a = _mm_loadu_ps(in + 9); \
+	_MM_TRANSPOSE4_PS(r, g, b, r##_a)
+
+inline
+__m128i packUnsignedFloat4(__m128 v, __m128 max, int drop, int maxBits)
+{
+	// max first: _mm_max_ps returns its second operand for NaN
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max);
+
+	__m128i h = floatToHalf4(v);
+	__m128i odd = _mm_and_si128(_mm_srli_epi32(h, drop), _mm_set1_epi32(1));
+	h = _mm_add_epi32(h, _mm_add_epi32(odd, _mm_set1_epi32((1 << (drop - 1)) - 1)));
+	h = _mm_srli_epi32(h, drop);
+
+	// the high halves are 0, so a 16 bit min works on 32 bit lanes
+	return _mm_min_epi16(h, _mm_set1_epi32(maxBits));
+}
+
+void packR11G11B10F(const float* in, unsigned int* out, int pixels)
+{
+	__m128 max = _mm_set1_ps(HL_R11G11B10F_MAX);
+
+	int i = 0;
+	for (; i + 5 <= pixels; i += 4)
+	{
+		HL_LOAD_RGB4(in + i * 3, r, g, b);
+
+		__m128i packed = packUnsignedFloat4(r, max, 4, 0x7bf);
+		packed = _mm_or_si128(packed, _mm_slli_epi32(packUnsignedFloat4(g, max, 4, 0x7bf), 11));
+		packed = _mm_or_si128(packed, _mm_slli_epi32(packUnsignedFloat4(b, max, 5, 0x3df), 22));
+		_mm_storeu_si128((__m128i*)(out + i), packed);
+	}
+	packR11G11B10FScalar(in + i * 3, out + i, pixels - i);
+}
+
+void packRGB9E5(const float* in, unsigned int* out, int pixels)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 limit = _mm_set1_ps(HL_RGB9E5_MAX);
+	__m128 half = _mm_set1_ps(0.5f);
+
+	int i = 0;
+	for (; i + 5 <= pixels; i += 4)
+	{
+		HL_LOAD_RGB4(in + i * 3, r, g, b);
+
+		r = _mm_min_ps(_mm_max_ps(r, zero), limit);
+		g = _mm_min_ps(_mm_max_ps(g, zero), limit);
+		b = _mm_min_ps(_mm_max_ps(b, zero), limit);
+		__m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+
+		// shared exponent from the largest channel's exponent bits
+		__m128i exp = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(max), 23), _mm_set1_epi32(127 - 16));
+		exp = _mm_and_si128(exp, _mm_cmpgt_epi32(exp, _mm_setzero_si128()));
+
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(151), exp), 23));
+
+		// the largest rounding up to 512 needs one more exponent step
+		__m128i top = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(max, scale), half));
+		__m128i carry = _mm_cmpeq_epi32(top, _mm_set1_epi32(512));
+		exp = _mm_sub_epi32(exp, carry);
+		scale = _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(scale), _mm_slli_epi32(carry, 23)));
+
+		__m128i packed = _mm_slli_epi32(exp, 27);
+		packed = _mm_or_si128(packed, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half)));
+		packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half)), 9));
+		packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half)), 18));
+		_mm_storeu_si128((__m128i*)(out + i), packed);
+	}
+	packRGB9E5Scalar(in + i * 3, out + i, pixels - i);
+}
+
+#undef HL_LOAD_RGB4
+
+#else
+
+void packHalf(const float* in, unsigned short* out, int count) { packHalfScalar(in, out, count); }
+void packR11G11B10F(const float* in, unsigned int* out, int pixels) { packR11G11B10FScalar(in, out, pixels); }
+void packRGB9E5(const float* in, unsigned int* out, int pixels) { packRGB9E5Scalar(in, out, pixels); }
+
+#endif
+
+// pack 'pixels' pixels of 'channels' floats for the sized format
+// 'internal' (see hdrInternalFormat); returns a malloc'd buffer
+// of hdrPixelBytes(internal, channels) per pixel, 0 on failure;
+// the packed formats take exactly 3 channels
+void* packHdr(const float* in, int pixels, int channels, unsigned int internal)
+{
+	if ((internal == GL_RGB9_E5 || internal == GL_R11F_G11F_B10F) && channels != 3) return 0;
+
+	void* ret = malloc((size_t)pixels * hdrPixelBytes(internal, channels));
+	if (!ret) return 0;
+
+	if (internal == GL_RGB9_E5) packRGB9E5(in, (unsigned int*)ret, pixels);
+	else if (internal == GL_R11F_G11F_B10F) packR11G11B10F(in, (unsigned int*)ret, pixels);
+	else if (hdrPixelBytes(internal, channels) == 2 * channels) packHalf(in, (unsigned short*)ret, pixels * channels);
+	else memcpy(ret, in, (size_t)pixels * channels * sizeof(float));
+
+	return ret;
+}
\ No newline at end of file
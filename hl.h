@@ -24,10 +24,27 @@ using namespace glm;
 #include <ext.h>
 
 #include "core.h"
+#include "trace.h"
+#include "jobs.h"
+#include "alloc.h"
+#include "hdr.h"
 #include "texture.h"
+#include "residency.h"
+#include "streaming.h"
 #include "frame.h"
+#include "graph.h"
+#include "readback.h"
 #include "shader.h"
+#include "uniform.h"
+#include "resolution.h"
+#include "virtual.h"
+#include "anim.h"
 #include "mesh.h"
+#include "meshlet.h"
+#include "render.h"
+#include "commands.h"
+#include "upload.h"
+#include "lights.h"
 
 //
 // CORE
@@ -35,9 +52,20 @@ using namespace glm;
  
 void setup()
 {
+	// HL_TRACE=path records every GL call from here on,
+	// for HL_TRACE_FRAMES frames if that's set (see trace.h)
+	char* trace = getenv("HL_TRACE");
+	char* frames = getenv("HL_TRACE_FRAMES");
+	if (trace) startTrace(trace, (frames) ? atoi(frames) : 0);
+	
+	setupParallelShaderCompile();
+	
+	// resolved on first use, so texture setup overlaps the compile
+	hl_textureShader = submitShader(TEXTURE_SHADER_VS, TEXTURE_SHADER_FS);
 	setupTextures();
-	hl_textureShader = createShader(TEXTURE_SHADER_VS, TEXTURE_SHADER_FS);
+	setupUniformRing();
 	hl_textureShader.setName("hlTextureShader");
+	bindUniformBlock(&hl_textureShader, "hlDraw", HL_DRAW_BINDING);
 }
 
 //
@@ -48,8 +76,8 @@ void drawTexture(Texture texture, int x, int y, int width, int height, Color col
 {
 	useShader(&hl_textureShader);
 	
-	vec4 glm_color(color.r, color.g, color.b, color.a);
-	hl_textureShader.setVec4("diffuse", glm_color);
+	DrawBlock draw;
+	draw.diffuse = vec4(color.r, color.g, color.b, color.a);
 	hl_textureShader.setTexture("texture", texture);
 	
 	//
@@ -67,7 +95,8 @@ void drawTexture(Texture texture, int x, int y, int width, int height, Color col
 	transform *= translate(vec3((float)(2*x/w - 1), (float)(2*y/h - 1), 0.0));
 	transform *= scale(vec3((float)width/w, (float)height/h, 1.0));
 	
-	hl_textureShader.setMat4("transform", transform);
+	draw.transform = transform;
+	if (!bindUniforms(pushUniforms(&draw, sizeof(draw)), HL_DRAW_BINDING)) return;
 	
 	glBindVertexArray(hl_textureQuad);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
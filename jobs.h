@@ -0,0 +1,311 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+//
+// Jobs
+//
+// work-stealing scheduler: every worker, and the main thread,
+// owns a deque; it pushes and pops its own jobs at the back while
+// idle workers steal from the front of the others
+//
+// jobs are a function over an index range; a JobCounter tracks
+// how many are unfinished, jobs can be held back until a counter
+// reaches zero, and a thread waiting on a counter runs jobs itself
+// instead of sleeping
+//
+// workers are opt-in (init's 'jobThreads', or startJobs); without
+// them (or with one thread) every job simply runs on the thread
+// that submits it
+//
+
+#define HL_MAX_WORKERS 64
+#define HL_JOB_QUEUE 4096 // jobs per deque
+#define HL_JOB_CONTINUATIONS 16 // jobs waiting on one counter
+
+typedef void (*JobFunc)(void* user, int begin, int end);
+
+struct JobCounter;
+
+struct Job
+{
+	JobFunc func;
+	void* user;
+	int begin, end;
+	JobCounter* counter; // decremented when the job finishes, may be 0
+};
+
+struct JobCounter
+{
+	std::atomic<int> pending;
+
+	// jobs to push once pending reaches zero
+	std::mutex lock;
+	Job continuations[HL_JOB_CONTINUATIONS];
+	int numContinuations;
+
+	JobCounter() : pending(0), numContinuations(0) {}
+};
+
+struct JobQueue
+{
+	std::mutex lock;
+	Job jobs[HL_JOB_QUEUE];
+	int head, tail; // steal at head, push/pop at tail
+};
+
+struct
+{
+	JobQueue queues[HL_MAX_WORKERS + 1]; // 0 is the main thread
+	std::thread workers[HL_MAX_WORKERS];
+	int numWorkers = 0;
+
+	std::atomic<int> queued{0}; // jobs sitting in queues
+	std::mutex sleepLock; // raising 'queued' and stopping happen under this
+	std::condition_variable wake;
+	std::atomic<int> running{0};
+
+	std::atomic<u64> executed{0};
+	std::atomic<u64> steals{0};
+}
+hl_jobs;
+
+// deque of the calling thread; threads outside the system use 0,
+// which only ever costs them some contention on the main deque
+thread_local int hl_jobWorker = 0;
+
+int pushJob(Job job)
+{
+	if (!hl_jobs.numWorkers) return 0;
+
+	JobQueue* q = &hl_jobs.queues[hl_jobWorker];
+	{
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (q->tail - q->head >= HL_JOB_QUEUE) return 0;
+
+		q->jobs[q->tail % HL_JOB_QUEUE] = job;
+		q->tail++;
+	}
+
+	// under the lock, so a worker between checking 'queued'
+	// and going to sleep can't miss it
+	{
+		std::lock_guard<std::mutex> guard(hl_jobs.sleepLock);
+		hl_jobs.queued++;
+	}
+	hl_jobs.wake.notify_one();
+	return 1;
+}
+
+int popJob(Job* job)
+{
+	JobQueue* q = &hl_jobs.queues[hl_jobWorker];
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->tail == q->head) return 0;
+
+	q->tail--;
+	*job = q->jobs[q->tail % HL_JOB_QUEUE];
+	hl_jobs.queued--;
+	return 1;
+}
+
+int stealJob(Job* job)
+{
+	int queues = hl_jobs.numWorkers + 1;
+	for (int i = 1; i < queues; i++)
+	{
+		JobQueue* q = &hl_jobs.queues[(hl_jobWorker + i) % queues];
+
+		std::unique_lock<std::mutex> guard(q->lock, std::try_to_lock);
+		if (!guard.owns_lock() || q->tail == q->head) continue;
+
+		*job = q->jobs[q->head % HL_JOB_QUEUE];
+		q->head++;
+		hl_jobs.queued--;
+		hl_jobs.steals++;
+		return 1;
+	}
+	return 0;
+}
+
+void submitJob(Job job);
+
+void finishJob(JobCounter* counter)
+{
+	if (!counter) return;
+
+	// the decrement happens under the lock, and waiters take the lock
+	// after seeing zero, so the counter outlives this function
+	Job continuations[HL_JOB_CONTINUATIONS];
+	int count = 0;
+	{
+		std::lock_guard<std::mutex> guard(counter->lock);
+		if (counter->pending.fetch_sub(1) == 1)
+		{
+			// last one out releases whatever waited on the counter
+			count = counter->numContinuations;
+			for (int i = 0; i < count; i++) continuations[i] = counter->continuations[i];
+			counter->numContinuations = 0;
+		}
+	}
+
+	for (int i = 0; i < count; i++) submitJob(continuations[i]);
+}
+
+inline
+void executeJob(Job* job)
+{
+	job->func(job->user, job->begin, job->end);
+	hl_jobs.executed++;
+	finishJob(job->counter);
+}
+
+// run the job now if no one else could
+void submitJob(Job job)
+{
+	if (!pushJob(job)) executeJob(&job);
+}
+
+// run one queued job on this thread; 0 if there was none
+int helpJobs()
+{
+	Job job;
+	if (popJob(&job) || stealJob(&job))
+	{
+		executeJob(&job);
+		return 1;
+	}
+	return 0;
+}
+
+void jobWorker(int index)
+{
+	hl_jobWorker = index;
+
+	while (hl_jobs.running)
+	{
+		if (helpJobs()) continue;
+
+		std::unique_lock<std::mutex> guard(hl_jobs.sleepLock);
+		hl_jobs.wake.wait(guard, []{ return hl_jobs.queued > 0 || !hl_jobs.running; });
+	}
+}
+
+// 'threads' includes the main thread; 0 = one per core
+void startJobs(int threads = 0)
+{
+	if (hl_jobs.numWorkers) return;
+
+	if (threads <= 0) threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	if (threads > HL_MAX_WORKERS + 1) threads = HL_MAX_WORKERS + 1;
+
+	for (int i = 0; i <= HL_MAX_WORKERS; i++)
+	{
+		hl_jobs.queues[i].head = 0;
+		hl_jobs.queues[i].tail = 0;
+	}
+
+	hl_jobWorker = 0;
+	hl_jobs.running = 1;
+	hl_jobs.numWorkers = threads - 1;
+	for (int i = 0; i < hl_jobs.numWorkers; i++)
+		hl_jobs.workers[i] = std::thread(jobWorker, i + 1);
+}
+
+// finishes everything still queued first
+void stopJobs()
+{
+	if (!hl_jobs.numWorkers) return;
+
+	while (helpJobs());
+
+	{
+		std::lock_guard<std::mutex> guard(hl_jobs.sleepLock);
+		hl_jobs.running = 0;
+	}
+	hl_jobs.wake.notify_all();
+	for (int i = 0; i < hl_jobs.numWorkers; i++) hl_jobs.workers[i].join();
+	hl_jobs.numWorkers = 0;
+}
+
+inline
+int jobThreads()
+{
+	return hl_jobs.numWorkers + 1;
+}
+
+// func(user, begin, end) over [begin, end)
+void runJob(JobFunc func, void* user, int begin, int end, JobCounter* counter = 0)
+{
+	if (counter) counter->pending++;
+
+	Job job = {func, user, begin, end, counter};
+	submitJob(job);
+}
+
+// help out until the counter reaches zero
+void waitJobs(JobCounter* counter)
+{
+	while (counter->pending > 0)
+	{
+		if (!helpJobs()) std::this_thread::yield();
+	}
+
+	// let the last finishJob leave before the counter can go away
+	std::lock_guard<std::mutex> guard(counter->lock);
+}
+
+// like runJob, but held back until 'after' reaches zero
+void runJobAfter(JobCounter* after, JobFunc func, void* user, int begin, int end, JobCounter* counter = 0)
+{
+	if (counter) counter->pending++;
+	Job job = {func, user, begin, end, counter};
+
+	{
+		std::lock_guard<std::mutex> guard(after->lock);
+		if (after->pending > 0 && after->numContinuations < HL_JOB_CONTINUATIONS)
+		{
+			after->continuations[after->numContinuations++] = job;
+			return;
+		}
+	}
+
+	// already done (or too many waiting, so wait here)
+	waitJobs(after);
+	submitJob(job);
+}
+
+// func over [0, count) in chunks of 'grain'; waits unless a counter is given
+void parallelFor(int count, int grain, JobFunc func, void* user, JobCounter* counter = 0)
+{
+	if (count <= 0) return;
+	if (grain < 1) grain = 1;
+
+	if (!hl_jobs.numWorkers || count <= grain)
+	{
+		if (counter) runJob(func, user, 0, count, counter);
+		else func(user, 0, count);
+		return;
+	}
+
+	JobCounter local;
+	JobCounter* c = (counter) ? counter : &local;
+
+	// queue all but the first chunk, which this thread takes
+	for (int begin = grain; begin < count; begin += grain)
+	{
+		int end = (begin + grain < count) ? begin + grain : count;
+		runJob(func, user, begin, end, c);
+	}
+
+	c->pending++;
+	Job first = {func, user, 0, grain, c};
+	executeJob(&first);
+
+	if (!counter) waitJobs(&local);
+}
\ No newline at end of file
@@ -0,0 +1,478 @@
+#pragma once
+
+//
+// Clustered lights
+//
+// the view frustum is cut into HL_CLUSTER_X by HL_CLUSTER_Y tiles on
+// screen and HL_CLUSTER_Z slices in depth (exponentially spaced, so
+// clusters stay roughly cube shaped); every frame clusterLights tests
+// each light's bounding sphere against the clusters' view space boxes,
+// four clusters at a time, and uploads one compact list of light
+// indices per cluster
+//
+// a fragment finds its cluster from gl_FragCoord and only loops over
+// the lights in it (see HL_CLUSTERED_LIGHTS_GLSL), so shading cost
+// follows how many lights overlap that spot, not how many there are
+//
+// slices are independent, so they're spread over the job system;
+// within a slice lights are added in index order, so the lists come
+// out the same on any thread count
+//
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// HL_CLUSTERED_LIGHTS_GLSL has the grid size written in
+#define HL_CLUSTER_X 16
+#define HL_CLUSTER_Y 9
+#define HL_CLUSTER_Z 24
+#define HL_CLUSTER_TILES (HL_CLUSTER_X * HL_CLUSTER_Y) // per slice, a multiple of 4
+#define HL_CLUSTERS (HL_CLUSTER_TILES * HL_CLUSTER_Z)
+#define HL_CLUSTER_MAX_LIGHTS 128 // per cluster, at most 255
+
+#define HL_POINT_LIGHT -2.0f // cosOuter of point lights
+
+// the layout the shader reads, three texels per light
+struct Light
+{
+	vec3 position; // world space
+	float radius; // no light past this distance
+	vec3 color; // premultiplied by intensity
+	float cosInner; // spots: full strength inside this cone
+	vec3 direction; // spots only
+	float cosOuter; // spots: no light outside this cone, HL_POINT_LIGHT otherwise
+};
+
+static_assert(sizeof(Light) == 48, "Light layout");
+
+Light pointLight(vec3 position, float radius, vec3 color)
+{
+	Light ret;
+	ret.position = position;
+	ret.radius = radius;
+	ret.color = color;
+	ret.cosInner = 1;
+	ret.direction = vec3(0, 0, -1);
+	ret.cosOuter = HL_POINT_LIGHT;
+	return ret;
+}
+
+// angles in radians, from the axis to the edge of the cone
+Light spotLight(vec3 position, vec3 direction, float radius, vec3 color, float inner, float outer)
+{
+	Light ret;
+	ret.position = position;
+	ret.radius = radius;
+	ret.color = color;
+	ret.cosInner = cosf(inner);
+	ret.direction = normalize(direction);
+	ret.cosOuter = cosf(outer);
+	return ret;
+}
+
+// a light's bounding sphere in view space and the slices it spans
+struct ClusterLight
+{
+	float x, y, z, radius;
+	int first, last;
+};
+
+struct LightStats
+{
+	int lights;
+	int indices; // total over all clusters
+	int maxPerCluster;
+	int overflowed; // light-cluster pairs dropped from full clusters
+};
+
+struct
+{
+	mat4 view;
+	float fov, aspect, nearClip, farClip;
+
+	// view space box of every cluster, per slice as
+	// min x, y, z, max x, y, z arrays of HL_CLUSTER_TILES each
+	float* bounds;
+
+	uint lightBuffer, gridBuffer, indexBuffer;
+	u64 lightCapacity, gridCapacity, indexCapacity;
+	Texture lights; // RGBA32F, 3 texels per light
+	Texture grid; // R32UI, first index << 8 | count per cluster
+	Texture indices; // R16UI
+
+	LightStats stats;
+}
+hl_lights;
+
+inline
+int sliceOf(float depth)
+{
+	float s = logf(depth / hl_lights.nearClip) / logf(hl_lights.farClip / hl_lights.nearClip) * HL_CLUSTER_Z;
+	if (s < 0) return 0;
+	if (s >= HL_CLUSTER_Z) return HL_CLUSTER_Z - 1;
+	return (int)s;
+}
+
+inline
+float sliceDepth(int slice)
+{
+	return hl_lights.nearClip * powf(hl_lights.farClip / hl_lights.nearClip, (float)slice / HL_CLUSTER_Z);
+}
+
+// the camera for this frame (Camera's fov, nearClip and farClip);
+// cluster boxes are only rebuilt when the projection changes
+void setLightView(mat4 view, float fov, float aspect, float nearClip, float farClip)
+{
+	hl_lights.view = view;
+
+	if (hl_lights.bounds && fov == hl_lights.fov && aspect == hl_lights.aspect
+		&& nearClip == hl_lights.nearClip && farClip == hl_lights.farClip) return;
+
+	hl_lights.fov = fov;
+	hl_lights.aspect = aspect;
+	hl_lights.nearClip = nearClip;
+	hl_lights.farClip = farClip;
+
+	if (!hl_lights.bounds) hl_lights.bounds = (float*) malloc(HL_CLUSTERS * 6 * sizeof(float));
+
+	float tanY = tanf(fov * 0.5f);
+	float tanX = tanY * aspect;
+
+	for (int z = 0; z < HL_CLUSTER_Z; z++)
+	{
+		float dn = sliceDepth(z), df = sliceDepth(z + 1);
+		float* b = hl_lights.bounds + z * 6 * HL_CLUSTER_TILES;
+
+		for (int y = 0; y < HL_CLUSTER_Y; y++)
+		{
+			for (int x = 0; x < HL_CLUSTER_X; x++)
+			{
+				int tile = y * HL_CLUSTER_X + x;
+
+				// tile edges in NDC, scaled out to both depths
+				float x0 = -1 + 2.0f * x / HL_CLUSTER_X, x1 = -1 + 2.0f * (x + 1) / HL_CLUSTER_X;
+				float y0 = -1 + 2.0f * y / HL_CLUSTER_Y, y1 = -1 + 2.0f * (y + 1) / HL_CLUSTER_Y;
+
+				b[tile] = fminf(x0 * tanX * dn, x0 * tanX * df);
+				b[tile + HL_CLUSTER_TILES] = fminf(y0 * tanY * dn, y0 * tanY * df);
+				b[tile + HL_CLUSTER_TILES * 2] = -df;
+				b[tile + HL_CLUSTER_TILES * 3] = fmaxf(x1 * tanX * dn, x1 * tanX * df);
+				b[tile + HL_CLUSTER_TILES * 4] = fmaxf(y1 * tanY * dn, y1 * tanY * df);
+				b[tile + HL_CLUSTER_TILES * 5] = -dn;
+			}
+		}
+	}
+}
+
+// view space bounding sphere; spots use the sphere around their cone
+ClusterLight clusterLight(Light* light)
+{
+	vec3 center = light->position;
+	float radius = light->radius;
+
+	if (light->cosOuter > -1)
+	{
+		float c = light->cosOuter;
+		if (c > 0.70710678f)
+		{
+			radius = light->radius / (2 * c);
+			center = light->position + light->direction * radius;
+		}
+		else if (c > 0)
+		{
+			center = light->position + light->direction * (light->radius * c);
+			radius = light->radius * sqrtf(1 - c * c);
+		}
+	}
+
+	vec3 v = vec3(hl_lights.view * vec4(center, 1.0));
+
+	ClusterLight ret;
+	ret.x = v.x;
+	ret.y = v.y;
+	ret.z = v.z;
+	ret.radius = radius;
+
+	// behind the camera or past the far plane
+	float nearest = -v.z - radius, farthest = -v.z + radius;
+	if (farthest < hl_lights.nearClip || nearest > hl_lights.farClip)
+	{
+		ret.first = 1;
+		ret.last = 0;
+		return ret;
+	}
+
+	ret.first = sliceOf(fmaxf(nearest, hl_lights.nearClip));
+	ret.last = sliceOf(fminf(farthest, hl_lights.farClip));
+	return ret;
+}
+
+struct ClusterJob
+{
+	ClusterLight* lights;
+	int numLights;
+	u16* lists; // HL_CLUSTER_MAX_LIGHTS per cluster
+	u8* counts;
+	int* overflowed; // per slice
+	int scalar;
+};
+
+inline
+void addClusterLight(ClusterJob* job, int cluster, int light, int slice)
+{
+	u8* count = &job->counts[cluster];
+	if (*count == HL_CLUSTER_MAX_LIGHTS)
+	{
+		job->overflowed[slice]++;
+		return;
+	}
+	job->lists[cluster * HL_CLUSTER_MAX_LIGHTS + *count] = light;
+	(*count)++;
+}
+
+// one slice, one cluster at a time; used without SSE and by bench/
+void clusterSliceScalar(ClusterJob* job, int slice)
+{
+	float* b = hl_lights.bounds + slice * 6 * HL_CLUSTER_TILES;
+
+	for (int l = 0; l < job->numLights; l++)
+	{
+		ClusterLight* light = &job->lights[l];
+		if (slice < light->first || slice > light->last) continue;
+
+		for (int t = 0; t < HL_CLUSTER_TILES; t++)
+		{
+			float dx = fmaxf(0, b[t] - light->x) + fmaxf(0, light->x - b[t + HL_CLUSTER_TILES * 3]);
+			float dy = fmaxf(0, b[t + HL_CLUSTER_TILES] - light->y) + fmaxf(0, light->y - b[t + HL_CLUSTER_TILES * 4]);
+			float dz = fmaxf(0, b[t + HL_CLUSTER_TILES * 2] - light->z) + fmaxf(0, light->z - b[t + HL_CLUSTER_TILES * 5]);
+
+			if (dx * dx + dy * dy + dz * dz <= light->radius * light->radius)
+				addClusterLight(job, slice * HL_CLUSTER_TILES + t, l, slice);
+		}
+	}
+}
+
+void clusterSlice(ClusterJob* job, int slice)
+{
+#ifdef __SSE__
+	float* b = hl_lights.bounds + slice * 6 * HL_CLUSTER_TILES;
+	__m128 zero = _mm_setzero_ps();
+
+	for (int l = 0; l < job->numLights; l++)
+	{
+		ClusterLight* light = &job->lights[l];
+		if (slice < light->first || slice > light->last) continue;
+
+		__m128 x = _mm_set1_ps(light->x);
+		__m128 y = _mm_set1_ps(light->y);
+		__m128 z = _mm_set1_ps(light->z);
+		__m128 r2 = _mm_set1_ps(light->radius * light->radius);
+
+		// distance from the sphere's center to four boxes at once
+		for (int t = 0; t < HL_CLUSTER_TILES; t += 4)
+		{
+			__m128 dx = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(_mm_loadu_ps(b + t), x)),
+				_mm_max_ps(zero, _mm_sub_ps(x, _mm_loadu_ps(b + t + HL_CLUSTER_TILES * 3))));
+			__m128 dy = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(_mm_loadu_ps(b + t + HL_CLUSTER_TILES), y)),
+				_mm_max_ps(zero, _mm_sub_ps(y, _mm_loadu_ps(b + t + HL_CLUSTER_TILES * 4))));
+			__m128 dz = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(_mm_loadu_ps(b + t + HL_CLUSTER_TILES * 2), z)),
+				_mm_max_ps(zero, _mm_sub_ps(z, _mm_loadu_ps(b + t + HL_CLUSTER_TILES * 5))));
+
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+			while (mask)
+			{
+				int i = __builtin_ctz(mask);
+				mask &= mask - 1;
+				addClusterLight(job, slice * HL_CLUSTER_TILES + t + i, l, slice);
+			}
+		}
+	}
+#else
+	clusterSliceScalar(job, slice);
+#endif
+}
+
+void clusterJob(void* user, int begin, int end)
+{
+	ClusterJob* job = (ClusterJob*)user;
+	for (int slice = begin; slice < end; slice++)
+	{
+		if (job->scalar) clusterSliceScalar(job, slice);
+		else clusterSlice(job, slice);
+	}
+}
+
+// per cluster light lists, compacted; 'grid' and 'indices' come from frameAlloc
+void assignLights(Light* lights, int count, u32** grid, u16** indices, int scalar = false)
+{
+	if (count > 65535) count = 65535;
+
+	ClusterJob job;
+	job.lights = (ClusterLight*) frameAlloc(count * sizeof(ClusterLight) + 16);
+	job.numLights = count;
+	job.lists = (u16*) frameAlloc((u64)HL_CLUSTERS * HL_CLUSTER_MAX_LIGHTS * sizeof(u16));
+	job.counts = (u8*) frameAlloc(HL_CLUSTERS);
+	job.overflowed = (int*) frameAlloc(HL_CLUSTER_Z * sizeof(int));
+	job.scalar = scalar;
+
+	memset(job.counts, 0, HL_CLUSTERS);
+	memset(job.overflowed, 0, HL_CLUSTER_Z * sizeof(int));
+
+	for (int i = 0; i < count; i++) job.lights[i] = clusterLight(&lights[i]);
+
+	parallelFor(HL_CLUSTER_Z, 1, clusterJob, &job);
+
+	int total = 0, most = 0, overflowed = 0;
+	for (int c = 0; c < HL_CLUSTERS; c++)
+	{
+		total += job.counts[c];
+		if (job.counts[c] > most) most = job.counts[c];
+	}
+	for (int z = 0; z < HL_CLUSTER_Z; z++) overflowed += job.overflowed[z];
+
+	*grid = (u32*) frameAlloc(HL_CLUSTERS * sizeof(u32));
+	*indices = (u16*) frameAlloc(total * sizeof(u16) + 16);
+
+	int at = 0;
+	for (int c = 0; c < HL_CLUSTERS; c++)
+	{
+		int n = job.counts[c];
+		(*grid)[c] = ((u32)at << 8) | n;
+		memcpy(*indices + at, job.lists + c * HL_CLUSTER_MAX_LIGHTS, n * sizeof(u16));
+		at += n;
+	}
+
+	hl_lights.stats.lights = count;
+	hl_lights.stats.indices = total;
+	hl_lights.stats.maxPerCluster = most;
+	hl_lights.stats.overflowed = overflowed;
+}
+
+// (re)fill a buffer behind a buffer texture, orphaning last frame's
+void uploadTextureBuffer(uint* buffer, u64* capacity, Texture* texture, uint format, void* data, u64 size)
+{
+	if (!*buffer)
+	{
+		glGenBuffers(1, buffer);
+		glGenTextures(1, &texture->id);
+		texture->type = GL_TEXTURE_BUFFER;
+		texture->format = format;
+		texture->residency = -1;
+		texture->stream = -1;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+	if (size > *capacity) *capacity = size * 2;
+	glBufferData(GL_TEXTURE_BUFFER, *capacity, 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+
+	glBindTexture(GL_TEXTURE_BUFFER, texture->id);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// assign this frame's lights to clusters and upload them;
+// call after setLightView, then useClusteredLights on each shader
+void clusterLights(Light* lights, int count)
+{
+	if (!hl_lights.bounds)
+	{
+		fprintf(stderr, "[Lights] setLightView first\n");
+		return;
+	}
+
+	u32* grid;
+	u16* indices;
+	assignLights(lights, count, &grid, &indices);
+
+	if (hl_lights.stats.overflowed)
+		fprintf(stderr, "[Lights] %i lights dropped from full clusters\n", hl_lights.stats.overflowed);
+
+	// buffer textures can't be empty
+	Light none = pointLight(vec3(0), 0, vec3(0));
+	if (!count) lights = &none;
+
+	uploadTextureBuffer(&hl_lights.lightBuffer, &hl_lights.lightCapacity, &hl_lights.lights, GL_RGBA32F,
+		lights, (u64)((count) ? count : 1) * sizeof(Light));
+	uploadTextureBuffer(&hl_lights.gridBuffer, &hl_lights.gridCapacity, &hl_lights.grid, GL_R32UI,
+		grid, HL_CLUSTERS * sizeof(u32));
+	uploadTextureBuffer(&hl_lights.indexBuffer, &hl_lights.indexCapacity, &hl_lights.indices, GL_R16UI,
+		indices, (u64)hl_lights.stats.indices * sizeof(u16) + 16);
+}
+
+LightStats getLightStats()
+{
+	return hl_lights.stats;
+}
+
+// set the uniforms HL_CLUSTERED_LIGHTS_GLSL expects on the active shader
+void useClusteredLights()
+{
+	Shader* shader = activeShader;
+
+	int viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	float n = hl_lights.nearClip, f = hl_lights.farClip;
+	float scale = HL_CLUSTER_Z / logf(f / n);
+
+	shader->setTexture("hlLights", hl_lights.lights);
+	shader->setTexture("hlClusterGrid", hl_lights.grid);
+	shader->setTexture("hlClusterIndices", hl_lights.indices);
+	shader->setVec4("hlClusterViewport", vec4(viewport[0], viewport[1], viewport[2], viewport[3]));
+	shader->setVec4("hlClusterDepth", vec4(n, f, scale, -logf(n) * scale));
+}
+
+// clusterRange(viewDepth) is the (first, count) of the fragment's
+// lights in hlClusterIndices; clusteredLight adds up simple diffuse
+// from all of them (positions are world space, like the lights)
+#define HL_CLUSTERED_LIGHTS_GLSL "\
+\n uniform samplerBuffer hlLights; // 3 texels per light\
+\n uniform usamplerBuffer hlClusterGrid;\
+\n uniform usamplerBuffer hlClusterIndices;\
+\n uniform vec4 hlClusterViewport;\
+\n uniform vec4 hlClusterDepth; // near, far, slice scale, slice bias\
+\n \
+\n // distance along the view direction, from the depth buffer value\
+\n float clusterViewDepth()\
+\n {\
+\n 	float n = hlClusterDepth.x, f = hlClusterDepth.y;\
+\n 	float z = gl_FragCoord.z * 2.0 - 1.0;\
+\n 	return 2.0 * n * f / (f + n - z * (f - n));\
+\n }\
+\n \
+\n uvec2 clusterRange(float viewDepth)\
+\n {\
+\n 	vec2 screen = (gl_FragCoord.xy - hlClusterViewport.xy) / hlClusterViewport.zw;\
+\n 	ivec3 c = ivec3(screen * vec2(16.0, 9.0), log(viewDepth) * hlClusterDepth.z + hlClusterDepth.w);\
+\n 	c = clamp(c, ivec3(0), ivec3(15, 8, 23));\
+\n 	uint cell = texelFetch(hlClusterGrid, (c.z * 9 + c.y) * 16 + c.x).r;\
+\n 	return uvec2(cell >> 8u, cell & 255u);\
+\n }\
+\n \
+\n vec3 clusteredLight(vec3 position, vec3 normal)\
+\n {\
+\n 	uvec2 range = clusterRange(clusterViewDepth());\
+\n 	vec3 sum = vec3(0.0);\
+\n 	for (uint i = 0u; i < range.y; i++)\
+\n 	{\
+\n 		int light = int(texelFetch(hlClusterIndices, int(range.x + i)).r) * 3;\
+\n 		vec4 a = texelFetch(hlLights, light);\
+\n 		vec4 b = texelFetch(hlLights, light + 1);\
+\n 		vec4 c = texelFetch(hlLights, light + 2);\
+\n 		vec3 toLight = a.xyz - position;\
+\n 		float d = length(toLight);\
+\n 		vec3 l = toLight / max(d, 1e-4);\
+\n 		float window = clamp(1.0 - pow(d / a.w, 4.0), 0.0, 1.0);\
+\n 		float falloff = window * window / (d * d + 1.0);\
+\n 		float cone = (c.w < -1.0) ? 1.0 : smoothstep(c.w, b.w, dot(-l, c.xyz));\
+\n 		sum += b.rgb * max(dot(normal, l), 0.0) * falloff * cone;\
+\n 	}\
+\n 	return sum;\
+\n }\
+"
+"
\ No newline at end of file
@@ -12,6 +12,10 @@ struct Material
 	Component normal;
 	Component rough;
 	Component emission;
+	
+	// texture array slot per component when packed
+	// (array << 16 | layer), -1 if the component has no texture
+	int layer[5];
 };
 
 struct Vertex
@@ -23,34 +27,103 @@ struct Vertex
 	struct {float r, g, b, a;} color;
 };
 
+struct MeshletSet;
+int drawClusters(MeshletSet* set);
+
 struct Mesh
 {	
-	uint vao, vbo;
+	uint vao, vbo, ebo;
+	int residency; // residency tracking slot
+	
+	// tightly packed positions sharing the index buffer,
+	// for depth-only passes (0 if not uploaded)
+	uint positionVao, positionVbo;
+	
+	MeshletSet* clusters; // 0 if not split into meshlets (see meshlet.h)
 	
 	uint* indices;
 	uint numIndices;
 	
 	Vertex* vertices;
 	uint numVertices;
+	
+	// bone influences per vertex, 0 if the mesh isn't skinned
+	SkinVertex* skin;
+	uint skinVbo;
+	
+	int arenaData; // vertices and indices belong to an arena, not malloc
 
 	int materialId;
 	
-	void draw(Array<Material> materials)
+	// bounding sphere (object space) and texture coordinates
+	// per world unit, for estimating on-screen texel density
+	vec3 center;
+	float radius;
+	float uvDensity;
+	
+	// ask the streamer for the mip levels this mesh needs
+	void requestTextures(Array<Material>& materials, mat4& world)
+	{
+		if (materialId < 0) return;
+		Material* material = &materials[materialId];
+		
+		vec3 c = vec3(world * vec4(center, 1.0));
+		float scale = length(vec3(world[0]));
+		float density = (scale > 0) ? uvDensity / scale : uvDensity;
+		
+		requestTextureLevel(material->diffuse.texture, c, density);
+		requestTextureLevel(material->specular.texture, c, density);
+		requestTextureLevel(material->normal.texture, c, density);
+		requestTextureLevel(material->rough.texture, c, density);
+		requestTextureLevel(material->emission.texture, c, density);
+	}
+	
+	// only the meshlets that survived this frame's cullModel, if any
+	void drawElements(uint array)
+	{
+		if (!array) return; // still uploading
+		
+		glBindVertexArray(array);
+		if (!clusters || !drawClusters(clusters))
+			glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+	}
+	
+	// positions only; falls back to the full vertex stream
+	void drawPositions()
+	{
+		drawElements((positionVao) ? positionVao : vao);
+	}
+	
+	void draw(Array<Material> materials, UniformBuffer* materialBuffer = 0, int packed = false)
 	{		
 		char name[16];
 		Shader* shader = activeShader;
 		
 		Material* material = &materials[materialId];
 		
+		// material constants live in a static buffer built at load
+		if (materialBuffer)
+		{
+			uint stride = alignUniform(sizeof(MaterialBlock));
+			glBindBufferRange(GL_UNIFORM_BUFFER, HL_MATERIAL_BINDING, materialBuffer->id,
+				materialId * stride, sizeof(MaterialBlock));
+		}
+		
+		// textures come from the model's arrays, already bound
+		if (packed)
+		{
+			drawElements(vao);
+			return;
+		}
+		
 		shader->setTexture("diffuseTex", material->diffuse.texture);
 		shader->setTexture("specularTex", material->specular.texture);
 		shader->setTexture("normalTex", material->normal.texture);
 		shader->setTexture("roughTex", material->rough.texture);
 		shader->setTexture("emissionTex", material->emission.texture);
 		
-		glBindVertexArray(vao);
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, indices);
-		glBindVertexArray(0);
+		drawElements(vao);
 	}
 };
 
@@ -60,6 +133,13 @@ Mesh createMesh()
 	
 	ret.vao = 0;
 	ret.vbo = 0;
+	ret.ebo = 0;
+	ret.residency = -1;
+	
+	ret.positionVao = 0;
+	ret.positionVbo = 0;
+	
+	ret.clusters = 0;
 	
 	ret.indices = 0;
 	ret.numIndices = 0;
@@ -67,114 +147,265 @@ Mesh createMesh()
 	ret.vertices = 0;
 	ret.numVertices = 0;
 	
+	ret.skin = 0;
+	ret.skinVbo = 0;
+	
+	ret.arenaData = false;
+	
 	ret.materialId = -1;
+	
+	ret.center = vec3(0);
+	ret.radius = 0;
+	ret.uvDensity = 0;
 		
 	return ret;
 }
 
-Mesh createMesh(aiMesh* mesh, const aiScene* scene)
+//
+// Vertex conversion
+//
+// the attribute checks are made once per mesh, then every
+// attribute is moved into the interleaved vertex with one
+// unaligned 16 byte load and store; big meshes are split into jobs
+//
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define HL_CONVERT_GRAIN (1 << 16) // vertices per job
+
+void convertVertexRange(aiMesh* mesh, Vertex* out, uint begin, uint end)
 {
-	Mesh ret;
+	int normals = mesh->HasNormals();
+	int uvs = mesh->mTextureCoords[0] != 0;
+	int colors = mesh->HasVertexColors(0);
 	
-	// assume three vertices per face
-	// for simplicity
-	ret.numIndices = mesh->mNumFaces * 3;
-	ret.numVertices = mesh->mNumVertices;
+	// each load reads one float past the attribute, so the
+	// mesh's last vertex goes through the scalar path
+	uint wide = (end == mesh->mNumVertices && end > begin) ? end - 1 : end;
 	
-	ret.indices = (uint*) malloc(ret.numIndices * sizeof(uint));
-	ret.vertices = (Vertex*) malloc(ret.numVertices * sizeof(Vertex));
-
-	// collect vertex data
-	for (uint i = 0; i < mesh->mNumVertices; i++)
+#ifdef __SSE__
+	// stores run front to back through the vertex, each one
+	// overwriting the previous one's spare lane
+	__m128 up = _mm_setr_ps(0, 1, 0, 0);
+	__m128 white = _mm_set1_ps(255);
+	
+	for (uint i = begin; i < wide; i++)
 	{
-		// positions
-		ret.vertices[i].position.x = mesh->mVertices[i].x;
-		ret.vertices[i].position.y = mesh->mVertices[i].y;
-		ret.vertices[i].position.z = mesh->mVertices[i].z;
+		Vertex* v = &out[i];
+		_mm_storeu_ps(&v->position.x, _mm_loadu_ps(&mesh->mVertices[i].x));
+		_mm_storeu_ps(&v->normal.x, (normals) ? _mm_loadu_ps(&mesh->mNormals[i].x) : up);
 		
-		// normals
-		if (mesh->HasNormals())
-	{
-		ret.vertices[i].normal.x = mesh->mNormals[i].x;
-		ret.vertices[i].normal.y = mesh->mNormals[i].y;
-		ret.vertices[i].normal.z = mesh->mNormals[i].z;
+		__m128 uv = (uvs) ? _mm_loadu_ps(&mesh->mTextureCoords[0][i].x) : _mm_setzero_ps();
+		_mm_storeu_ps(&v->uv1.u, _mm_movelh_ps(uv, _mm_setzero_ps())); // uv1, uv2 = 0
+		
+		_mm_storeu_ps(&v->color.r, (colors) ? _mm_loadu_ps(&mesh->mColors[0][i].r) : white);
 	}
-		else
+#else
+	wide = begin;
+#endif
+	
+	for (uint i = wide; i < end; i++)
 	{
-		printf("No normals while loading mesh %p\n", &ret);
-		// NOTE: the address here is garbage, since ret is a
-		// temporary variable and gets deleted at the end of the function.
-		// nevertheless, it can be useful to distinguish, when loading
-		// multiple meshes, for debugging purposes
+		Vertex* v = &out[i];
+		aiVector3D p = mesh->mVertices[i];
+		v->position = {p.x, p.y, p.z};
 		
-		ret.vertices[i].normal = {0,1,0};
-	}
+		if (normals) v->normal = {mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z};
+		else v->normal = {0, 1, 0};
+		
+		if (uvs) v->uv1 = {mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y};
+		else v->uv1 = {0, 0};
+		v->uv2 = {0, 0};
 		
-		// texture coordinates
-		// there may be up to 8 different uv sets per vertex
-		// we assume only the first set is used
-		if (mesh->mTextureCoords[0])
+		if (colors)
+		{
+			aiColor4D c = mesh->mColors[0][i];
+			v->color = {c.r, c.g, c.b, c.a};
+		}
+		else v->color = {255, 255, 255, 255};
+	}
+}
+
+void convertIndexRange(aiMesh* mesh, uint* indices, uint begin, uint end)
+{
+	for (uint i = begin; i < end; i++)
 	{
-		ret.vertices[i].uv1.u = mesh->mTextureCoords[0][i].x;
-		ret.vertices[i].uv1.v = mesh->mTextureCoords[0][i].y;
+		// by reference: copying an aiFace copies its index array
+		const aiFace& face = mesh->mFaces[i];
+		indices[i * 3 + 0] = face.mIndices[0];
+		indices[i * 3 + 1] = face.mIndices[1];
+		indices[i * 3 + 2] = face.mIndices[2];
 	}
-		// if we didnt find a uv for the vertex,
-		// default to (0,0)
-		else
+}
+
+struct ConvertJob
+{
+	aiMesh* mesh;
+	Vertex* out;
+	uint* indices;
+};
+
+void convertVertexJob(void* user, int begin, int end)
+{
+	ConvertJob* job = (ConvertJob*)user;
+	convertVertexRange(job->mesh, job->out, begin, end);
+}
+
+void convertIndexJob(void* user, int begin, int end)
+{
+	ConvertJob* job = (ConvertJob*)user;
+	convertIndexRange(job->mesh, job->indices, begin, end);
+}
+
+void convertMesh(aiMesh* mesh, Vertex* out, uint* indices)
+{
+	if (!mesh->HasNormals()) printf("No normals while loading mesh %s\n", mesh->mName.C_Str());
+	
+	ConvertJob job = {mesh, out, indices};
+	
+	JobCounter done;
+	parallelFor(mesh->mNumVertices, HL_CONVERT_GRAIN, convertVertexJob, &job, &done);
+	parallelFor(mesh->mNumFaces, HL_CONVERT_GRAIN, convertIndexJob, &job, &done);
+	waitJobs(&done);
+}
+
+// with an arena the vertex and index data is allocated from it
+// and released when the arena is freed
+// with a skeleton, bone weights are imported too (see anim.h)
+Mesh createMesh(aiMesh* mesh, const aiScene* scene, Arena* arena = 0, Skeleton* skeleton = 0)
+{
+	Mesh ret = createMesh();
+	
+	// assume three vertices per face
+	// for simplicity
+	ret.numIndices = mesh->mNumFaces * 3;
+	ret.numVertices = mesh->mNumVertices;
+	
+	ret.arenaData = (arena != 0);
+	if (arena)
 	{
-		ret.vertices[i].uv1.u = 0.0;
-		ret.vertices[i].uv1.v = 0.0;
+		ret.vertices = (Vertex*) arenaAlloc(arena, ret.numVertices * sizeof(Vertex));
+		ret.indices = (uint*) arenaAlloc(arena, ret.numIndices * sizeof(uint));
 	}
-		// colors
-		// only use first set of colors if present
-		if (mesh->HasVertexColors(0))
+	else
 	{
-		ret.vertices[i].color.r = mesh->mColors[i]->r;
-		ret.vertices[i].color.g = mesh->mColors[i]->g;
-		ret.vertices[i].color.b = mesh->mColors[i]->b;
-		ret.vertices[i].color.a = mesh->mColors[i]->a;
+		ret.indices = (uint*) malloc(ret.numIndices * sizeof(uint));
+		ret.vertices = (Vertex*) malloc(ret.numVertices * sizeof(Vertex));
 	}
-		// default to white
-		else
+
+	convertMesh(mesh, ret.vertices, ret.indices);
+	
+	if (skeleton && mesh->HasBones())
 	{
-		ret.vertices[i].color = {255u,255u,255u,255u};
+		u64 skinBytes = ret.numVertices * sizeof(SkinVertex);
+		ret.skin = (SkinVertex*) ((arena) ? arenaAlloc(arena, skinBytes) : malloc(skinBytes));
+		convertSkin(mesh, skeleton, ret.skin);
 	}
 	
+	// material index
+	ret.materialId = mesh->mMaterialIndex;
+	
+	// bounds
+	vec3 lo = vec3(1e30), hi = vec3(-1e30);
+	for (uint i = 0; i < ret.numVertices; i++)
+	{
+		vec3 p = vec3(ret.vertices[i].position.x, ret.vertices[i].position.y, ret.vertices[i].position.z);
+		lo = min(lo, p);
+		hi = max(hi, p);
 	}
+	ret.center = (lo + hi) * 0.5f;
+	ret.radius = (ret.numVertices) ? length(hi - ret.center) : 0;
 	
-	// copy indices
-	for(uint i = 0; i < mesh->mNumFaces; i++)
+	// uv density: sqrt of uv area over world area
+	double uvArea = 0, worldArea = 0;
+	for (uint i = 0; i + 2 < ret.numIndices; i += 3)
 	{
-		aiFace face = mesh->mFaces[i];
+		Vertex* a = &ret.vertices[ret.indices[i]];
+		Vertex* b = &ret.vertices[ret.indices[i+1]];
+		Vertex* c = &ret.vertices[ret.indices[i+2]];
 		
-		ret.indices[i * 3 + 0] = face.mIndices[0];
-		ret.indices[i * 3 + 1] = face.mIndices[1];
-		ret.indices[i * 3 + 2] = face.mIndices[2];
+		vec3 e1 = vec3(b->position.x - a->position.x, b->position.y - a->position.y, b->position.z - a->position.z);
+		vec3 e2 = vec3(c->position.x - a->position.x, c->position.y - a->position.y, c->position.z - a->position.z);
+		worldArea += length(cross(e1, e2)) * 0.5;
+		
+		float u1 = b->uv1.u - a->uv1.u, v1 = b->uv1.v - a->uv1.v;
+		float u2 = c->uv1.u - a->uv1.u, v2 = c->uv1.v - a->uv1.v;
+		uvArea += fabs(u1 * v2 - u2 * v1) * 0.5;
 	}
-	
-	// material index
-	ret.materialId = mesh->mMaterialIndex;
+	ret.uvDensity = (worldArea > 0) ? sqrt(uvArea / worldArea) : 0;
 		
 	return ret;
 }
 
-void uploadMesh(Mesh& mesh)
+// buffer objects only: these are shared between contexts,
+// so this half of the upload can run on the upload thread
+// ('positionStream' also uploads positions on their own, 12 bytes
+// per vertex instead of 56, for depth-only passes)
+void uploadMeshBuffers(Mesh& mesh, int positionStream = false)
 {
-	glGenVertexArrays(1, &mesh.vao);
 	glGenBuffers(1, &mesh.vbo);
-
-	glBindVertexArray(mesh.vao);
+	glGenBuffers(1, &mesh.ebo);
 	
-	//
-	// Quite possible we don't even need this
-	// but leaving it here just in case
-	/*
+	// core profile can't draw from client-side indices,
+	// and it lets the CPU copy go once uploaded
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint) * mesh.numIndices, mesh.indices, GL_STATIC_DRAW);
-	*/
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * mesh.numVertices, mesh.vertices, GL_STATIC_DRAW); 
+	
+	if (positionStream)
+	{
+		float* positions = (float*) malloc((u64)mesh.numVertices * 3 * sizeof(float));
+		for (uint i = 0; i < mesh.numVertices; i++)
+		{
+			positions[i * 3 + 0] = mesh.vertices[i].position.x;
+			positions[i * 3 + 1] = mesh.vertices[i].position.y;
+			positions[i * 3 + 2] = mesh.vertices[i].position.z;
+		}
+		
+		glGenBuffers(1, &mesh.positionVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.positionVbo);
+		glBufferData(GL_ARRAY_BUFFER, (u64)mesh.numVertices * 3 * sizeof(float), positions, GL_STATIC_DRAW);
+		free(positions);
+	}
+	
+	if (mesh.skin)
+	{
+		glGenBuffers(1, &mesh.skinVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.skinVbo);
+		glBufferData(GL_ARRAY_BUFFER, (u64)mesh.numVertices * sizeof(SkinVertex), mesh.skin, GL_STATIC_DRAW);
+	}
+	
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// bone indices and weights, on the bound vertex array
+void bindSkinAttributes(Mesh& mesh)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.skinVbo);
+	
+	glVertexAttribIPointer(HL_JOINTS_LOCATION, 4, GL_UNSIGNED_BYTE, sizeof(SkinVertex),
+		(void*) offsetof(SkinVertex, joints));
+	glEnableVertexAttribArray(HL_JOINTS_LOCATION);
+	
+	glVertexAttribPointer(HL_WEIGHTS_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SkinVertex),
+		(void*) offsetof(SkinVertex, weights));
+	glEnableVertexAttribArray(HL_WEIGHTS_LOCATION);
+}
+
+// vertex arrays aren't shared between contexts,
+// so this half always runs on the drawing context
+void bindMeshArrays(Mesh& mesh)
+{
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
 
 	// position
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
@@ -200,8 +431,61 @@ void uploadMesh(Mesh& mesh)
 	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
 		(void*) offsetof(Vertex, color));
 	glEnableVertexAttribArray(4);
+	
+	if (mesh.skinVbo) bindSkinAttributes(mesh);
 
 	glBindVertexArray(0);
+	
+	u64 vertexBytes = (u64)sizeof(Vertex) * mesh.numVertices;
+	u64 indexBytes = (u64)sizeof(uint) * mesh.numIndices;
+	
+	if (mesh.positionVbo)
+	{
+		glGenVertexArrays(1, &mesh.positionVao);
+		glBindVertexArray(mesh.positionVao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.positionVbo);
+		
+		// same location as the full stream, so any shader works with both
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+		glEnableVertexAttribArray(0);
+		
+		// skinned depth passes need the bones too
+		if (mesh.skinVbo) bindSkinAttributes(mesh);
+		
+		glBindVertexArray(0);
+		
+		vertexBytes += (u64)mesh.numVertices * 3 * sizeof(float);
+	}
+	if (mesh.skinVbo) vertexBytes += (u64)mesh.numVertices * sizeof(SkinVertex);
+	mesh.residency = trackResource(HL_RES_MESH, mesh.vbo, vertexBytes + indexBytes);
+	
+	if (hl_residency.cpuPolicy == HL_DROP_CPU_COPIES)
+	{
+		// only the copies we had; the position stream was never on the CPU
+		u64 cpuBytes = 0;
+		if (mesh.vertices) cpuBytes += (u64)sizeof(Vertex) * mesh.numVertices;
+		if (mesh.indices) cpuBytes += (u64)sizeof(uint) * mesh.numIndices;
+		if (mesh.skin) cpuBytes += (u64)sizeof(SkinVertex) * mesh.numVertices;
+		
+		// arena data goes when the arena does
+		if (!mesh.arenaData)
+		{
+			free(mesh.vertices);
+			free(mesh.indices);
+			free(mesh.skin);
+		}
+		mesh.vertices = 0;
+		mesh.indices = 0;
+		mesh.skin = 0;
+		hl_residency.cpuBytesFreed += cpuBytes;
+	}
+}
+
+void uploadMesh(Mesh& mesh, int positionStream = false)
+{
+	uploadMeshBuffers(mesh, positionStream);
+	bindMeshArrays(mesh);
 }
 
 // collection of meshes and materials
@@ -209,17 +493,210 @@ struct Model
 {
 	Array<Mesh> meshes;
 	Array<Material> materials;
+	Arena arena; // meshlets, and CPU copies of mesh data unless they're dropped after upload
+	UniformBuffer materialBuffer; // one MaterialBlock per material ('hlMaterial')
+	
+	// material textures grouped by size and format,
+	// bound once per draw as hlTextureArray0..N
+	Texture textureArrays[HL_MAX_TEXTURE_ARRAYS];
+	int numTextureArrays;
+	
+	// 0 if no mesh has bones; skeleton and clips live in 'arena'
+	Skeleton* skeleton;
+	AnimationClip* clips;
+	int numClips;
+	
+	// 'world' is only used to estimate streamed texture levels;
+	// set the transform on the shader as usual
+	//
+	// with 'prepass' set, depth is laid down first from positions only
+	// and the shading pass runs with GL_EQUAL and depth writes off,
+	// so each pixel is shaded once; 'depthShader' (e.g. from createDepthShader,
+	// with its transform set) replaces the active shader for the depth pass
+	//
+	// GL_EQUAL needs both passes to compute bit-identical positions:
+	// use the same vertex code and declare 'invariant gl_Position;'
+	void draw(mat4 world = identity<mat4>(), int prepass = false, Shader* depthShader = 0)
+	{
+		if (!prepass)
+		{
+			shade(world);
+			return;
+		}
+		
+		Shader* shading = activeShader;
+		if (depthShader) useShader(depthShader);
+		
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+		
+		for (int i = 0; i < meshes.size; i++)
+			meshes[i].drawPositions();
+		
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		if (depthShader) useShader(shading);
+		
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+		
+		shade(world);
+		
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
 	
-	void draw()
+	void shade(mat4 world)
 	{
+		if (hl_streaming.active)
+		{
+			for (int i = 0; i < meshes.size; i++)
+				meshes[i].requestTextures(materials, world);
+		}
+		
+		if (numTextureArrays > 0)
+		{
+			Shader* shader = activeShader;
+			char name[32];
+			
+			for (int i = 0; i < numTextureArrays; i++)
+			{
+				snprintf(name, sizeof(name), "hlTextureArray%i", i);
+				shader->setTexture(name, textureArrays[i]);
+			}
+			
+			// materials only differ by their constants now
+			for (int i = 0; i < meshes.size; i++)
+			{
+				meshes[i].draw(materials, &materialBuffer, true);
+			}
+			
+			clearTextures();
+			return;
+		}
+		
 		for (int i = 0; i < meshes.size; i++)
 		{
-			meshes[i].draw(materials);
+			meshes[i].draw(materials, &materialBuffer);
 		}
 	}
 };
 
-Array<Material> getMaterials(const aiScene* scene)
+// group the images by size and format into 2D texture arrays
+// and record each component's array and layer in its material
+// returns 0 (leaving the model unpacked) if there are too many groups
+int packTextureArrays(Model* model, Image* images, Arena* arena)
+{
+	int numImages = model->materials.size * 5;
+	
+	struct {int width, height, channels, layers;} groups[HL_MAX_TEXTURE_ARRAYS];
+	int numGroups = 0;
+	
+	int* imageGroup = (int*) arenaAlloc(arena, numImages * sizeof(int));
+	
+	for (int i = 0; i < numImages; i++)
+	{
+		imageGroup[i] = -1;
+		Image* img = &images[i];
+		if (!img->data) continue;
+		
+		int g = 0;
+		for (; g < numGroups; g++)
+		{
+			if (groups[g].width == img->width && groups[g].height == img->height
+				&& groups[g].channels == img->channels) break;
+		}
+		
+		if (g == numGroups)
+		{
+			if (numGroups == HL_MAX_TEXTURE_ARRAYS)
+			{
+				fprintf(stderr, "[Texture] More than %i texture sizes/formats, not packing\n", HL_MAX_TEXTURE_ARRAYS);
+				return 0;
+			}
+			
+			groups[g].width = img->width;
+			groups[g].height = img->height;
+			groups[g].channels = img->channels;
+			groups[g].layers = 0;
+			numGroups++;
+		}
+		
+		imageGroup[i] = g;
+		model->materials[i / 5].layer[i % 5] = (g << 16) | groups[g].layers;
+		groups[g].layers++;
+	}
+	
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	
+	for (int g = 0; g < numGroups; g++)
+	{
+		Texture* tex = &model->textureArrays[g];
+		tex->type = GL_TEXTURE_2D_ARRAY;
+		
+		int channels = groups[g].channels;
+		if (channels == 1) tex->format = GL_RED;
+		else if (channels == 2) tex->format = GL_RG;
+		else if (channels == 3) tex->format = GL_RGB;
+		else tex->format = GL_RGBA;
+		
+		glGenTextures(1, &tex->id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex->id);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, tex->format, groups[g].width, groups[g].height, groups[g].layers,
+			0, tex->format, GL_UNSIGNED_BYTE, 0);
+		
+		for (int i = 0; i < numImages; i++)
+		{
+			if (imageGroup[i] != g) continue;
+			
+			int layer = model->materials[i / 5].layer[i % 5] & 0xFFFF;
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, groups[g].width, groups[g].height, 1,
+				tex->format, GL_UNSIGNED_BYTE, images[i].data);
+		}
+		
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	
+	model->numTextureArrays = numGroups;
+	return 1;
+}
+
+// pack every material's constants into one uniform buffer,
+// each entry aligned so it can be bound with glBindBufferRange
+UniformBuffer createMaterialBuffer(Array<Material>& materials)
+{
+	uint stride = alignUniform(sizeof(MaterialBlock));
+	uint size = stride * ((materials.size > 0) ? materials.size : 1);
+	
+	u8* data = (u8*) calloc(size, 1);
+	
+	for (int i = 0; i < materials.size; i++)
+	{
+		Material* m = &materials[i];
+		MaterialBlock* block = (MaterialBlock*)(data + i * stride);
+		
+		block->diffuseColor = vec4(m->diffuse.color.r, m->diffuse.color.g, m->diffuse.color.b, m->diffuse.color.a);
+		block->specularColor = vec4(m->specular.color.r, m->specular.color.g, m->specular.color.b, m->specular.color.a);
+		block->emissionColor = vec4(m->emission.color.r, m->emission.color.g, m->emission.color.b, m->emission.color.a);
+		block->factors = vec4(m->diffuse.factor, m->specular.factor, m->rough.factor, m->emission.factor);
+		block->layers = ivec4(m->layer[0], m->layer[1], m->layer[2], m->layer[3]);
+		block->layers2 = ivec4(m->layer[4], -1, -1, -1);
+	}
+	
+	UniformBuffer ret = createUniformBuffer(size, data, GL_STATIC_DRAW);
+	free(data);
+	
+	return ret;
+}
+
+// with 'images' set, component images are kept there (5 per material)
+// for packing instead of being uploaded one texture each;
+// with 'stream' set, textures start with their mip tail and stream in
+Array<Material> getMaterials(const aiScene* scene, Image* images = 0, int stream = false)
 {
 	Array<Material> ret;
 	ret.allocate(scene->mNumMaterials);
@@ -266,6 +743,7 @@ Array<Material> getMaterials(const aiScene* scene)
 		for (int type = 0; type < 5; type++)
 		{
 			int textureCount = aimat->GetTextureCount(types[type]);
+			ret[i].layer[type] = -1;
 			
 			if (textureCount < 1)
 				continue;
@@ -277,15 +755,45 @@ Array<Material> getMaterials(const aiScene* scene)
 			// must match material struct
 			Texture* texture = (Texture*)
 				&( (Material::Component*)&ret[i].diffuse.texture )[type];
+			if (stream && !images)
+			{
+				*texture = createStreamedTexture(path.C_Str());
+				continue;
+			}
+			
 			Image img = createImage(path.C_Str());
+			
+			if (images)
+			{
+				images[i * 5 + type] = img;
+				continue;
+			}
+			
 			*texture = createTexture(&img);
+			setTextureSource(*texture, path.C_Str());
+			
+			if (hl_residency.cpuPolicy == HL_DROP_CPU_COPIES)
+			{
+				hl_residency.cpuBytesFreed += (u64)img.width * img.height * img.channels;
+				unloadImage(img);
+			}
 		}
 	}
 	
 	return ret;
 }
 
-void getMeshesRecursive(aiNode* node, const aiScene* scene, Array<Mesh>& meshes)
+int countMeshes(aiNode* node)
+{
+	int ret = node->mNumMeshes;
+	for (uint i = 0; i < node->mNumChildren; i++)
+		ret += countMeshes(node->mChildren[i]);
+	return ret;
+}
+
+void buildMeshlets(Mesh* mesh, Arena* arena);
+
+void getMeshesRecursive(aiNode* node, const aiScene* scene, Array<Mesh>& meshes, Arena* arena, int positionStream, Arena* meshlets, Skeleton* skeleton)
 {	
 	// process each mesh located at the current node
 	for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -295,36 +803,48 @@ void getMeshesRecursive(aiNode* node, const aiScene* scene, Array<Mesh>& meshes)
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 		
 		// load mesh struct and append to array
-		Mesh m = createMesh(mesh, scene);
-		uploadMesh(m);
+		Mesh m = createMesh(mesh, scene, arena, skeleton);
+		// bounds and cones of skinned meshes would only hold for the bind pose
+		if (meshlets && !m.skin) buildMeshlets(&m, meshlets);
+		uploadMesh(m, positionStream);
 		meshes.append(m);
 	}
 	
 	// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 	for(unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		getMeshesRecursive(node->mChildren[i], scene, meshes);
+		getMeshesRecursive(node->mChildren[i], scene, meshes, arena, positionStream, meshlets, skeleton);
 	}
 }
 
-Array<Mesh> getMeshes(const aiScene* scene)
+// 'meshlets' is the arena to build meshlets into, 0 to skip them
+Array<Mesh> getMeshes(const aiScene* scene, Arena* arena = 0, int positionStream = false, Arena* meshlets = 0, Skeleton* skeleton = 0)
 {
 	Array<Mesh> ret;
-	ret.allocate(scene->mNumMeshes);
-	// there may be more meshes down the tree,
-	// but this is a good starting point
+	ret.allocate(countMeshes(scene->mRootNode));
+	// meshes can be referenced by more than one node,
+	// so count the tree instead of trusting mNumMeshes
 	
-	getMeshesRecursive(scene->mRootNode, scene, ret);
+	getMeshesRecursive(scene->mRootNode, scene, ret, arena, positionStream, meshlets, skeleton);
 	// the "bootstrap"; calling the actual recursive function
 	
-	ret.shrink(); // get rid of extra allocated memory
-	
 	return ret;
 }
 
-Model createModel(char* filePath, int flipUv = false)
+// packTextures groups material textures into texture arrays,
+// so a model draws with one set of texture binds (see HL_MATERIAL_ARRAYS_GLSL)
+// streamTextures loads only coarse mips up front (see setStreamingView);
+// packed textures are never streamed
+// positionStream uploads a position-only stream per mesh for depth pre-passes
+// meshlets splits meshes into clusters for cullModel
+// models with bones come with their skeleton and clips (see anim.h)
+Model createModel(char* filePath, int flipUv = false, int packTextures = false, int streamTextures = false, int positionStream = false, int meshlets = false)
 {
 	Model ret;
+	ret.numTextureArrays = 0;
+	ret.skeleton = 0;
+	ret.clips = 0;
+	ret.numClips = 0;
 	
 	Assimp::Importer importer;
 	
@@ -343,8 +863,46 @@ Model createModel(char* filePath, int flipUv = false)
 		return;
 	}
 	
-	ret.materials = getMaterials(scene);
-	ret.meshes = getMeshes(scene);
+	// made only once the import worked, so a failed one has nothing to free
+	ret.arena = createArena();
+	// everything the import needs only while loading
+	Arena load = createArena();
+	
+	if (packTextures)
+	{
+		int numImages = scene->mNumMaterials * 5;
+		Image* images = (Image*) arenaCalloc(&load, numImages * sizeof(Image));
+		
+		ret.materials = getMaterials(scene, images);
+		
+		if (!packTextureArrays(&ret, images, &load))
+		{
+			// fall back to one texture per component
+			for (int i = 0; i < numImages; i++)
+			{
+				ret.materials[i / 5].layer[i % 5] = -1;
+				if (!images[i].data) continue;
+				
+				Texture* texture = (Texture*)
+					&( (Material::Component*)&ret.materials[i / 5].diffuse.texture )[i % 5];
+				*texture = createTexture(&images[i]);
+			}
+		}
+		
+		for (int i = 0; i < numImages; i++)
+			if (images[i].data) unloadImage(images[i]);
+	}
+	else ret.materials = getMaterials(scene, 0, streamTextures);
+	
+	ret.materialBuffer = createMaterialBuffer(ret.materials);
+	// mesh data only outlives the import if we keep CPU copies
+	Arena* meshData = (hl_residency.cpuPolicy == HL_DROP_CPU_COPIES) ? &load : &ret.arena;
+	// bones and animations, if the scene has any
+	ret.skeleton = createSkeleton(scene, &ret.arena);
+	ret.clips = createClips(scene, ret.skeleton, &ret.arena, &ret.numClips);
+	
+	ret.meshes = getMeshes(scene, meshData, positionStream, (meshlets) ? &ret.arena : 0, ret.skeleton);
 	
+	freeArena(&load);
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+#pragma once
+
+//
+// Meshlets
+//
+// each mesh's triangles are split, in index order, into clusters
+// of at most 64 vertices and 124 triangles; since the order is kept,
+// every meshlet is a contiguous range of the existing index buffer
+// and nothing is re-uploaded
+//
+// per frame, cullModel tests each meshlet's bounding sphere against
+// the frustum and its normal cone against the camera, and leaves a
+// compacted list of index ranges (adjacent visible meshlets merged)
+// that Mesh draws with glMultiDrawElements
+//
+// skinned meshes aren't clustered: their bounds would only hold
+// for the bind pose, so they're always drawn whole
+//
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define HL_MESHLET_VERTICES 64
+#define HL_MESHLET_TRIANGLES 124
+#define HL_CULL_GRAIN 4096 // meshlets per job, a multiple of 4
+
+struct Meshlet
+{
+	uint indexOffset; // first index in the mesh's index buffer
+	uint indexCount;
+	uint vertexCount; // unique vertices
+};
+
+struct MeshletSet
+{
+	Meshlet* meshlets;
+	int count;
+
+	// bounds as structure of arrays, padded to a multiple of 4:
+	// center x, y, z, radius, cone axis x, y, z, cone cutoff
+	float* bounds;
+	int padded;
+
+	// this frame's visible ranges, from cullModel
+	GLsizei* counts;
+	void** offsets;
+	int visible;
+	uint frame; // residency frame the ranges belong to
+};
+
+inline
+float* meshletBounds(MeshletSet* set, int field)
+{
+	return set->bounds + field * set->padded;
+}
+
+// cone and sphere of triangles [first, first + count) of the mesh
+void meshletCone(Mesh* mesh, uint first, uint count, MeshletSet* set, int index)
+{
+	vec3 lo = vec3(1e30), hi = vec3(-1e30);
+	vec3 axis = vec3(0);
+
+	for (uint t = first; t < first + count; t += 3)
+	{
+		Vertex* v[3];
+		for (int k = 0; k < 3; k++)
+		{
+			v[k] = &mesh->vertices[mesh->indices[t + k]];
+			vec3 p = vec3(v[k]->position.x, v[k]->position.y, v[k]->position.z);
+			lo = min(lo, p);
+			hi = max(hi, p);
+		}
+
+		vec3 a = vec3(v[0]->position.x, v[0]->position.y, v[0]->position.z);
+		vec3 b = vec3(v[1]->position.x, v[1]->position.y, v[1]->position.z);
+		vec3 c = vec3(v[2]->position.x, v[2]->position.y, v[2]->position.z);
+		vec3 n = cross(b - a, c - a);
+		float len = length(n);
+		if (len > 0) axis += n / len;
+	}
+
+	vec3 center = (lo + hi) * 0.5f;
+	float radius = 0;
+	for (uint t = first; t < first + count; t++)
+	{
+		Vertex* v = &mesh->vertices[mesh->indices[t]];
+		radius = fmax(radius, length(vec3(v->position.x, v->position.y, v->position.z) - center));
+	}
+
+	float axisLength = length(axis);
+	axis = (axisLength > 0) ? axis / axisLength : vec3(0, 0, 1);
+
+	// widest angle between the axis and any triangle normal
+	float minDot = 1;
+	for (uint t = first; t < first + count; t += 3)
+	{
+		Vertex* v0 = &mesh->vertices[mesh->indices[t]];
+		Vertex* v1 = &mesh->vertices[mesh->indices[t + 1]];
+		Vertex* v2 = &mesh->vertices[mesh->indices[t + 2]];
+		vec3 a = vec3(v0->position.x, v0->position.y, v0->position.z);
+		vec3 n = cross(vec3(v1->position.x, v1->position.y, v1->position.z) - a,
+			vec3(v2->position.x, v2->position.y, v2->position.z) - a);
+		float len = length(n);
+		if (len > 0) minDot = fmin(minDot, dot(axis, n / len));
+	}
+
+	// backfacing for every triangle once the view direction is within
+	// 90 degrees minus the cone angle of the axis, i.e. dot > sin(angle);
+	// a cone wider than a hemisphere can never be culled (cutoff > 1)
+	float cutoff = (minDot <= 0 || axisLength == 0) ? 2.0f : sqrt(1 - minDot * minDot);
+
+	meshletBounds(set, 0)[index] = center.x;
+	meshletBounds(set, 1)[index] = center.y;
+	meshletBounds(set, 2)[index] = center.z;
+	meshletBounds(set, 3)[index] = radius;
+	meshletBounds(set, 4)[index] = axis.x;
+	meshletBounds(set, 5)[index] = axis.y;
+	meshletBounds(set, 6)[index] = axis.z;
+	meshletBounds(set, 7)[index] = cutoff;
+}
+
+// needs the mesh's CPU vertex and index data;
+// allocates from 'arena' if given, otherwise with malloc
+void buildMeshlets(Mesh* mesh, Arena* arena)
+{
+	if (!mesh->vertices || !mesh->indices || !mesh->numIndices) return;
+
+	u64 maxMeshlets = mesh->numIndices / 3;
+
+	// unique vertex tracking: a vertex belongs to the current meshlet
+	// when its stamp equals the meshlet's number
+	uint* stamp = (uint*) calloc(mesh->numVertices, sizeof(uint));
+	Meshlet* list = (Meshlet*) malloc(maxMeshlets * sizeof(Meshlet));
+
+	int count = 0;
+	Meshlet current = {0, 0, 0};
+
+	for (uint t = 0; t < mesh->numIndices; t += 3)
+	{
+		int added = 0;
+		for (int k = 0; k < 3; k++)
+			if (stamp[mesh->indices[t + k]] != (uint)count + 1) added++;
+
+		if (current.indexCount && (current.vertexCount + added > HL_MESHLET_VERTICES
+			|| current.indexCount / 3 + 1 > HL_MESHLET_TRIANGLES))
+		{
+			list[count++] = current;
+			current.indexOffset = t;
+			current.indexCount = 0;
+			current.vertexCount = 0;
+
+			added = 3;
+			for (int k = 0; k < 3; k++)
+			{
+				uint a = mesh->indices[t + k];
+				for (int j = 0; j < k; j++) if (mesh->indices[t + j] == a) { added--; break; }
+			}
+		}
+
+		for (int k = 0; k < 3; k++) stamp[mesh->indices[t + k]] = count + 1;
+		current.vertexCount += added;
+		current.indexCount += 3;
+	}
+	if (current.indexCount) list[count++] = current;
+
+	free(stamp);
+
+	MeshletSet* set = (MeshletSet*)((arena) ? arenaCalloc(arena, sizeof(MeshletSet)) : calloc(1, sizeof(MeshletSet)));
+	set->count = count;
+	set->padded = (count + 3) & ~3;
+
+	u64 meshletBytes = (u64)count * sizeof(Meshlet);
+	u64 boundsBytes = (u64)set->padded * 8 * sizeof(float);
+	set->meshlets = (Meshlet*)((arena) ? arenaAlloc(arena, meshletBytes) : malloc(meshletBytes));
+	set->bounds = (float*)((arena) ? arenaCalloc(arena, boundsBytes) : calloc(1, boundsBytes));
+	memcpy(set->meshlets, list, meshletBytes);
+	free(list);
+
+	for (int i = 0; i < count; i++)
+		meshletCone(mesh, set->meshlets[i].indexOffset, set->meshlets[i].indexCount, set, i);
+
+	// padding never passes the frustum test
+	for (int i = count; i < set->padded; i++) meshletBounds(set, 3)[i] = -1e30;
+
+	mesh->clusters = set;
+}
+
+//
+// Culling
+//
+
+struct CullView
+{
+	vec4 planes[6]; // object space, normalized
+	vec3 camera; // object space
+};
+
+CullView cullView(mat4 world, mat4 viewProj, vec3 cameraPos)
+{
+	CullView ret;
+
+	// rows of the clip matrix give the planes directly;
+	// in object space, so bounds don't need transforming
+	mat4 m = transpose(viewProj * world);
+	ret.planes[0] = m[3] + m[0];
+	ret.planes[1] = m[3] - m[0];
+	ret.planes[2] = m[3] + m[1];
+	ret.planes[3] = m[3] - m[1];
+	ret.planes[4] = m[3] + m[2];
+	ret.planes[5] = m[3] - m[2];
+
+	for (int i = 0; i < 6; i++)
+		ret.planes[i] /= length(vec3(ret.planes[i]));
+
+	ret.camera = vec3(inverse(world) * vec4(cameraPos, 1.0));
+	return ret;
+}
+
+// visibility of meshlets [begin, end), begin a multiple of 4
+void cullMeshletRange(MeshletSet* set, CullView* view, u8* visible, int begin, int end)
+{
+	float* cx = meshletBounds(set, 0);
+	float* cy = meshletBounds(set, 1);
+	float* cz = meshletBounds(set, 2);
+	float* r = meshletBounds(set, 3);
+	float* ax = meshletBounds(set, 4);
+	float* ay = meshletBounds(set, 5);
+	float* az = meshletBounds(set, 6);
+	float* cut = meshletBounds(set, 7);
+
+#ifdef __SSE__
+	for (int i = begin; i < end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(cx + i);
+		__m128 y = _mm_loadu_ps(cy + i);
+		__m128 z = _mm_loadu_ps(cz + i);
+		__m128 radius = _mm_loadu_ps(r + i);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+		__m128 pass = _mm_cmpge_ps(radius, _mm_setzero_ps());
+		for (int p = 0; p < 6; p++)
+		{
+			vec4 pl = view->planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(pl.x)), _mm_mul_ps(y, _mm_set1_ps(pl.y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(pl.z)), _mm_set1_ps(pl.w)));
+			pass = _mm_and_ps(pass, _mm_cmpge_ps(d, negRadius));
+		}
+
+		// backface cone: dot(center - camera, axis) >= cutoff * |center - camera| + radius
+		__m128 vx = _mm_sub_ps(x, _mm_set1_ps(view->camera.x));
+		__m128 vy = _mm_sub_ps(y, _mm_set1_ps(view->camera.y));
+		__m128 vz = _mm_sub_ps(z, _mm_set1_ps(view->camera.z));
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(ax + i)), _mm_mul_ps(vy, _mm_loadu_ps(ay + i))),
+			_mm_mul_ps(vz, _mm_loadu_ps(az + i)));
+		__m128 backface = _mm_cmpge_ps(d, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(cut + i), len), radius));
+		pass = _mm_andnot_ps(backface, pass);
+
+		int mask = _mm_movemask_ps(pass);
+		for (int k = 0; k < 4 && i + k < end; k++) visible[i + k] = (mask >> k) & 1;
+	}
+#else
+	for (int i = begin; i < end; i++)
+	{
+		int pass = r[i] >= 0;
+		for (int p = 0; p < 6 && pass; p++)
+		{
+			vec4 pl = view->planes[p];
+			pass = cx[i] * pl.x + cy[i] * pl.y + cz[i] * pl.z + pl.w >= -r[i];
+		}
+
+		vec3 v = vec3(cx[i], cy[i], cz[i]) - view->camera;
+		if (pass && dot(v, vec3(ax[i], ay[i], az[i])) >= cut[i] * length(v) + r[i]) pass = 0;
+
+		visible[i] = pass;
+	}
+#endif
+}
+
+struct CullJob
+{
+	MeshletSet* set;
+	CullView* view;
+	u8* visible;
+};
+
+void cullMeshletJob(void* user, int begin, int end)
+{
+	CullJob* job = (CullJob*)user;
+	cullMeshletRange(job->set, job->view, job->visible, begin, end);
+}
+
+// build this frame's visible ranges for one mesh, from the frame allocator
+void cullMeshlets(Mesh* mesh, CullView* view)
+{
+	MeshletSet* set = mesh->clusters;
+	if (!set) return;
+
+	u8* visible = (u8*) frameAlloc(set->padded);
+
+	CullJob job = {set, view, visible};
+	parallelFor(set->count, HL_CULL_GRAIN, cullMeshletJob, &job);
+
+	// compact, merging runs of visible meshlets into one range
+	set->counts = (GLsizei*) frameAlloc(set->count * sizeof(GLsizei));
+	set->offsets = (void**) frameAlloc(set->count * sizeof(void*));
+	set->visible = 0;
+
+	for (int i = 0; i < set->count; i++)
+	{
+		if (!visible[i]) continue;
+
+		Meshlet* m = &set->meshlets[i];
+		int n = set->visible;
+		if (n > 0 && i > 0 && visible[i - 1])
+		{
+			set->counts[n - 1] += m->indexCount;
+			continue;
+		}
+
+		set->counts[n] = m->indexCount;
+		set->offsets[n] = (void*)((u64)m->indexOffset * sizeof(uint));
+		set->visible++;
+	}
+
+	set->frame = hl_residency.frame;
+}
+
+// cull every clustered mesh of the model for this frame;
+// the next draws of the model only submit visible meshlets
+void cullModel(Model* model, mat4 world, mat4 viewProj, vec3 cameraPos)
+{
+	CullView view = cullView(world, viewProj, cameraPos);
+
+	for (int i = 0; i < model->meshes.size; i++)
+		cullMeshlets(&model->meshes[i], &view);
+}
+
+// draw this frame's visible ranges; 0 if the mesh wasn't culled this frame
+int drawClusters(MeshletSet* set)
+{
+	if (set->frame != hl_residency.frame || !set->counts) return 0;
+
+	if (set->visible > 0)
+		glMultiDrawElements(GL_TRIANGLES, set->counts, GL_UNSIGNED_INT, (const void**)set->offsets, set->visible);
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//
+// Asynchronous frame readback
+//
+// glReadPixels goes into a ring of pixel pack buffers
+// and a fence is placed behind it; the pixels are only
+// mapped once the fence has signaled, so the render thread
+// never waits on the GPU to catch up
+//
+
+#define HL_READBACK_RING 4
+
+#define HL_READBACK_FREE 0
+#define HL_READBACK_PENDING 1 // waiting on the fence
+#define HL_READBACK_MAPPED 2 // handed to the caller
+#define HL_READBACK_WORKING 3 // handed to the worker thread
+
+typedef void (*ReadbackFunc)(const u8* pixels, int width, int height, int channels, uint ticket, void* user);
+
+struct ReadbackSlot
+{
+	uint pbo;
+	u64 capacity; // bytes allocated in the pbo
+	GLsync fence;
+
+	uint ticket;
+	int width, height;
+	int channels;
+
+	int state;
+	int useWorker;
+	std::atomic<int> workDone;
+
+	void* pixels; // mapped pointer while MAPPED or WORKING
+};
+
+struct
+{
+	ReadbackSlot slots[HL_READBACK_RING];
+	uint nextTicket = 1;
+
+	ReadbackFunc callback = 0;
+	void* user = 0;
+
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wake;
+	int queue[HL_READBACK_RING];
+	int queued = 0;
+	int running = 0;
+}
+hl_readback;
+
+ReadbackSlot* findReadback(uint ticket)
+{
+	for (int i = 0; i < HL_READBACK_RING; i++)
+	{
+		ReadbackSlot* slot = &hl_readback.slots[i];
+		if (slot->state != HL_READBACK_FREE && slot->ticket == ticket)
+			return slot;
+	}
+	return 0;
+}
+
+// queue a copy of the frame's color attachment (or the backbuffer, if frame is 0)
+// returns a ticket for mapReadback, or 0 if every slot in the ring is busy
+uint readFrameAsync(Frame* frame, int channels = 4, int toWorker = false)
+{
+	ReadbackSlot* slot = 0;
+	for (int i = 0; i < HL_READBACK_RING; i++)
+	{
+		if (hl_readback.slots[i].state == HL_READBACK_FREE)
+		{
+			slot = &hl_readback.slots[i];
+			break;
+		}
+	}
+
+	if (!slot)
+	{
+		fprintf(stderr, "[Readback] Ring full, dropping request\n");
+		return 0;
+	}
+
+	uint format;
+	if (channels == 1) format = GL_RED;
+	else if (channels == 2) format = GL_RG;
+	else if (channels == 3) format = GL_RGB;
+	else { format = GL_RGBA; channels = 4; }
+
+	int width = (frame) ? frame->width : hl.fwidth;
+	int height = (frame) ? frame->height : hl.fheight;
+	u64 size = (u64)width * height * channels;
+
+	if (!slot->pbo) glGenBuffers(1, &slot->pbo);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	if (slot->capacity < size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+		slot->capacity = size;
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, (frame) ? frame->fbo : 0);
+	glReadBuffer((frame) ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, 0);
+	// the pack buffer is bound, so this only records the copy
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, (currentFrame) ? currentFrame->fbo : 0);
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->ticket = hl_readback.nextTicket++;
+	if (hl_readback.nextTicket == 0) hl_readback.nextTicket = 1;
+
+	slot->width = width;
+	slot->height = height;
+	slot->channels = channels;
+	slot->state = HL_READBACK_PENDING;
+	slot->useWorker = toWorker && hl_readback.callback;
+	slot->workDone = 0;
+	slot->pixels = 0;
+
+	return slot->ticket;
+}
+
+int readbackReady(uint ticket)
+{
+	ReadbackSlot* slot = findReadback(ticket);
+	if (!slot) return 0;
+	if (slot->state != HL_READBACK_PENDING) return 1;
+
+	GLenum status = glClientWaitSync(slot->fence, 0, 0);
+	return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+int mapSlot(ReadbackSlot* slot, int wait)
+{
+	if (slot->state != HL_READBACK_PENDING) return 1;
+
+	GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+		(wait) ? GL_TIMEOUT_IGNORED : 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return 0;
+
+	glDeleteSync(slot->fence);
+	slot->fence = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	slot->pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+		(u64)slot->width * slot->height * slot->channels, GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot->state = HL_READBACK_MAPPED;
+	return 1;
+}
+
+// returns the pixels (bottom row first) once the copy has landed, 0 if still in flight
+// the pointer stays valid until unmapReadback
+const u8* mapReadback(uint ticket, int wait = false)
+{
+	ReadbackSlot* slot = findReadback(ticket);
+	if (!slot || slot->useWorker) return 0;
+
+	if (!mapSlot(slot, wait)) return 0;
+	return (const u8*)slot->pixels;
+}
+
+void releaseSlot(ReadbackSlot* slot)
+{
+	if (slot->fence)
+	{
+		glDeleteSync(slot->fence);
+		slot->fence = 0;
+	}
+
+	if (slot->pixels)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot->pixels = 0;
+	}
+
+	slot->state = HL_READBACK_FREE;
+}
+
+void unmapReadback(uint ticket)
+{
+	ReadbackSlot* slot = findReadback(ticket);
+	if (slot) releaseSlot(slot);
+}
+
+//
+// Worker thread
+//
+// the mapped pointer is handed straight to the worker,
+// so encoding never copies and never touches GL;
+// the render thread unmaps once the worker is done
+//
+
+void readbackWorker()
+{
+	while (1)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> guard(hl_readback.lock);
+			hl_readback.wake.wait(guard, []{ return hl_readback.queued > 0 || !hl_readback.running; });
+
+			if (hl_readback.queued == 0) return;
+
+			index = hl_readback.queue[0];
+			hl_readback.queued--;
+			for (int i = 0; i < hl_readback.queued; i++)
+				hl_readback.queue[i] = hl_readback.queue[i+1];
+		}
+
+		ReadbackSlot* slot = &hl_readback.slots[index];
+		hl_readback.callback((const u8*)slot->pixels, slot->width, slot->height, slot->channels, slot->ticket, hl_readback.user);
+		slot->workDone = 1;
+	}
+}
+
+void setReadbackCallback(ReadbackFunc callback, void* user = 0)
+{
+	hl_readback.callback = callback;
+	hl_readback.user = user;
+
+	if (callback && !hl_readback.running)
+	{
+		hl_readback.running = 1;
+		hl_readback.worker = std::thread(readbackWorker);
+	}
+}
+
+void stopReadbackWorker()
+{
+	if (!hl_readback.running) return;
+
+	{
+		std::lock_guard<std::mutex> guard(hl_readback.lock);
+		hl_readback.running = 0;
+	}
+	hl_readback.wake.notify_one();
+	hl_readback.worker.join();
+}
+
+// hand finished copies to the worker and recycle the ones it's done with
+// called once per frame from presentFrame
+void updateReadbacks()
+{
+	for (int i = 0; i < HL_READBACK_RING; i++)
+	{
+		ReadbackSlot* slot = &hl_readback.slots[i];
+		if (!slot->useWorker) continue;
+
+		if (slot->state == HL_READBACK_PENDING && mapSlot(slot, false))
+		{
+			slot->state = HL_READBACK_WORKING;
+			{
+				std::lock_guard<std::mutex> guard(hl_readback.lock);
+				hl_readback.queue[hl_readback.queued++] = i;
+			}
+			hl_readback.wake.notify_one();
+		}
+		else if (slot->state == HL_READBACK_WORKING && slot->workDone)
+		{
+			releaseSlot(slot);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+
+//
+// Render thread
+//
+// optional: the GL context moves to a thread of its own that runs
+// the draw callback and presentFrame, while the app thread only
+// simulates and records what to draw into a snapshot
+//
+// snapshots are handed over through three slots and one atomic
+// exchange, without locks: the app owns one slot, the render thread
+// another, and the third holds the latest finished snapshot
+//
+// double buffered (2): the app waits until its last snapshot has been
+// picked up, so nothing is dropped and it stays at most one frame ahead
+// triple buffered (3): the app never waits; a snapshot the render thread
+// didn't get to yet is replaced by the newer one
+//
+// in this mode the app thread calls glfwPollEvents itself (GLFW needs
+// it on the main thread) and nothing but the render thread touches GL
+// or the frame allocator; snapshotAlloc is the app side's equivalent
+//
+
+#define HL_SNAPSHOT_FRESH 4 // flag on hl_render.ready: not picked up yet
+
+// draw a snapshot; presentFrame is called after it returns
+typedef void (*RenderFunc)(void* snapshot, void* user);
+
+struct Snapshot
+{
+	void* data;
+	Arena arena; // variable sized data of this snapshot
+	u64 frame; // app frame number it was recorded in
+};
+
+struct
+{
+	Snapshot slots[3];
+	uint size;
+	int buffers;
+
+	int write; // app thread's slot
+	int read; // render thread's slot, -1 before the first snapshot
+	std::atomic<int> ready; // slot index | HL_SNAPSHOT_FRESH
+
+	RenderFunc render;
+	void* user;
+
+	std::thread thread;
+	std::atomic<int> running{0};
+
+	std::atomic<u64> submitted{0};
+	std::atomic<u64> rendered{0};
+	std::atomic<u64> dropped{0};
+	std::atomic<u64> latency{0}; // frames between the newest submit and the last render
+}
+hl_render;
+
+// spin briefly, then back off so a waiting thread doesn't eat a core
+inline
+void renderBackoff(int* spins)
+{
+	if (++*spins < 64) std::this_thread::yield();
+	else std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+void renderThread()
+{
+	glfwMakeContextCurrent(hl.window);
+
+	while (hl_render.running)
+	{
+		// wait for something new
+		int spins = 0;
+		while (hl_render.running && !(hl_render.ready & HL_SNAPSHOT_FRESH)) renderBackoff(&spins);
+		if (!hl_render.running) break;
+
+		// trade our slot for the fresh one
+		hl_render.read = hl_render.ready.exchange(hl_render.read < 0 ? 2 : hl_render.read) & 3;
+
+		Snapshot* snapshot = &hl_render.slots[hl_render.read];
+		hl_render.render(snapshot->data, hl_render.user);
+		presentFrame();
+
+		hl_render.rendered++;
+		hl_render.latency = hl_render.submitted - snapshot->frame;
+	}
+
+	glFinish();
+	glfwMakeContextCurrent(0);
+}
+
+// hand GL over to a render thread; call after openWindow and setup
+// 'snapshotSize' bytes are reserved per slot for the app's fixed frame data
+void startRenderThread(RenderFunc render, void* user, uint snapshotSize, int buffers = 3)
+{
+	if (hl_render.running) return;
+
+	hl_render.size = snapshotSize;
+	hl_render.buffers = (buffers == 2) ? 2 : 3;
+	hl_render.render = render;
+	hl_render.user = user;
+
+	for (int i = 0; i < 3; i++)
+	{
+		hl_render.slots[i].data = calloc(1, snapshotSize);
+		hl_render.slots[i].arena = createArena(1 << 16);
+		hl_render.slots[i].frame = 0;
+	}
+
+	// slot 2 starts out as the render thread's, handed in on its first exchange
+	hl_render.write = 0;
+	hl_render.read = -1;
+	hl_render.ready = 1;
+	hl_render.submitted = 0;
+	hl_render.rendered = 0;
+	hl_render.dropped = 0;
+	hl_render.latency = 0;
+
+	hl.renderThread = 1;
+	glfwMakeContextCurrent(0);
+
+	hl_render.running = 1;
+	hl_render.thread = std::thread(renderThread);
+}
+
+// give the context back to the calling thread
+void stopRenderThread()
+{
+	if (!hl_render.running) return;
+
+	hl_render.running = 0;
+	hl_render.thread.join();
+
+	glfwMakeContextCurrent(hl.window);
+	hl.renderThread = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		free(hl_render.slots[i].data);
+		freeArena(&hl_render.slots[i].arena);
+	}
+}
+
+// the app thread's slot for this frame, and its arena emptied
+void* beginSnapshot()
+{
+	Snapshot* snapshot = &hl_render.slots[hl_render.write];
+	resetArena(&snapshot->arena);
+	return snapshot->data;
+}
+
+// memory that lives as long as the snapshot being recorded
+inline
+void* snapshotAlloc(u64 size, u64 align = 16)
+{
+	return arenaAlloc(&hl_render.slots[hl_render.write].arena, size, align);
+}
+
+void submitSnapshot()
+{
+	// double buffered: don't get more than one snapshot ahead
+	int spins = 0;
+	if (hl_render.buffers == 2)
+		while (hl_render.running && (hl_render.ready & HL_SNAPSHOT_FRESH)) renderBackoff(&spins);
+
+	hl_render.slots[hl_render.write].frame = ++hl_render.submitted;
+
+	int previous = hl_render.ready.exchange(hl_render.write | HL_SNAPSHOT_FRESH);
+	if (previous & HL_SNAPSHOT_FRESH) hl_render.dropped++;
+
+	hl_render.write = previous & 3;
+}
+
+struct RenderThreadStats
+{
+	u64 submitted;
+	u64 rendered;
+	u64 dropped; // replaced before the render thread got to them
+	u64 latency; // snapshots behind the app at the last render
+};
+
+RenderThreadStats getRenderThreadStats()
+{
+	RenderThreadStats ret;
+	ret.submitted = hl_render.submitted;
+	ret.rendered = hl_render.rendered;
+	ret.dropped = hl_render.dropped;
+	ret.latency = hl_render.latency;
+	return ret;
+}
\ No newline at end of file
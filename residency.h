@@ -0,0 +1,486 @@
+#pragma once
+
+//
+// GPU memory residency
+//
+// every texture, mesh buffer and frame attachment hl creates
+// is accounted here by class; when textures go over budget,
+// the least recently drawn ones are stepped down to lower mips
+// (in place, so handles stay valid), and dropped entirely after
+// the 1x1 level; they're brought back from their source file
+// once they're drawn again and there is room
+//
+
+#define HL_RES_TEXTURE 0
+#define HL_RES_MESH 1
+#define HL_RES_FRAME 2
+#define HL_RES_CLASSES 3
+
+#define HL_KEEP_CPU_COPIES 0
+#define HL_DROP_CPU_COPIES 1 // free mesh vertices and images once uploaded
+
+#define HL_RESIDENCY_GRACE 8 // frames a texture must go undrawn before eviction
+#define HL_EVICT_STEP 2 // mip levels dropped per eviction (1/16 the memory)
+#define HL_RESIDENCY_DECODES 8 // textures being rebuilt at once
+
+struct ResidentResource
+{
+	int cls;
+	uint id;
+	int alive;
+
+	u64 bytes; // current size
+	uint lastUsed; // frame of the last draw
+
+	// textures only
+	int width, height, channels;
+	uint format;
+	int level; // mip level currently at the top (0 = full resolution, past the 1x1 level = gone)
+	int wanted; // drawn while evicted
+	int decoding; // a new chain is being decoded
+	char path[256]; // source to reload from, empty if not reloadable
+};
+
+// a chain being rebuilt on a job thread; the inputs are copied
+// so the job never touches 'resources' while it grows
+struct ResidencyDecode
+{
+	int resource = -1; // -1 if the slot is free
+	uint id;
+	int level;
+	int width, height, channels;
+	char path[256];
+
+	i64 freeing; // its share of hl_residency.freeing
+	u8* data; // levels [level, 1x1] back to back, 0 if decoding failed
+	JobCounter counter;
+};
+
+struct
+{
+	Array<ResidentResource> resources;
+
+	u64 bytes[HL_RES_CLASSES];
+	u64 peak[HL_RES_CLASSES];
+	u64 budget = 0; // texture bytes, 0 = unlimited
+
+	uint frame = 0;
+	int cpuPolicy = HL_KEEP_CPU_COPIES;
+
+	ResidencyDecode decodes[HL_RESIDENCY_DECODES];
+	i64 freeing; // bytes decodes in flight will free (negative for reloads)
+
+	int evictions;
+	int reloads;
+	u64 cpuBytesFreed;
+}
+hl_residency;
+
+const char* hl_residencyClassNames[] = {"texture", "mesh", "frame"};
+
+void setResidencyBudget(u64 textureBytes)
+{
+	hl_residency.budget = textureBytes;
+}
+
+void setCpuCopyPolicy(int policy)
+{
+	hl_residency.cpuPolicy = policy;
+}
+
+// bytes of a 2D texture, with its mip chain from 'level' down
+u64 textureBytes(int width, int height, int channels, int level, int mipmapped = true)
+{
+	u64 ret = 0;
+	int w = width >> level; if (w < 1) w = 1;
+	int h = height >> level; if (h < 1) h = 1;
+
+	while (1)
+	{
+		ret += (u64)w * h * channels;
+		if (!mipmapped || (w == 1 && h == 1)) break;
+		if (w > 1) w >>= 1;
+		if (h > 1) h >>= 1;
+	}
+	return ret;
+}
+
+int trackResource(int cls, uint id, u64 bytes)
+{
+	ResidentResource r;
+	memset(&r, 0, sizeof(r));
+	r.cls = cls;
+	r.id = id;
+	r.alive = 1;
+	r.bytes = bytes;
+	r.lastUsed = hl_residency.frame;
+
+	hl_residency.bytes[cls] += bytes;
+	if (hl_residency.bytes[cls] > hl_residency.peak[cls])
+		hl_residency.peak[cls] = hl_residency.bytes[cls];
+
+	// reuse a dead slot
+	for (int i = 0; i < hl_residency.resources.size; i++)
+	{
+		if (!hl_residency.resources[i].alive)
+		{
+			hl_residency.resources[i] = r;
+			return i;
+		}
+	}
+
+	hl_residency.resources.append(r);
+	return hl_residency.resources.size - 1;
+}
+
+void untrackResource(int index)
+{
+	if (index < 0 || index >= hl_residency.resources.size) return;
+
+	ResidentResource* r = &hl_residency.resources[index];
+	if (!r->alive) return;
+
+	hl_residency.bytes[r->cls] -= r->bytes;
+	r->alive = 0;
+}
+
+// 3D textures (depth > 1) are accounted but never evicted
+int trackTexture(Texture* tex, int width, int height, int depth, int channels, int mipmapped)
+{
+	int ret = trackResource(HL_RES_TEXTURE, tex->id, textureBytes(width, height, channels, 0, mipmapped) * depth);
+
+	ResidentResource* r = &hl_residency.resources[ret];
+	r->width = width;
+	r->height = height;
+	r->channels = channels;
+	r->format = tex->format;
+
+	return ret;
+}
+
+inline
+ResidentResource* textureResidency(Texture& tex)
+{
+	if (tex.residency < 0 || tex.residency >= hl_residency.resources.size) return 0;
+
+	ResidentResource* r = &hl_residency.resources[tex.residency];
+	if (!r->alive || r->id != tex.id) return 0;
+	return r;
+}
+
+// remember where a texture came from, so it can be evicted and reloaded
+void setTextureSource(Texture& tex, const char* path)
+{
+	ResidentResource* r = textureResidency(tex);
+	if (!r) return;
+
+	snprintf(r->path, sizeof(r->path), "%s", path);
+}
+
+// called from activateTexture
+void touchTexture(Texture& tex)
+{
+	ResidentResource* r = textureResidency(tex);
+	if (!r) return;
+
+	r->lastUsed = hl_residency.frame;
+	if (r->level > 0) r->wanted = 1;
+}
+
+//
+// Level rebuilding
+//
+// evictions and reloads rebuild the chain from the source file on a
+// job thread (the decode and downsampling is the slow part); the levels
+// are uploaded from updateResidency once the job is done, so the
+// drawing thread never reads a texture back or decodes one
+// (without job workers, see init, the decode runs right away)
+//
+
+inline
+int levelSize(int size, int level)
+{
+	size >>= level;
+	return (size < 1) ? 1 : size;
+}
+
+// index of the 1x1 level
+inline
+int textureMaxLevel(int width, int height)
+{
+	int ret = 0;
+	for (int s = (width > height) ? width : height; s > 1; s >>= 1) ret++;
+	return ret;
+}
+
+// 2x2 box filter into the next level
+void downsample(u8* src, int w, int h, int channels, u8* dst)
+{
+	int dw = (w > 1) ? w / 2 : 1;
+	int dh = (h > 1) ? h / 2 : 1;
+
+	for (int y = 0; y < dh; y++)
+	{
+		int y0 = (2*y < h) ? 2*y : h-1;
+		int y1 = (2*y+1 < h) ? 2*y+1 : h-1;
+
+		for (int x = 0; x < dw; x++)
+		{
+			int x0 = (2*x < w) ? 2*x : w-1;
+			int x1 = (2*x+1 < w) ? 2*x+1 : w-1;
+
+			for (int c = 0; c < channels; c++)
+			{
+				int sum = src[(y0*w + x0)*channels + c] + src[(y0*w + x1)*channels + c]
+					+ src[(y1*w + x0)*channels + c] + src[(y1*w + x1)*channels + c];
+				dst[(y*dw + x)*channels + c] = (sum + 2) / 4;
+			}
+		}
+	}
+}
+
+// decode the file and build levels [level, until) back to back
+u8* decodeChain(const char* path, int width, int height, int channels, int level, int until)
+{
+	int w, h, c;
+	u8* full = stbi_load(path, &w, &h, &c, channels);
+	if (!full) return 0;
+
+	u64 size = 0;
+	for (int l = level; l < until; l++) size += (u64)levelSize(width, l) * levelSize(height, l) * channels;
+	u8* ret = (u8*) malloc(size);
+
+	u8* src = full;
+	u8* at = ret;
+	w = width; h = height;
+
+	for (int l = 0; l < until; l++)
+	{
+		u64 bytes = (u64)w * h * channels;
+		if (l >= level)
+		{
+			memcpy(at, src, bytes);
+			at += bytes;
+		}
+		if (l + 1 == until) break;
+
+		int nw = levelSize(width, l + 1);
+		int nh = levelSize(height, l + 1);
+		u8* next = (u8*) malloc((u64)nw * nh * channels);
+		downsample(src, w, h, channels, next);
+		if (src != full) free(src);
+		src = next;
+		w = nw;
+		h = nh;
+	}
+
+	if (src != full) free(src);
+	stbi_image_free(full);
+	return ret;
+}
+
+void decodeResidencyJob(void* user, int begin, int end)
+{
+	ResidencyDecode* d = (ResidencyDecode*)user;
+	d->data = decodeChain(d->path, d->width, d->height, d->channels, d->level, textureMaxLevel(d->width, d->height) + 1);
+}
+
+// respecify the texture in place with its chain starting at 'level';
+// 'data' holds levels [level, 1x1] back to back, and a level past
+// the 1x1 one releases the storage entirely
+void setTextureLevel(ResidentResource* r, int level, u8* data)
+{
+	int maxLevel = textureMaxLevel(r->width, r->height);
+	int levels = (level > maxLevel) ? 0 : maxLevel - level + 1;
+	int oldLevels = (r->level > maxLevel) ? 0 : maxLevel - r->level + 1;
+
+	glBindTexture(GL_TEXTURE_2D, r->id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	u8* at = data;
+	for (int i = 0; i < levels; i++)
+	{
+		int w = levelSize(r->width, level + i);
+		int h = levelSize(r->height, level + i);
+		glTexImage2D(GL_TEXTURE_2D, i, r->format, w, h, 0, r->format, GL_UNSIGNED_BYTE, at);
+		at += (u64)w * h * r->channels;
+	}
+
+	// release the levels past the new end
+	for (int i = levels; i < oldLevels; i++)
+		glTexImage2D(GL_TEXTURE_2D, i, r->format, 0, 0, 0, r->format, GL_UNSIGNED_BYTE, 0);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (levels > 0) ? levels - 1 : 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	if (level < r->level) hl_residency.reloads++;
+	else hl_residency.evictions++;
+
+	u64 bytes = (levels > 0) ? textureBytes(r->width, r->height, r->channels, level) : 0;
+	hl_residency.bytes[HL_RES_TEXTURE] -= r->bytes;
+	r->bytes = bytes;
+	r->level = level;
+	hl_residency.bytes[HL_RES_TEXTURE] += r->bytes;
+
+	if (level == 0) r->wanted = 0;
+}
+
+// start rebuilding a texture at 'level' on a job thread;
+// returns 0 if all decode slots are busy
+int queueTextureLevel(int index, int level)
+{
+	ResidentResource* r = &hl_residency.resources[index];
+
+	for (int i = 0; i < HL_RESIDENCY_DECODES; i++)
+	{
+		ResidencyDecode* d = &hl_residency.decodes[i];
+		if (d->resource >= 0) continue;
+
+		d->resource = index;
+		d->id = r->id;
+		d->level = level;
+		d->width = r->width;
+		d->height = r->height;
+		d->channels = r->channels;
+		d->data = 0;
+		snprintf(d->path, sizeof(d->path), "%s", r->path);
+
+		d->freeing = (i64)r->bytes - (i64)textureBytes(r->width, r->height, r->channels, level);
+		hl_residency.freeing += d->freeing;
+		r->decoding = 1;
+		runJob(decodeResidencyJob, d, 0, 1, &d->counter);
+		return 1;
+	}
+	return 0;
+}
+
+// upload the chains that finished decoding
+void completeTextureLevels()
+{
+	for (int i = 0; i < HL_RESIDENCY_DECODES; i++)
+	{
+		ResidencyDecode* d = &hl_residency.decodes[i];
+		if (d->resource < 0 || d->counter.pending > 0) continue;
+
+		// let the job's finishJob leave before the slot is reused
+		{ std::lock_guard<std::mutex> guard(d->counter.lock); }
+
+		ResidentResource* r = &hl_residency.resources[d->resource];
+		hl_residency.freeing -= d->freeing;
+
+		// the texture may have been deleted in the meantime
+		if (r->alive && r->id == d->id)
+		{
+			r->decoding = 0;
+			if (d->data) setTextureLevel(r, d->level, d->data);
+			else fprintf(stderr, "[Texture] Failed to reload '%s'\n", d->path);
+		}
+
+		free(d->data);
+		d->data = 0;
+		d->resource = -1;
+	}
+}
+
+// enforce the budget; called once per frame from presentFrame
+void updateResidency()
+{
+	hl_residency.frame++;
+	completeTextureLevels();
+	if (!hl_residency.budget) return;
+
+	u64* used = &hl_residency.bytes[HL_RES_TEXTURE];
+
+	// evict least recently drawn textures until we fit,
+	// counting what decodes in flight will free
+	while ((i64)*used - hl_residency.freeing > (i64)hl_residency.budget)
+	{
+		int oldest = -1;
+		for (int i = 0; i < hl_residency.resources.size; i++)
+		{
+			ResidentResource* r = &hl_residency.resources[i];
+			if (!r->alive || r->cls != HL_RES_TEXTURE || !r->path[0] || r->decoding) continue;
+			if (hl_residency.frame - r->lastUsed < HL_RESIDENCY_GRACE) continue;
+			if (r->level > textureMaxLevel(r->width, r->height)) continue;
+
+			if (oldest < 0 || r->lastUsed < hl_residency.resources[oldest].lastUsed) oldest = i;
+		}
+		if (oldest < 0) break;
+
+		ResidentResource* r = &hl_residency.resources[oldest];
+		int maxLevel = textureMaxLevel(r->width, r->height);
+
+		// from the 1x1 level the texture goes entirely, which needs no decode
+		if (r->level == maxLevel) setTextureLevel(r, maxLevel + 1, 0);
+		else
+		{
+			int level = r->level + HL_EVICT_STEP;
+			if (level > maxLevel) level = maxLevel;
+			if (!queueTextureLevel(oldest, level)) break;
+		}
+	}
+
+	// bring back one wanted texture per frame, if it fits
+	for (int i = 0; i < hl_residency.resources.size; i++)
+	{
+		ResidentResource* r = &hl_residency.resources[i];
+		if (!r->alive || !r->wanted || r->decoding) continue;
+
+		u64 full = textureBytes(r->width, r->height, r->channels, 0);
+		if ((i64)(*used - r->bytes + full) - hl_residency.freeing > (i64)hl_residency.budget) continue;
+
+		queueTextureLevel(i, 0);
+		break;
+	}
+}
+
+struct ResidencyStats
+{
+	u64 bytes[HL_RES_CLASSES];
+	u64 peak[HL_RES_CLASSES];
+	int counts[HL_RES_CLASSES];
+	int evicted; // textures currently below full resolution
+	int evictions;
+	int reloads;
+	u64 cpuBytesFreed;
+};
+
+ResidencyStats getResidencyStats()
+{
+	ResidencyStats ret;
+	memset(&ret, 0, sizeof(ret));
+
+	for (int c = 0; c < HL_RES_CLASSES; c++)
+	{
+		ret.bytes[c] = hl_residency.bytes[c];
+		ret.peak[c] = hl_residency.peak[c];
+	}
+
+	for (int i = 0; i < hl_residency.resources.size; i++)
+	{
+		ResidentResource* r = &hl_residency.resources[i];
+		if (!r->alive) continue;
+
+		ret.counts[r->cls]++;
+		if (r->level > 0) ret.evicted++;
+	}
+
+	ret.evictions = hl_residency.evictions;
+	ret.reloads = hl_residency.reloads;
+	ret.cpuBytesFreed = hl_residency.cpuBytesFreed;
+	return ret;
+}
+
+void dumpResidency(FILE* f = stderr)
+{
+	ResidencyStats stats = getResidencyStats();
+
+	fprintf(f, "[Residency] frame %u, budget %llu KiB\n", hl_residency.frame, (unsigned long long)(hl_residency.budget >> 10));
+	for (int c = 0; c < HL_RES_CLASSES; c++)
+	{
+		fprintf(f, "  %-8s %5i  %8llu KiB  (peak %llu KiB)\n", hl_residencyClassNames[c], stats.counts[c],
+			(unsigned long long)(stats.bytes[c] >> 10), (unsigned long long)(stats.peak[c] >> 10));
+	}
+	fprintf(f, "  %i evicted, %i evictions, %i reloads, %llu KiB of CPU copies freed\n",
+		stats.evicted, stats.evictions, stats.reloads, (unsigned long long)(stats.cpuBytesFreed >> 10));
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+//
+// Dynamic resolution
+//
+// the scene renders into a sub-rectangle of a max-size frame;
+// the rectangle shrinks or grows with measured GPU time so
+// the frame stays inside its budget, then gets upscaled
+// to the window at present
+//
+// drawing in frame coordinates keeps working unchanged,
+// since the viewport maps them onto the scaled rectangle
+//
+
+#define HL_DRS_QUERIES 4 // frames of latency before a timing is read back
+
+#define HL_UPSCALE_BILINEAR 0
+#define HL_UPSCALE_SHARPEN 1
+
+#define UPSCALE_SHADER_FS "\
+#version 330\
+\n	\
+\n in vec2 fragCoord;\
+\n \
+\n layout (location = 0) out vec4 finalColor;\
+\n	\
+\n	uniform sampler2D texture;\
+\n uniform vec2 uvScale;\
+\n uniform vec2 texel;\
+\n uniform float sharpness;\
+\n	\
+\n	void main()\
+\n	{\
+\n		// stay inside the rendered rectangle; past it are stale texels\
+\n		// from earlier, larger frames\
+\n		vec2 lo = 0.5 * texel;\
+\n		vec2 hi = uvScale - 0.5 * texel;\
+\n		vec2 uv = fragCoord * uvScale;\
+\n		vec3 c = texture2D(texture, clamp(uv, lo, hi)).rgb;\
+\n		vec3 n = texture2D(texture, clamp(uv + vec2(0, texel.y), lo, hi)).rgb;\
+\n		vec3 s = texture2D(texture, clamp(uv - vec2(0, texel.y), lo, hi)).rgb;\
+\n		vec3 e = texture2D(texture, clamp(uv + vec2(texel.x, 0), lo, hi)).rgb;\
+\n		vec3 w = texture2D(texture, clamp(uv - vec2(texel.x, 0), lo, hi)).rgb;\
+\n		vec3 edge = 4.0 * c - n - s - e - w;\
+\n		finalColor = vec4(clamp(c + edge * sharpness * 0.25, 0.0, 1.0), 1.0);\
+\n	}\
+"
+
+struct
+{
+	Frame frame; // allocated once at full frame size
+
+	int width, height; // current render size
+	float scale;
+	float minScale;
+	float budget; // target GPU time in milliseconds
+	float gpuTime; // last measured GPU time in milliseconds
+
+	uint queries[HL_DRS_QUERIES];
+	int queryHead; // next query to issue
+	int queryCount; // queries in flight
+	int timing; // a query is open for this frame
+
+	int upscale;
+	float sharpness;
+	Shader upscaleShader;
+
+	int enabled;
+}
+hl_drs;
+
+void setupDynamicResolution(float budgetMs, float minScale = 0.5, int upscale = HL_UPSCALE_BILINEAR, float sharpness = 0.5)
+{
+	hl_drs.frame = createFrame(1, 1, hl.fwidth, hl.fheight);
+
+	hl_drs.scale = 1.0;
+	hl_drs.minScale = minScale;
+	hl_drs.budget = budgetMs;
+	hl_drs.gpuTime = 0;
+	hl_drs.width = hl.fwidth;
+	hl_drs.height = hl.fheight;
+
+	glGenQueries(HL_DRS_QUERIES, hl_drs.queries);
+	hl_drs.queryHead = 0;
+	hl_drs.queryCount = 0;
+
+	hl_drs.upscale = upscale;
+	hl_drs.sharpness = sharpness;
+	if (upscale == HL_UPSCALE_SHARPEN)
+	{
+		hl_drs.upscaleShader = createShader(TEXTURE_SHADER_VS, UPSCALE_SHADER_FS);
+		hl_drs.upscaleShader.setName("hlUpscaleShader");
+		bindUniformBlock(&hl_drs.upscaleShader, "hlDraw", HL_DRAW_BINDING);
+	}
+
+	hl_drs.enabled = 1;
+}
+
+// pick a new scale from the latest GPU time
+void updateResolutionScale(float gpuTime)
+{
+	hl_drs.gpuTime = gpuTime;
+	if (gpuTime <= 0) return;
+
+	// pixel count scales with the square of the axis scale
+	float target = hl_drs.scale * sqrt(hl_drs.budget / gpuTime);
+
+	// leave some headroom under the budget before growing again
+	if (target > hl_drs.scale) target = hl_drs.scale + (target - hl_drs.scale) * 0.1;
+	else target = hl_drs.scale + (target - hl_drs.scale) * 0.5;
+
+	target = clamp(target, hl_drs.minScale, 1.0f);
+
+	// ignore jitter so the image doesn't swim
+	if (fabs(target - hl_drs.scale) < 0.02) return;
+	hl_drs.scale = target;
+
+	// keep the render size on an 8 pixel grid
+	hl_drs.width = ((int)(hl.fwidth * hl_drs.scale) + 7) & ~7;
+	hl_drs.height = ((int)(hl.fheight * hl_drs.scale) + 7) & ~7;
+	if (hl_drs.width > (int)hl.fwidth) hl_drs.width = hl.fwidth;
+	if (hl_drs.height > (int)hl.fheight) hl_drs.height = hl.fheight;
+}
+
+void beginDynamicFrame()
+{
+	// collect timings that are ready without waiting on the GPU
+	while (hl_drs.queryCount > 0)
+	{
+		int oldest = (hl_drs.queryHead - hl_drs.queryCount + HL_DRS_QUERIES) % HL_DRS_QUERIES;
+
+		int available = 0;
+		glGetQueryObjectiv(hl_drs.queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(hl_drs.queries[oldest], GL_QUERY_RESULT, &elapsed);
+		hl_drs.queryCount--;
+
+		updateResolutionScale(elapsed / 1000000.0);
+	}
+
+	enableFrame(&hl_drs.frame);
+	glViewport(0, 0, hl_drs.width, hl_drs.height);
+
+	// out of queries means the GPU is far behind; skip timing this frame
+	if (hl_drs.queryCount < HL_DRS_QUERIES)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, hl_drs.queries[hl_drs.queryHead]);
+		hl_drs.queryHead = (hl_drs.queryHead + 1) % HL_DRS_QUERIES;
+		hl_drs.queryCount++;
+		hl_drs.timing = 1;
+	}
+	else hl_drs.timing = 0;
+}
+
+void endDynamicFrame()
+{
+	if (hl_drs.timing) glEndQuery(GL_TIME_ELAPSED);
+	hl_drs.timing = 0;
+}
+
+// upscale the rendered rectangle onto the window
+void presentDynamicFrame()
+{
+	defaultFrame();
+	glViewport(0, 0, hl.wwidth, hl.wheight);
+
+	DrawBlock draw;
+	draw.transform = identity<mat4>();
+	draw.diffuse = vec4(1.0);
+
+	// a plain blit if the uniform ring is full this frame
+	if (hl_drs.upscale == HL_UPSCALE_SHARPEN && bindUniforms(pushUniforms(&draw, sizeof(draw)), HL_DRAW_BINDING))
+	{
+		Shader* shader = &hl_drs.upscaleShader;
+		useShader(shader);
+
+		// sharpen harder the further we are below native
+		float sharpness = hl_drs.sharpness * (1.0 - hl_drs.scale) / (1.0 - hl_drs.minScale + 0.0001);
+		
+		shader->setTexture("texture", hl_drs.frame.color);
+		shader->setVec2("uvScale", vec2((float)hl_drs.width / hl.fwidth, (float)hl_drs.height / hl.fheight));
+		shader->setVec2("texel", vec2(1.0 / hl.fwidth, 1.0 / hl.fheight));
+		shader->setFloat("sharpness", sharpness);
+
+		glBindVertexArray(hl_textureQuad);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glBindVertexArray(0);
+
+		clearTextures();
+	}
+	else
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, hl_drs.frame.fbo);
+		glBlitFramebuffer(0, 0, hl_drs.width, hl_drs.height, 0, 0, hl.wwidth, hl.wheight,
+			GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	}
+
+	presentFrame();
+}
\ No newline at end of file
@@ -1,24 +1,51 @@
 #pragma once
 
-void FileToString(char* file, char** string)
+// with an arena the string is freed along with it,
+// otherwise it's the caller's to free
+void FileToString(char* file, char** string, Arena* arena = 0)
 {
+	*string = 0;
+	
 	FILE* f = fopen(file, "r");
+	if (!f)
+	{
+		fprintf(stderr, "[Shader] Can't open '%s'\n", file);
+		return;
+	}
+	
 	fseek(f, 0, SEEK_END);
 	int len = ftell(f) + 1;
 	fseek(f, 0, SEEK_SET);
 	
-	*string = (char*)malloc(len * sizeof(char));
-	fread(*string, sizeof(char), len, f);
+	*string = (arena) ? (char*)arenaAlloc(arena, len, 1) : (char*)malloc(len * sizeof(char));
+	int read = fread(*string, sizeof(char), len - 1, f);
+	(*string)[read] = 0;
+	
+	fclose(f);
 }
 
+#define HL_SHADER_READY 0
+#define HL_SHADER_PENDING 1 // submitted, status not checked yet
+#define HL_SHADER_FAILED 2
+
+#define HL_SHADER_PENDING_BLOCKS 4 // block bindings held until the program is resolved
+
 struct Shader
 {
 	uint id;
 	uint vert;
 	uint frag;
 	
+	int status;
+	u64 sourceHash; // cache key, 0 if not cached
+	
 	char name[32];
 	
+	// bindUniformBlock calls made while pending, applied by finishShader
+	char pendingBlocks[HL_SHADER_PENDING_BLOCKS][32];
+	uint pendingBindings[HL_SHADER_PENDING_BLOCKS];
+	int numPendingBlocks;
+	
 	void setName(const char* _name)
 	{
 		int i = 0;
@@ -64,68 +91,457 @@ struct Shader
 	
 	void setTexture(char* uniform, Texture& texture)
 	{
+		// activateTexture takes the next unit
 		activateTexture(texture);
-		glUniform1i(glGetUniformLocation(id, uniform), textureSlot);
-		
-		textureSlot++;
+		glUniform1i(glGetUniformLocation(id, uniform), texture.slot);
 		//glActiveTexture(0); // so we dont accidentally modify this texture with later operations
 	}
 };
 
 Shader* activeShader = 0;
 
-Shader createShader(char* vertCode, char* fragCode)
+//
+// Program binary cache
+//
+// linked programs are written to disk keyed by a hash of their source;
+// each entry also records which driver produced it, so an entry
+// from another driver or GPU is dropped and rebuilt instead of loaded
+//
+
+#define HL_SHADER_CACHE_MAGIC 0x4C48424E // 'HLBN'
+
+struct ShaderCacheHeader
+{
+	u32 magic;
+	u32 format; // driver binary format
+	u64 sourceHash;
+	u64 driverHash;
+	u32 length; // bytes of binary following the header
+};
+
+struct
+{
+	char dir[256]; // empty = cache disabled
+	u64 driverHash;
+	int hits;
+	int misses;
+}
+hl_shaderCache;
+
+u64 hashString(const char* str, u64 hash = 0xcbf29ce484222325)
+{
+	// FNV-1a
+	for (; *str != 0; str++)
+	{
+		hash ^= (u8)*str;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+// enable the cache, storing binaries in 'dir' (which must exist)
+// call after the window is open, before setup()
+void setShaderCache(const char* dir)
+{
+	hl_shaderCache.dir[0] = 0;
+	
+	int formats = 0;
+	if (glProgramBinary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats < 1)
+	{
+		fprintf(stderr, "[Shader] Program binaries unsupported, cache disabled\n");
+		return;
+	}
+	
+	snprintf(hl_shaderCache.dir, sizeof(hl_shaderCache.dir), "%s", dir);
+	
+	u64 hash = hashString((const char*)glGetString(GL_VENDOR));
+	hash = hashString((const char*)glGetString(GL_RENDERER), hash);
+	hash = hashString((const char*)glGetString(GL_VERSION), hash);
+	hl_shaderCache.driverHash = hash;
+}
+
+void shaderCachePath(char* path, int size, u64 sourceHash)
+{
+	snprintf(path, size, "%s/%016llx.shbin", hl_shaderCache.dir, (unsigned long long)sourceHash);
+}
+
+// returns 1 and fills in the program on a valid cache entry
+int loadCachedProgram(Shader* shader, u64 sourceHash)
+{
+	char path[300];
+	shaderCachePath(path, sizeof(path), sourceHash);
+	
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+	
+	ShaderCacheHeader header;
+	int valid = fread(&header, sizeof(header), 1, f) == 1
+		&& header.magic == HL_SHADER_CACHE_MAGIC
+		&& header.sourceHash == sourceHash
+		&& header.driverHash == hl_shaderCache.driverHash;
+	
+	void* binary = 0;
+	if (valid)
+	{
+		binary = malloc(header.length);
+		valid = fread(binary, 1, header.length, f) == header.length;
+	}
+	fclose(f);
+	
+	if (valid)
+	{
+		shader->id = glCreateProgram();
+		glProgramBinary(shader->id, header.format, binary, header.length);
+		
+		int linked = 0;
+		glGetProgramiv(shader->id, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			glDeleteProgram(shader->id);
+			valid = 0;
+		}
+	}
+	free(binary);
+	
+	if (!valid)
+	{
+		// stale or corrupt, rebuild from source
+		fprintf(stderr, "[Shader] Dropping stale cache entry %016llx\n", (unsigned long long)sourceHash);
+		remove(path);
+	}
+	
+	return valid;
+}
+
+void storeCachedProgram(Shader* shader, u64 sourceHash)
+{
+	int length = 0;
+	glGetProgramiv(shader->id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length < 1) return;
+	
+	ShaderCacheHeader header;
+	header.magic = HL_SHADER_CACHE_MAGIC;
+	header.sourceHash = sourceHash;
+	header.driverHash = hl_shaderCache.driverHash;
+	
+	void* binary = malloc(length);
+	GLenum format;
+	glGetProgramBinary(shader->id, length, &length, &format, binary);
+	header.format = format;
+	header.length = length;
+	
+	char path[300];
+	shaderCachePath(path, sizeof(path), sourceHash);
+	
+	FILE* f = fopen(path, "wb");
+	if (f)
+	{
+		fwrite(&header, sizeof(header), 1, f);
+		fwrite(binary, 1, length, f);
+		fclose(f);
+	}
+	else fprintf(stderr, "[Shader] Failed to write cache entry '%s'\n", path);
+	
+	free(binary);
+}
+
+//
+// Non-blocking compilation
+//
+// submitShader queues compile and link without asking for the result,
+// which would make the driver finish the work on the spot;
+// status is only checked once the program is first used.
+// with KHR_parallel_shader_compile the driver also compiles
+// on its own threads and shaderReady can be polled
+//
+
+int hl_parallelCompile = 0;
+
+void setupParallelShaderCompile()
+{
+	if (!glMaxShaderCompilerThreadsKHR) return;
+	
+	glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // let the driver decide
+	hl_parallelCompile = 1;
+}
+
+Shader submitShader(char* vertCode, char* fragCode)
 {
 	Shader ret;
 	
 	ret.name[0] = 0; // null terminate for safety
+	ret.vert = 0;
+	ret.frag = 0;
+	ret.sourceHash = 0;
+	ret.status = HL_SHADER_PENDING;
+	ret.numPendingBlocks = 0;
 	
-	int compile = 0;
-	char err_str[1024];
+	// binaries wouldn't replay elsewhere, so traces go through source
+	if (hl_shaderCache.dir[0] != 0 && !hl_trace.running)
+	{
+		// separator keeps "ab"+"c" and "a"+"bc" apart
+		ret.sourceHash = hashString(fragCode, hashString("\x01", hashString(vertCode)));
+		
+		if (loadCachedProgram(&ret, ret.sourceHash))
+		{
+			hl_shaderCache.hits++;
+			fprintf(stderr, "[Shader] Cache hit %016llx\n", (unsigned long long)ret.sourceHash);
+			ret.status = HL_SHADER_READY;
+			return ret;
+		}
+		
+		hl_shaderCache.misses++;
+		fprintf(stderr, "[Shader] Cache miss %016llx\n", (unsigned long long)ret.sourceHash);
+	}
 	
 	ret.vert = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(ret.vert, 1, &vertCode, 0);
 	glCompileShader(ret.vert);
-	glGetShaderiv(ret.vert, GL_COMPILE_STATUS, &compile);
-	if (!compile)
-	{
-		glGetShaderInfoLog(ret.vert, 1024, 0, err_str);
-		fprintf(stderr, "ERROR: [%s] vertex\n%s", ret.name, err_str);
-	}
 	
 	ret.frag = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(ret.frag, 1, &fragCode, NULL);
 	glCompileShader(ret.frag);
-	glGetShaderiv(ret.frag, GL_COMPILE_STATUS, &compile);
-	if (!compile)
-	{
-		glGetShaderInfoLog(ret.frag, 1024, 0, err_str);
-		fprintf(stderr, "ERROR: [%s] fragment\n%s", ret.name, err_str);
-	}
 	
 	ret.id = glCreateProgram();
 	glAttachShader(ret.id, ret.vert);
 	glAttachShader(ret.id, ret.frag);
+	if (ret.sourceHash) glProgramParameteri(ret.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ret.id);
 	
-	glDeleteShader(ret.vert);
-	glDeleteShader(ret.frag);
+	return ret;
+}
+
+// non-blocking when the driver compiles in parallel,
+// otherwise pending programs always report ready
+// (checking them would block anyway)
+int shaderReady(Shader* shader)
+{
+	if (shader->status != HL_SHADER_PENDING) return 1;
+	if (!hl_parallelCompile) return 1;
+	
+	int done = 0;
+	glGetProgramiv(shader->id, GL_COMPLETION_STATUS_KHR, &done);
+	return done;
+}
+
+int shadersReady(Shader* shaders, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (!shaderReady(&shaders[i])) return 0;
+	return 1;
+}
+
+void setUniformBlockBinding(Shader* shader, const char* block, uint binding)
+{
+	uint index = glGetUniformBlockIndex(shader->id, block);
+	if (index == GL_INVALID_INDEX)
+	{
+		fprintf(stderr, "[Shader] [%s] has no uniform block '%s'\n", shader->name, block);
+		return;
+	}
+	glUniformBlockBinding(shader->id, index, binding);
+}
+
+// wait for the result, report errors and release the stage objects
+int finishShader(Shader* shader)
+{
+	if (shader->status != HL_SHADER_PENDING)
+		return shader->status == HL_SHADER_READY;
+	
+	int linked = 0;
+	glGetProgramiv(shader->id, GL_LINK_STATUS, &linked);
+	
+	if (!linked)
+	{
+		int compile = 0;
+		char err_str[1024];
+		
+		glGetShaderiv(shader->vert, GL_COMPILE_STATUS, &compile);
+		if (!compile)
+		{
+			glGetShaderInfoLog(shader->vert, 1024, 0, err_str);
+			fprintf(stderr, "ERROR: [%s] vertex\n%s", shader->name, err_str);
+		}
+		
+		glGetShaderiv(shader->frag, GL_COMPILE_STATUS, &compile);
+		if (!compile)
+		{
+			glGetShaderInfoLog(shader->frag, 1024, 0, err_str);
+			fprintf(stderr, "ERROR: [%s] fragment\n%s", shader->name, err_str);
+		}
+		
+		glGetProgramInfoLog(shader->id, 1024, 0, err_str);
+		fprintf(stderr, "ERROR: [%s] link\n%s", shader->name, err_str);
+	}
+	
+	glDetachShader(shader->id, shader->vert);
+	glDetachShader(shader->id, shader->frag);
+	glDeleteShader(shader->vert);
+	glDeleteShader(shader->frag);
+	shader->vert = 0;
+	shader->frag = 0;
+	
+	if (linked && shader->sourceHash) storeCachedProgram(shader, shader->sourceHash);
+	
+	if (linked)
+	{
+		for (int i = 0; i < shader->numPendingBlocks; i++)
+			setUniformBlockBinding(shader, shader->pendingBlocks[i], shader->pendingBindings[i]);
+	}
+	shader->numPendingBlocks = 0;
+	
+	shader->status = (linked) ? HL_SHADER_READY : HL_SHADER_FAILED;
+	return linked;
+}
+
+void finishShaders(Shader* shaders, int count)
+{
+	for (int i = 0; i < count; i++)
+		finishShader(&shaders[i]);
+}
+
+Shader createShader(char* vertCode, char* fragCode)
+{
+	Shader ret = submitShader(vertCode, fragCode);
+	finishShader(&ret);
+	return ret;
+}
+
+//
+// Precompiled variants from shadercomp ('@variant')
+//
+// one program per unique fragment variant, all sharing a vertex stage,
+// or, when both stages have variants (e.g. skinning in the vertex stage),
+// one per unique pair of them; a material's feature bitmask picks its
+// program through the index table
+//
+
+struct ShaderVariants
+{
+	Shader* programs;
+	int count;
+	const unsigned char* index; // feature bitmask -> program
+	unsigned char* ownIndex; // 'index' when built here rather than generated, 0 otherwise
+	
+	Shader* get(uint features)
+	{
+		return &programs[index[features]];
+	}
+};
+
+// e.g. createShaderVariants(meshvsShaderCode, matfsShaderVariants,
+//      matfsShaderVariantCount, matfsShaderVariantIndex)
+ShaderVariants createShaderVariants(char* vertCode, char** fragVariants, int count, const unsigned char* index)
+{
+	ShaderVariants ret;
+	ret.programs = (Shader*) malloc(count * sizeof(Shader));
+	ret.count = count;
+	ret.index = index;
+	ret.ownIndex = 0;
+	
+	// submitted together, resolved on first use
+	for (int i = 0; i < count; i++)
+		ret.programs[i] = submitShader(vertCode, fragVariants[i]);
+	
+	return ret;
+}
+
+// both stages from shadercomp, paired as 'meshvs.glsl+matfs.glsl' so their axes share bits;
+// 'masks' is either's ShaderVariantMasks
+// e.g. createShaderVariants(meshvsShaderVariants, meshvsShaderVariantIndex,
+//      matfsShaderVariants, matfsShaderVariantIndex, matfsShaderVariantMasks)
+ShaderVariants createShaderVariants(char** vertVariants, const unsigned char* vertIndex,
+	char** fragVariants, const unsigned char* fragIndex, int masks)
+{
+	ShaderVariants ret;
+	unsigned char* index = (unsigned char*) malloc(masks);
+	u16* pairs = (u16*) malloc(masks * sizeof(u16));
+	ret.count = 0;
+	
+	// features that change neither stage share a program
+	for (int mask = 0; mask < masks; mask++)
+	{
+		u16 pair = vertIndex[mask] << 8 | fragIndex[mask];
+		
+		int found = 0;
+		while (found < ret.count && pairs[found] != pair) found++;
+		if (found == ret.count) pairs[ret.count++] = pair;
+		
+		index[mask] = found;
+	}
 	
+	ret.programs = (Shader*) malloc(ret.count * sizeof(Shader));
+	ret.index = index;
+	ret.ownIndex = index;
+	
+	// submitted together, resolved on first use
+	for (int i = 0; i < ret.count; i++)
+		ret.programs[i] = submitShader(vertVariants[pairs[i] >> 8], fragVariants[pairs[i] & 0xff]);
+	
+	free(pairs);
 	return ret;
 }
 
+void deleteShaderVariants(ShaderVariants* variants)
+{
+	for (int i = 0; i < variants->count; i++)
+	{
+		Shader* shader = &variants->programs[i];
+		if (activeShader == shader) activeShader = 0;
+		
+		// still pending: the stages haven't been released yet
+		if (shader->vert) glDeleteShader(shader->vert);
+		if (shader->frag) glDeleteShader(shader->frag);
+		glDeleteProgram(shader->id);
+	}
+	
+	free(variants->programs);
+	free(variants->ownIndex);
+	variants->programs = 0;
+	variants->ownIndex = 0;
+	variants->index = 0;
+	variants->count = 0;
+}
+
+#define DEPTH_SHADER_FS "\
+#version 330\
+\n	void main() {}\
+"
+
+// depth-only program sharing a shading program's vertex code,
+// for Model::draw's pre-pass
+Shader createDepthShader(char* vertCode)
+{
+	return createShader(vertCode, DEPTH_SHADER_FS);
+}
+
 Shader createShaderFromFile(char* vertPath, char* fragPath)
 {
+	// the sources are only needed until they're handed to GL
+	Arena scratch = createArena(1 << 16);
+	
 	char* vertCode;
 	char* fragCode;
-	FileToString(vertPath, &vertCode);
-	FileToString(fragPath, &fragCode);
+	FileToString(vertPath, &vertCode, &scratch);
+	FileToString(fragPath, &fragCode, &scratch);
+	
+	Shader ret;
+	if (vertCode && fragCode) ret = createShader(vertCode, fragCode);
+	else
+	{
+		memset(&ret, 0, sizeof(ret));
+		ret.status = HL_SHADER_FAILED;
+	}
 	
-	return createShader(vertCode, fragCode);
+	freeArena(&scratch);
+	return ret;
 }
 
 void useShader(Shader* shader)
 {
+	if (shader->status == HL_SHADER_PENDING) finishShader(shader);
+	
 	activeShader = shader;
 	glUseProgram(shader->id);
 }
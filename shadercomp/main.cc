@@ -19,7 +19,15 @@ This will overwrite any existing file at the path.\n"
 scomp - shader precompilation utility\n\
 Processes GLSL shader code into C header definitions.\n\
 \n\
-Use '@import FILE_PATH'. (Must include space!)\n"
+Use '@import FILE_PATH'. (Must include space!)\n\
+Use '@variant NAME1 NAME2 ...' to generate one shader per combination;\n\
+'#ifdef NAME' blocks are resolved, identical outputs are merged and\n\
+NAMEShaderVariantIndex maps a feature bitmask to NAMEShaderVariants.\n\
+Pass a pair as VERT_FILE+FRAG_FILE to number both stages' axes\n\
+together, so one feature bitmask (e.g. skinning in the vertex\n\
+stage) indexes both tables.\n\
+Uniform blocks (std140) and buffer blocks (std430) are emitted as\n\
+C++ structs with checked offsets, plus a BLOCKBinding index.\n"
 
 FILE* out;
 
@@ -75,7 +83,71 @@ char* pathGetName(char* path, char delimeter)
 	return ret;
 }
 
-void expandFile(char* pwd, char* name)
+//
+// Growable text buffer
+//
+
+struct Text
+{
+	char* data;
+	uint len;
+	uint cap;
+};
+
+void textAppend(Text* t, const char* s, uint n)
+{
+	if (t->len + n + 1 > t->cap)
+	{
+		uint cap = (t->cap) ? t->cap : 1024;
+		while (t->len + n + 1 > cap) cap *= 2;
+		t->data = (char*) realloc(t->data, cap);
+		t->cap = cap;
+	}
+	memcpy(t->data + t->len, s, n);
+	t->len += n;
+	t->data[t->len] = 0;
+}
+
+void textPutc(Text* t, char c)
+{
+	textAppend(t, &c, 1);
+}
+
+//
+// Variant axes ('@variant NAME NAME ...')
+//
+
+#define MAX_AXES 8 // 256 permutations, so the index table fits in bytes
+
+struct Axes
+{
+	char names[MAX_AXES][64];
+	uint count;
+};
+
+void addAxis(Axes* axes, char* name)
+{
+	for (uint i = 0; i < axes->count; i++)
+		if (!strcmp(axes->names[i], name)) return;
+	
+	if (axes->count >= MAX_AXES)
+	{
+		fprintf(stderr, "Too many variant axes (max %i), ignoring '%s'\n", MAX_AXES, name);
+		return;
+	}
+	
+	snprintf(axes->names[axes->count], 64, "%s", name);
+	axes->count++;
+}
+
+int findAxis(Axes* axes, const char* name, uint len)
+{
+	for (uint i = 0; i < axes->count; i++)
+		if (strlen(axes->names[i]) == len && !strncmp(axes->names[i], name, len)) return i;
+	return -1;
+}
+
+void expandFile(Text* dst, Axes* axes, char* pwd, char* name)
 {
 	string path(pwd);
 	path.append(name);
@@ -89,21 +161,51 @@ void expandFile(char* pwd, char* name)
 	
 	fseek(file, 0, SEEK_SET);
 	
-	char c = fgetc(file);
+	int c = fgetc(file);
 	
 	while (c != 0 && c != EOF)
 	{
-		if (c == '\n') fputs("\\\n\\n\t", out);
-		
-		else if (c == '@')
+		if (c == '@')
 		{
-			char* import = (char*) malloc(512 * sizeof(char));
-			fscanf(file, "%s%s", import, import);
-			expandFile(pathGetDir(path.str, PATH_DELIM), import);
-			free(import);
+			char directive[64];
+			fscanf(file, "%63s", directive);
+			
+			if (!strcmp(directive, "import"))
+			{
+				char* import = (char*) malloc(512 * sizeof(char));
+				fscanf(file, "%511s", import);
+				expandFile(dst, axes, pathGetDir(path.str, PATH_DELIM), import);
+				free(import);
+			}
+			else if (!strcmp(directive, "variant"))
+			{
+				// names up to the end of the line
+				char axis[64];
+				uint n = 0;
+				
+				c = fgetc(file);
+				while (1)
+				{
+					if (c == ' ' || c == '\t' || c == '\n' || c == EOF)
+					{
+						if (n > 0)
+						{
+							axis[n] = 0;
+							addAxis(axes, axis);
+							n = 0;
+						}
+						if (c == '\n' || c == EOF) break;
+					}
+					else if (n < 63) axis[n++] = c;
+					
+					c = fgetc(file);
+				}
+				continue; // keep the newline
+			}
+			else fprintf(stderr, "Unknown directive '@%s' in '%s'\n", directive, path.str);
 		}
 		
-		else fputc(c, out);
+		else textPutc(dst, c);
 		c = fgetc(file);
 	}
 	
@@ -112,6 +214,515 @@ void expandFile(char* pwd, char* name)
 	return;
 }
 
+//
+// Permutations
+//
+// '#ifdef'/'#ifndef' blocks on a variant axis are resolved here,
+// so every variant is branch-free; anything else is left to the
+// GLSL preprocessor, with a '#define' for enabled axes that are
+// still referenced after resolution
+//
+
+struct Block
+{
+	int resolved; // condition was on an axis
+	int active; // lines inside are kept
+	int taken; // condition held (for #else)
+};
+
+const char* skipSpace(const char* s)
+{
+	while (*s == ' ' || *s == '\t') s++;
+	return s;
+}
+
+uint wordLength(const char* s)
+{
+	uint n = 0;
+	while (s[n] == '_' || (s[n] >= '0' && s[n] <= '9')
+		|| (s[n] >= 'a' && s[n] <= 'z') || (s[n] >= 'A' && s[n] <= 'Z')) n++;
+	return n;
+}
+
+// does 'name' appear as a whole word in 'text'
+int referencesWord(const char* text, const char* name)
+{
+	uint len = strlen(name);
+	const char* at = text;
+	
+	while ((at = strstr(at, name)))
+	{
+		int before = (at == text) ? 0 : wordLength(at - 1);
+		if (!before && wordLength(at) == len) return 1;
+		at += len;
+	}
+	return 0;
+}
+
+void resolveVariant(const char* src, Axes* axes, uint mask, Text* dst)
+{
+	Block stack[64];
+	int depth = 0;
+	
+	const char* line = src;
+	while (*line)
+	{
+		const char* end = strchr(line, '\n');
+		uint lineLen = (end) ? (end - line + 1) : strlen(line);
+		
+		int parentActive = (depth > 0) ? stack[depth-1].active : 1;
+		int emit = parentActive;
+		
+		const char* s = skipSpace(line);
+		if (*s == '#')
+		{
+			s = skipSpace(s + 1);
+			uint dirLen = wordLength(s);
+			const char* arg = skipSpace(s + dirLen);
+			int axis = findAxis(axes, arg, wordLength(arg));
+			
+			if ((dirLen == 5 && !strncmp(s, "ifdef", 5)) || (dirLen == 6 && !strncmp(s, "ifndef", 6)))
+			{
+				Block b;
+				b.resolved = axis >= 0;
+				b.taken = 1;
+				if (b.resolved)
+				{
+					b.taken = ((mask >> axis) & 1) == (dirLen == 5);
+					emit = 0;
+				}
+				b.active = parentActive && b.taken;
+				if (depth < 64) stack[depth++] = b;
+			}
+			else if (dirLen == 2 && !strncmp(s, "if", 2))
+			{
+				Block b = {0, parentActive, 1};
+				if (depth < 64) stack[depth++] = b;
+			}
+			else if (depth > 0 && stack[depth-1].resolved)
+			{
+				Block* b = &stack[depth-1];
+				int outer = (depth > 1) ? stack[depth-2].active : 1;
+				
+				if (dirLen == 4 && !strncmp(s, "else", 4))
+				{
+					b->active = outer && !b->taken;
+					emit = 0;
+				}
+				else if (dirLen == 4 && !strncmp(s, "elif", 4))
+				{
+					fprintf(stderr, "'#elif' after a variant '#ifdef' is not supported\n");
+				}
+				else if (dirLen == 5 && !strncmp(s, "endif", 5))
+				{
+					depth--;
+					emit = 0;
+				}
+			}
+			else if (depth > 0 && dirLen == 5 && !strncmp(s, "endif", 5))
+			{
+				depth--;
+			}
+		}
+		
+		if (emit) textAppend(dst, line, lineLen);
+		line += lineLen;
+	}
+}
+
+// insert '#define' lines after '#version', which has to come first
+void defineAxes(Text* text, Axes* axes, uint mask)
+{
+	Text defines = {0, 0, 0};
+	for (uint i = 0; i < axes->count; i++)
+	{
+		if (!((mask >> i) & 1) || !referencesWord(text->data, axes->names[i])) continue;
+		
+		textAppend(&defines, "#define ", 8);
+		textAppend(&defines, axes->names[i], strlen(axes->names[i]));
+		textPutc(&defines, '\n');
+	}
+	if (!defines.len) return;
+	
+	uint at = 0;
+	char* version = strstr(text->data, "#version");
+	if (version)
+	{
+		char* end = strchr(version, '\n');
+		at = (end) ? (end - text->data + 1) : text->len;
+	}
+	
+	Text ret = {0, 0, 0};
+	textAppend(&ret, text->data, at);
+	textAppend(&ret, defines.data, defines.len);
+	textAppend(&ret, text->data + at, text->len - at);
+	
+	free(text->data);
+	free(defines.data);
+	*text = ret;
+}
+
+void writeEscaped(const char* text)
+{
+	for (; *text; text++)
+	{
+		if (*text == '\n') fputs("\\\n\\n\t", out);
+		else fputc(*text, out);
+	}
+}
+
+// 'declared' are the file's own axes, a subset of 'axes' when it's paired
+void writeVariants(char* name, const char* src, Axes* axes, Axes* declared)
+{
+	uint permutations = 1 << axes->count;
+	
+	Text* unique = (Text*) malloc(permutations * sizeof(Text));
+	uint numUnique = 0;
+	uint8* index = (uint8*) malloc(permutations);
+	
+	for (uint mask = 0; mask < permutations; mask++)
+	{
+		Text variant = {0, 0, 0};
+		resolveVariant(src, axes, mask, &variant);
+		if (!variant.data) textAppend(&variant, "", 0);
+		defineAxes(&variant, axes, mask);
+		
+		// features that don't change the code share a program
+		uint found = numUnique;
+		for (uint i = 0; i < numUnique; i++)
+		{
+			if (!strcmp(unique[i].data, variant.data))
+			{
+				found = i;
+				break;
+			}
+		}
+		
+		if (found == numUnique) unique[numUnique++] = variant;
+		else free(variant.data);
+		
+		index[mask] = found;
+	}
+	
+	for (uint i = 0; i < axes->count; i++)
+	{
+		if (findAxis(declared, axes->names[i], strlen(axes->names[i])) < 0) continue;
+		fprintf(out, "#define %sVariant_%s %u\n", name, axes->names[i], 1u << i);
+	}
+	fprintf(out, "#define %sShaderVariantCount %u\n", name, numUnique);
+	fprintf(out, "#define %sShaderVariantMasks %u\n", name, permutations);
+	
+	fprintf(out, "#ifndef HL_COMPILE_RES\nextern\n#endif\nchar* %sShaderVariants[%u]\n#ifdef HL_COMPILE_RES\n= {\n", name, numUnique);
+	for (uint i = 0; i < numUnique; i++)
+	{
+		fputs("\"\\\n", out);
+		writeEscaped(unique[i].data);
+		fputs("\\\n\",\n", out);
+		free(unique[i].data);
+	}
+	fputs("}\n#endif\n;\n", out);
+	
+	// feature bitmask -> variant
+	fprintf(out, "#ifndef HL_COMPILE_RES\nextern\n#endif\nunsigned char %sShaderVariantIndex[%u]\n#ifdef HL_COMPILE_RES\n= {", name, permutations);
+	for (uint mask = 0; mask < permutations; mask++)
+		fprintf(out, "%u,", index[mask]);
+	fputs("}\n#endif\n;\n", out);
+	
+	fprintf(stderr, "%s: %u variants (%u permutations)\n", name, numUnique, permutations);
+	
+	free(unique);
+	free(index);
+}
+
+//
+// Uniform blocks
+//
+// 'uniform' (std140) and 'buffer' (std430) block declarations
+// become C++ structs with explicit padding, so a whole block
+// can be uploaded straight from memory; offsets and size are
+// static_assert'ed so a layout mismatch fails to compile
+//
+
+struct GlslType
+{
+	const char* glsl;
+	const char* cpp;
+	uint size;
+	uint align;
+	uint columns; // matrices are arrays of column vectors
+	const char* column; // C++ type of one padded column
+};
+
+GlslType glslTypes[] =
+{
+	{"float", "float", 4, 4, 0, 0},
+	{"int", "int", 4, 4, 0, 0},
+	{"uint", "unsigned int", 4, 4, 0, 0},
+	{"bool", "unsigned int", 4, 4, 0, 0},
+	{"vec2", "vec2", 8, 8, 0, 0},
+	{"vec3", "vec3", 12, 16, 0, 0},
+	{"vec4", "vec4", 16, 16, 0, 0},
+	{"ivec2", "ivec2", 8, 8, 0, 0},
+	{"ivec3", "ivec3", 12, 16, 0, 0},
+	{"ivec4", "ivec4", 16, 16, 0, 0},
+	{"uvec2", "uvec2", 8, 8, 0, 0},
+	{"uvec3", "uvec3", 12, 16, 0, 0},
+	{"uvec4", "uvec4", 16, 16, 0, 0},
+	{"mat2", "vec2", 8, 8, 2, "vec2"},
+	{"mat3", "vec3", 12, 16, 3, "vec3"},
+	{"mat4", "mat4", 64, 16, 4, 0},
+};
+
+GlslType* findType(const char* name)
+{
+	for (uint i = 0; i < sizeof(glslTypes) / sizeof(glslTypes[0]); i++)
+		if (!strcmp(glslTypes[i].glsl, name)) return &glslTypes[i];
+	return 0;
+}
+
+// identifiers, numbers or single punctuation characters;
+// comments and preprocessor lines are skipped
+int nextToken(const char** p, char* tok)
+{
+	const char* s = *p;
+	
+	while (1)
+	{
+		while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r') s++;
+		
+		if (s[0] == '/' && s[1] == '/') { while (*s && *s != '\n') s++; }
+		else if (s[0] == '/' && s[1] == '*')
+		{
+			s += 2;
+			while (*s && !(s[0] == '*' && s[1] == '/')) s++;
+			if (*s) s += 2;
+		}
+		else if (*s == '#') { while (*s && *s != '\n') s++; }
+		else break;
+	}
+	
+	if (!*s) { *p = s; return 0; }
+	
+	uint n = wordLength(s);
+	if (n == 0) n = 1;
+	if (n > 63) n = 63;
+	
+	memcpy(tok, s, n);
+	tok[n] = 0;
+	*p = s + n;
+	return 1;
+}
+
+// bindings handed out to blocks without 'binding ='
+// 0 and 1 are taken by hl (HL_DRAW_BINDING, HL_MATERIAL_BINDING)
+int hl_nextBinding = 2;
+
+uint alignUp(uint x, uint a)
+{
+	return (x + a - 1) / a * a;
+}
+
+void writeMember(Text* body, Text* asserts, char* block, GlslType* type, char* name, uint count, int std430, uint* offset, uint* pad, uint* maxAlign)
+{
+	// matrices are laid out as arrays of columns
+	uint elemSize = type->size;
+	uint elemAlign = type->align;
+	uint columns = (type->columns && type->column) ? type->columns : 0;
+	
+	if (columns)
+	{
+		uint columnStride = (std430) ? alignUp(type->size, type->align) : 16;
+		elemSize = columnStride * columns;
+		elemAlign = (std430) ? type->align : 16;
+	}
+	
+	uint align = elemAlign;
+	uint stride = alignUp(elemSize, elemAlign);
+	if (count > 0 || columns)
+	{
+		// std140 rounds array and matrix strides up to a vec4
+		if (!std430) { align = alignUp(align, 16); stride = alignUp(stride, 16); }
+	}
+	
+	uint at = alignUp(*offset, align);
+	if (align > *maxAlign) *maxAlign = align;
+	char line[256];
+	
+	if (at > *offset)
+	{
+		snprintf(line, sizeof(line), "\tchar _pad%u[%u];\n", (*pad)++, at - *offset);
+		textAppend(body, line, strlen(line));
+	}
+	
+	if (columns)
+	{
+		uint columnStride = stride / columns;
+		uint columnPad = columnStride - type->size;
+		
+		if (columnPad) snprintf(line, sizeof(line), "\tstruct {%s value; char _pad[%u];} %s[%u]", type->column, columnPad, name, columns * ((count) ? count : 1));
+		else snprintf(line, sizeof(line), "\t%s %s[%u]", type->column, name, columns * ((count) ? count : 1));
+	}
+	else if (count > 0 && stride > elemSize)
+	{
+		snprintf(line, sizeof(line), "\tstruct {%s value; char _pad[%u];} %s[%u]", type->cpp, stride - elemSize, name, count);
+	}
+	else if (count > 0)
+	{
+		snprintf(line, sizeof(line), "\t%s %s[%u]", type->cpp, name, count);
+	}
+	else snprintf(line, sizeof(line), "\t%s %s", type->cpp, name);
+	
+	textAppend(body, line, strlen(line));
+	snprintf(line, sizeof(line), "; // offset %u\n", at);
+	textAppend(body, line, strlen(line));
+	
+	snprintf(line, sizeof(line), "static_assert(offsetof(%s, %s) == %u, \"%s.%s offset\");\n", block, name, at, block, name);
+	textAppend(asserts, line, strlen(line));
+	
+	*offset = at + ((count) ? stride * count : ((columns) ? stride : elemSize));
+}
+
+void writeBlocks(const char* src)
+{
+	const char* p = src;
+	char tok[64];
+	
+	int std430 = 0;
+	int binding = -1;
+	
+	while (nextToken(&p, tok))
+	{
+		// remember the layout qualifier of the next declaration
+		if (!strcmp(tok, "layout"))
+		{
+			std430 = 0;
+			binding = -1;
+			
+			int depth = 0;
+			while (nextToken(&p, tok))
+			{
+				if (!strcmp(tok, "(")) depth++;
+				else if (!strcmp(tok, ")")) { if (--depth == 0) break; }
+				else if (!strcmp(tok, "std430")) std430 = 1;
+				else if (!strcmp(tok, "binding"))
+				{
+					nextToken(&p, tok); // '='
+					nextToken(&p, tok);
+					binding = atoi(tok);
+				}
+			}
+			continue;
+		}
+		
+		int isBuffer = !strcmp(tok, "buffer");
+		if (strcmp(tok, "uniform") && !isBuffer)
+		{
+			if (!strcmp(tok, ";") || !strcmp(tok, "}")) { std430 = 0; binding = -1; }
+			continue;
+		}
+		
+		char block[64];
+		const char* save = p;
+		if (!nextToken(&p, block) || !wordLength(block)) continue;
+		if (!nextToken(&p, tok) || strcmp(tok, "{"))
+		{
+			// plain uniform, not a block
+			p = save;
+			continue;
+		}
+		
+		if (isBuffer) std430 = 1;
+		if (binding < 0) binding = hl_nextBinding++;
+		
+		Text body = {0, 0, 0};
+		Text asserts = {0, 0, 0};
+		uint offset = 0;
+		uint pad = 0;
+		uint maxAlign = 4;
+		int valid = 1;
+		
+		// members: 'type name[N], name;'
+		while (nextToken(&p, tok) && strcmp(tok, "}"))
+		{
+			// skip qualifiers
+			while (!findType(tok) && strcmp(tok, ";") && strcmp(tok, "}"))
+			{
+				if (wordLength(tok) && !strcmp(tok, "layout"))
+				{
+					while (nextToken(&p, tok) && strcmp(tok, ")"));
+				}
+				else if (!wordLength(tok) || !strcmp(tok, "highp") || !strcmp(tok, "mediump") || !strcmp(tok, "lowp"));
+				else
+				{
+					fprintf(stderr, "Block '%s': unsupported member type '%s'\n", block, tok);
+					valid = 0;
+					while (strcmp(tok, ";") && nextToken(&p, tok));
+					break;
+				}
+				if (!nextToken(&p, tok)) break;
+			}
+			if (!strcmp(tok, ";")) continue;
+			if (!strcmp(tok, "}")) break;
+			
+			GlslType* type = findType(tok);
+			
+			while (nextToken(&p, tok))
+			{
+				if (!strcmp(tok, ";")) break;
+				if (!strcmp(tok, ",")) continue;
+				
+				char name[64];
+				strcpy(name, tok);
+				uint count = 0;
+				
+				const char* peek = p;
+				if (nextToken(&peek, tok) && !strcmp(tok, "["))
+				{
+					nextToken(&peek, tok);
+					if (!strcmp(tok, "]"))
+					{
+						// runtime-sized trailing array, no fixed size to mirror
+						fprintf(stderr, "Block '%s': unsized array '%s' left out of the struct\n", block, name);
+						p = peek;
+						continue;
+					}
+					count = atoi(tok);
+					nextToken(&peek, tok); // ']'
+					p = peek;
+				}
+				
+				writeMember(&body, &asserts, block, type, name, count, std430, &offset, &pad, &maxAlign);
+			}
+		}
+		
+		// skip the instance name
+		while (nextToken(&p, tok) && strcmp(tok, ";"));
+		
+		if (valid && body.len)
+		{
+			// std140 rounds the block up to a vec4, std430 to its widest member
+			uint size = alignUp(offset, (std430) ? maxAlign : 16);
+			char line[256];
+			
+			fprintf(out, "#ifndef HL_BLOCK_%s\n#define HL_BLOCK_%s\n", block, block);
+			fprintf(out, "#define %sBinding %i\n", block, binding);
+			fprintf(out, "struct %s // %s\n{\n", block, (std430) ? "std430" : "std140");
+			fputs(body.data, out);
+			if (size > offset) fprintf(out, "\tchar _pad%u[%u];\n", pad, size - offset);
+			fputs("};\n", out);
+			fputs(asserts.data, out);
+			snprintf(line, sizeof(line), "static_assert(sizeof(%s) == %u, \"%s size\");\n", block, size, block);
+			fputs(line, out);
+			fputs("#endif\n", out);
+		}
+		
+		free(body.data);
+		free(asserts.data);
+		std430 = 0;
+		binding = -1;
+	}
+}
+
 int main(int argc, char** argv)
 {
 	char* headerFile;
@@ -143,15 +754,52 @@ int main(int argc, char** argv)
 	
 	for (int i = 2; i < argc; i++)
 	{
-		char* inPath = argv[i];
-		char* name = pathGetName(inPath, PATH_DELIM);
+		// 'VERT+FRAG' pairs stages whose axes share one numbering
+		char* paths[2] = {argv[i], 0};
+		char* plus = strchr(argv[i], '+');
+		if (plus)
+		{
+			*plus = 0;
+			paths[1] = plus + 1;
+		}
+		int numPaths = (plus) ? 2 : 1;
 		
-		fprintf(out, "#ifndef HL_COMPILE_RES\nextern\n#endif\nchar* %sShaderCode\n#ifdef HL_COMPILE_RES\n= \n\"\\\n", name);
-	
-		expandFile("", inPath);
+		Text srcs[2];
+		Axes fileAxes[2];
+		Axes axes;
+		axes.count = 0;
 		
-		fputs("\\\n\"\n#endif\n;\n", out);
-	}
+		for (int p = 0; p < numPaths; p++)
+		{
+			srcs[p] = {0, 0, 0};
+			fileAxes[p].count = 0;
+			
+			expandFile(&srcs[p], &fileAxes[p], "", paths[p]);
+			if (!srcs[p].data) textAppend(&srcs[p], "", 0);
+			
+			for (uint a = 0; a < fileAxes[p].count; a++) addAxis(&axes, fileAxes[p].names[a]);
+		}
 		
+		for (int p = 0; p < numPaths; p++)
+		{
+			char* name = pathGetName(paths[p], PATH_DELIM);
+			
+			writeBlocks(srcs[p].data);
+			
+			if (fileAxes[p].count > 0)
+			{
+				writeVariants(name, srcs[p].data, &axes, &fileAxes[p]);
+			}
+			else
+			{
+				fprintf(out, "#ifndef HL_COMPILE_RES\nextern\n#endif\nchar* %sShaderCode\n#ifdef HL_COMPILE_RES\n= \n\"\\\n", name);
+				writeEscaped(srcs[p].data);
+				fputs("\\\n\"\n#endif\n;\n", out);
+			}
+			
+			free(srcs[p].data);
+		}
+	}
+	
 	return 0;
 }
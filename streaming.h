@@ -0,0 +1,342 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//
+// Mip streaming
+//
+// streamed textures start out with only their coarse tail
+// (levels up to HL_STREAM_TAIL pixels) and the GL_TEXTURE_BASE_LEVEL
+// clamped to it; Model::draw estimates the finest level each
+// texture needs on screen, and a worker thread decodes and
+// downsamples finer levels which get uploaded between frames
+//
+
+#define HL_STREAM_TAIL 64 // largest dimension of the initial tail
+#define HL_STREAM_KEEP 120 // frames a finer level stays after it's no longer needed
+#define HL_STREAM_QUEUE 64 // decode jobs in flight
+
+struct StreamedTexture
+{
+	uint id;
+	char path[256];
+	int width, height, channels;
+	uint format;
+
+	int maxLevel; // the 1x1 level
+	int base; // finest level resident
+	int requested; // finest level asked for this frame
+	int inFlight; // level being decoded, -1 if none
+	uint lastFine; // last frame 'base' was actually needed
+	
+	int tailLoaded;
+	int residency;
+};
+
+// decoded levels from 'level' up to (not including) 'until'
+struct StreamResult
+{
+	int texture;
+	int level;
+	int until;
+	u8* data;
+};
+
+struct
+{
+	Array<StreamedTexture> textures;
+	uint frame;
+
+	// view used to estimate screen size
+	int active;
+	mat4 viewProj;
+	float projScale; // projection[1][1], without the camera's rotation
+	float screenHeight;
+
+	std::thread worker;
+	std::mutex lock; // guards the queues and appends to 'textures'
+	std::condition_variable wake;
+	StreamResult jobs[HL_STREAM_QUEUE];
+	int numJobs;
+	int numDecoding; // taken from 'jobs', not in 'done' yet
+	StreamResult done[HL_STREAM_QUEUE];
+	int numDone;
+	int running;
+}
+hl_streaming;
+
+u64 levelBytes(StreamedTexture* t, int level)
+{
+	return (u64)levelSize(t->width, level) * levelSize(t->height, level) * t->channels;
+}
+
+// decode the file and build levels [level, until) back to back
+u8* decodeLevels(StreamedTexture* t, int level, int until)
+{
+	return decodeChain(t->path, t->width, t->height, t->channels, level, until);
+}
+
+void streamingWorker()
+{
+	while (1)
+	{
+		StreamResult job;
+		StreamedTexture t;
+		{
+			std::unique_lock<std::mutex> guard(hl_streaming.lock);
+			hl_streaming.wake.wait(guard, []{ return hl_streaming.numJobs > 0 || !hl_streaming.running; });
+			if (!hl_streaming.running) return;
+
+			job = hl_streaming.jobs[--hl_streaming.numJobs];
+			t = hl_streaming.textures[job.texture];
+			hl_streaming.numDecoding++;
+		}
+
+		job.data = decodeLevels(&t, job.level, job.until);
+
+		// the done queue can't overflow: queueLevels counts
+		// jobs waiting, decoding and done against its size
+		std::lock_guard<std::mutex> guard(hl_streaming.lock);
+		hl_streaming.numDecoding--;
+		hl_streaming.done[hl_streaming.numDone++] = job;
+	}
+}
+
+void stopStreaming()
+{
+	if (!hl_streaming.running) return;
+
+	{
+		std::lock_guard<std::mutex> guard(hl_streaming.lock);
+		hl_streaming.running = 0;
+	}
+	hl_streaming.wake.notify_one();
+	hl_streaming.worker.join();
+}
+
+// returns 0 if the queue is full; the request is simply made again next frame
+int queueLevels(int index, int level, int until)
+{
+	if (!hl_streaming.running)
+	{
+		hl_streaming.running = 1;
+		hl_streaming.worker = std::thread(streamingWorker);
+	}
+
+	StreamResult job = {index, level, until, 0};
+	{
+		std::lock_guard<std::mutex> guard(hl_streaming.lock);
+		if (hl_streaming.numJobs + hl_streaming.numDecoding + hl_streaming.numDone >= HL_STREAM_QUEUE) return 0;
+		hl_streaming.jobs[hl_streaming.numJobs++] = job;
+	}
+	hl_streaming.wake.notify_one();
+
+	hl_streaming.textures[index].inFlight = level;
+	return 1;
+}
+
+// keep residency accounting in step with the levels resident
+void accountStreamed(StreamedTexture* t)
+{
+	if (t->residency < 0) return;
+	ResidentResource* r = &hl_residency.resources[t->residency];
+
+	u64 bytes = 0;
+	for (int l = t->base; l <= t->maxLevel; l++) bytes += levelBytes(t, l);
+
+	hl_residency.bytes[HL_RES_TEXTURE] += bytes - r->bytes;
+	r->bytes = bytes;
+}
+
+// finest level of the coarse tail, which includes the 1x1 level
+int tailLevel(StreamedTexture* t)
+{
+	int ret = 0;
+	while (ret < t->maxLevel && (levelSize(t->width, ret) > HL_STREAM_TAIL || levelSize(t->height, ret) > HL_STREAM_TAIL)) ret++;
+	return ret;
+}
+
+// returns immediately; the texture samples as a 1x1 placeholder
+// until its tail has been decoded
+Texture createStreamedTexture(const char* path)
+{
+	Texture ret;
+	ret.type = GL_TEXTURE_2D;
+	ret.residency = -1;
+	ret.stream = -1;
+	ret.id = 0;
+
+	StreamedTexture t;
+	memset(&t, 0, sizeof(t));
+	snprintf(t.path, sizeof(t.path), "%s", path);
+
+	if (!stbi_info(path, &t.width, &t.height, &t.channels))
+	{
+		fprintf(stderr, "[Texture] Failed to load from file '%s'!\n", path);
+		return ret;
+	}
+
+	if (t.channels == 1) t.format = GL_RED;
+	else if (t.channels == 2) t.format = GL_RG;
+	else if (t.channels == 3) t.format = GL_RGB;
+	else t.format = GL_RGBA;
+	ret.format = t.format;
+
+	t.maxLevel = textureMaxLevel(t.width, t.height);
+
+	// placeholder until the tail arrives
+	u8 white[4] = {255, 255, 255, 255};
+	glGenTextures(1, &ret.id);
+	glBindTexture(GL_TEXTURE_2D, ret.id);
+	glTexImage2D(GL_TEXTURE_2D, t.maxLevel, t.format, 1, 1, 0, t.format, GL_UNSIGNED_BYTE, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.maxLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.maxLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	t.id = ret.id;
+	t.base = t.maxLevel;
+	t.requested = t.maxLevel;
+	t.inFlight = -1;
+
+	// streamed textures are never evicted by residency (no source path there),
+	// they shed levels on their own
+	ret.residency = trackResource(HL_RES_TEXTURE, ret.id, levelBytes(&t, t.maxLevel));
+	t.residency = ret.residency;
+
+	{
+		std::lock_guard<std::mutex> guard(hl_streaming.lock);
+		hl_streaming.textures.append(t);
+		ret.stream = hl_streaming.textures.size - 1;
+	}
+
+	// the tail replaces the placeholder; if the queue is full
+	// updateStreaming asks again
+	queueLevels(ret.stream, tailLevel(&t), t.maxLevel + 1);
+
+	return ret;
+}
+
+inline
+StreamedTexture* streamedTexture(Texture& tex)
+{
+	if (tex.stream < 0 || tex.stream >= hl_streaming.textures.size) return 0;
+
+	StreamedTexture* t = &hl_streaming.textures[tex.stream];
+	return (t->id == tex.id) ? t : 0;
+}
+
+// set the camera used to estimate screen coverage in Model::draw;
+// projection and view come separately so the projection's scale
+// isn't mixed up with where the camera is looking
+void setStreamingView(mat4 projection, mat4 view, float screenHeight)
+{
+	hl_streaming.viewProj = projection * view;
+	hl_streaming.projScale = projection[1][1];
+	hl_streaming.screenHeight = screenHeight;
+	hl_streaming.active = 1;
+}
+
+// finest mip needed for something 'texelsPerUnit' texels per world unit at level 0
+// drawn around 'center' in world space
+int requiredLevel(vec3 center, float texelsPerUnit)
+{
+	vec4 clip = hl_streaming.viewProj * vec4(center, 1.0);
+	float w = (clip.w > 0.01) ? clip.w : 0.01;
+
+	// screen pixels covered by one world unit at that depth
+	float pixelsPerUnit = hl_streaming.projScale * hl_streaming.screenHeight * 0.5 / w;
+	if (pixelsPerUnit <= 0) return 1000;
+
+	float ratio = texelsPerUnit / pixelsPerUnit;
+	return (ratio <= 1.0) ? 0 : (int)log2(ratio);
+}
+
+void requestTextureLevel(Texture& tex, vec3 center, float uvDensity)
+{
+	StreamedTexture* t = streamedTexture(tex);
+	if (!t) return;
+
+	float texelsPerUnit = uvDensity * ((t->width > t->height) ? t->width : t->height);
+	int level = requiredLevel(center, texelsPerUnit);
+	if (level > t->maxLevel) level = t->maxLevel;
+
+	if (level < t->requested) t->requested = level;
+}
+
+// upload finished levels, queue finer ones and drop unneeded ones
+// called once per frame from presentFrame
+void updateStreaming()
+{
+	hl_streaming.frame++;
+
+	{
+		std::lock_guard<std::mutex> guard(hl_streaming.lock);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i = 0; i < hl_streaming.numDone; i++)
+		{
+			StreamResult* job = &hl_streaming.done[i];
+			StreamedTexture* t = &hl_streaming.textures[job->texture];
+
+			// inFlight stays set, so a file that won't decode isn't tried every frame
+			if (!job->data)
+			{
+				fprintf(stderr, "[Texture] Failed to stream '%s'\n", t->path);
+				continue;
+			}
+			t->inFlight = -1;
+
+			glBindTexture(GL_TEXTURE_2D, t->id);
+			u8* at = job->data;
+			for (int l = job->level; l < job->until; l++)
+			{
+				glTexImage2D(GL_TEXTURE_2D, l, t->format, levelSize(t->width, l), levelSize(t->height, l),
+					0, t->format, GL_UNSIGNED_BYTE, at);
+				at += levelBytes(t, l);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job->level);
+			free(job->data);
+
+			t->base = job->level;
+			t->lastFine = hl_streaming.frame;
+			t->tailLoaded = 1;
+			accountStreamed(t);
+		}
+		hl_streaming.numDone = 0;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	for (int i = 0; i < hl_streaming.textures.size; i++)
+	{
+		StreamedTexture* t = &hl_streaming.textures[i];
+
+		if (t->requested <= t->base) t->lastFine = hl_streaming.frame;
+
+		if (t->requested < t->base && t->inFlight < 0)
+		{
+			// finer levels needed (and the 1x1 level, if the tail never made it in)
+			queueLevels(i, t->requested, (t->tailLoaded) ? t->base : t->maxLevel + 1);
+		}
+		else if (!t->tailLoaded && t->inFlight < 0)
+		{
+			// the tail didn't fit in the queue when the texture was created
+			queueLevels(i, tailLevel(t), t->maxLevel + 1);
+		}
+		else if (t->inFlight < 0 && t->base < t->requested && t->base < t->maxLevel
+			&& hl_streaming.frame - t->lastFine > HL_STREAM_KEEP)
+		{
+			// finest level hasn't been needed in a while, let it go
+			glBindTexture(GL_TEXTURE_2D, t->id);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t->base + 1);
+			glTexImage2D(GL_TEXTURE_2D, t->base, t->format, 0, 0, 0, t->format, GL_UNSIGNED_BYTE, 0);
+			t->base++;
+			t->lastFine = hl_streaming.frame;
+			accountStreamed(t);
+		}
+
+		// start over for the next frame's requests
+		t->requested = t->maxLevel;
+	}
+}
\ No newline at end of file
@@ -8,6 +8,7 @@ struct Image
 	int width, height, depth;
 	int channels; // number of fields per pixel
 	uint type;
+	uint format; // sized float format of the data (see hdr.h), 0 for 8 bits per channel
 };
 
 // load 2D image from a file
@@ -17,6 +18,7 @@ Image createImage(const char* filename)
 	
 	ret.type = GL_TEXTURE_2D;
 	ret.depth = 0;
+	ret.format = 0;
 	ret.data = stbi_load(filename, &ret.width, &ret.height, &ret.channels, 0);
 	
 	if (!ret.data)
@@ -27,6 +29,47 @@ Image createImage(const char* filename)
 	return ret;
 }
 
+// load a 2D image as floats and pack it as 'hdrFormat':
+// GL_RGB9_E5 or GL_R11F_G11F_B10F (RGB only, 4 bytes per pixel),
+// GL_HALF_FLOAT or GL_FLOAT (16F or 32F with the file's channels)
+// 8 bit files load too, as values from 0 to 1
+Image createImage(const char* filename, uint hdrFormat)
+{
+	Image ret;
+	
+	ret.type = GL_TEXTURE_2D;
+	ret.depth = 0;
+	ret.data = 0;
+	
+	int want = (hdrFormat == GL_RGB9_E5 || hdrFormat == GL_R11F_G11F_B10F) ? 3 : 0;
+	float* pixels = stbi_loadf(filename, &ret.width, &ret.height, &ret.channels, want);
+	if (!pixels)
+	{
+		fprintf(stderr, "[Texture] Failed to load from file '%s'!\n", filename);
+		return ret;
+	}
+	if (want) ret.channels = want;
+	
+	ret.format = hdrInternalFormat(hdrFormat, ret.channels);
+	if (!ret.format)
+	{
+		fprintf(stderr, "[Texture] Unsupported HDR format (0x%x) for '%s'\n", hdrFormat, filename);
+		stbi_image_free(pixels);
+		return ret;
+	}
+	
+	if (hdrFormat == GL_FLOAT)
+	{
+		ret.data = (u8*)pixels;
+		return ret;
+	}
+	
+	ret.data = (u8*) packHdr(pixels, ret.width * ret.height, ret.channels, ret.format);
+	stbi_image_free(pixels);
+	
+	return ret;
+}
+
 // create an empty 2D or 3D image
 // optionally zeroes out buffer
 Image createImage(int width, int height, int depth, int channels, int zeroData = false)
@@ -37,6 +80,7 @@ Image createImage(int width, int height, int depth, int channels, int zeroData =
 	ret.height = height;
 	ret.depth = depth;
 	ret.channels = channels;
+	ret.format = 0;
 	
 	if (depth < 1) ret.type = GL_TEXTURE_2D;
 	else ret.type = GL_TEXTURE_3D;
@@ -64,7 +108,11 @@ void unloadImage(Image img)
 \n	\
 \n out vec2 fragCoord;\
 \n \
-\n uniform mat4 transform;\
+\n layout (std140) uniform hlDraw\
+\n {\
+\n 	mat4 transform;\
+\n 	vec4 diffuse;\
+\n };\
 \n	\
 \n	void main()\
 \n	{\
@@ -83,7 +131,11 @@ void unloadImage(Image img)
 \n layout (location = 0) out vec4 finalColor;\
 \n	\
 \n	uniform sampler2D texture;\
-\n uniform vec4 diffuse;\
+\n layout (std140) uniform hlDraw\
+\n {\
+\n 	mat4 transform;\
+\n 	vec4 diffuse;\
+\n };\
 \n	\
 \n	void main()\
 \n	{\
@@ -97,18 +149,39 @@ struct Texture
 	uint format;
 	uint type;
 	int slot; // which texture slot currently bound to
+	int residency; // residency tracking slot, -1 if untracked
+	int stream; // streaming slot, -1 if fully loaded
 };
 
+int trackTexture(Texture* tex, int width, int height, int depth, int channels, int mipmapped);
+void touchTexture(Texture& tex);
+
 int textureSlot = 0;
 
 uint hl_textureQuad;
 Texture hl_blankTexture;
 
-Texture createTexture(void* _image)
+// pixel type to upload an HDR image's data with
+uint hdrUploadType(Image& image)
+{
+	if (image.format == GL_RGB9_E5) return GL_UNSIGNED_INT_5_9_9_9_REV;
+	if (image.format == GL_R11F_G11F_B10F) return GL_UNSIGNED_INT_10F_11F_11F_REV;
+	if (hdrPixelBytes(image.format, image.channels) == 2 * image.channels) return GL_HALF_FLOAT;
+	return GL_FLOAT;
+}
+
+// 'track' = false leaves residency tracking to the caller
+// (the upload thread can't touch it)
+// HDR images (image.format set) upload with their sized format;
+// they have no source to reload, so residency never evicts them
+Texture createTexture(void* _image, int track = true)
 {
 	Image image = *(Image*)_image;
 	Texture tex;
 	
+	uint internal, type;
+	int pixelBytes;
+	
 	if (image.channels == 1) tex.format = GL_RED;
 	else if (image.channels == 2) tex.format = GL_RG;
 	else if (image.channels == 3) tex.format = GL_RGB;
@@ -119,24 +192,46 @@ Texture createTexture(void* _image)
 		return;
 	}
 	
+	if (image.format)
+	{
+		internal = image.format;
+		type = hdrUploadType(image);
+		pixelBytes = hdrPixelBytes(image.format, image.channels);
+		
+		// rows of 2 and 6 byte pixels aren't always 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	}
+	else
+	{
+		internal = tex.format;
+		type = GL_UNSIGNED_BYTE;
+		pixelBytes = image.channels;
+	}
+	
+	tex.residency = -1;
+	tex.stream = -1;
 	glGenTextures(1, &tex.id);
 	glBindTexture(image.type, tex.id);
 	if (image.type == GL_TEXTURE_2D)
 	{
 		tex.type = GL_TEXTURE_2D;
-		glTexImage2D(image.type, 0, tex.format, image.width, image.height, 0, tex.format, GL_UNSIGNED_BYTE, image.data);
+		glTexImage2D(image.type, 0, internal, image.width, image.height, 0, tex.format, type, image.data);
 		glGenerateMipmap(image.type);
+		if (track) tex.residency = trackTexture(&tex, image.width, image.height, 1, pixelBytes, true);
 	}
 	else if (image.type == GL_TEXTURE_3D)
 	{
 		tex.type = GL_TEXTURE_3D;
-		glTexImage3D(image.type, 0, tex.format, image.width, image.height, image.depth, 0, tex.format, GL_UNSIGNED_BYTE, image.data);
+		glTexImage3D(image.type, 0, internal, image.width, image.height, image.depth, 0, tex.format, type, image.data);
+		if (track) tex.residency = trackTexture(&tex, image.width, image.height, image.depth, pixelBytes, false);
 	}
 	else
 	{
 		fprintf(stderr, "[Texture] Image tex.format unsupported for texture load (neither 2D nor 3D)\n");
 	}
 	
+	if (image.format) glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	
 	return tex;
 }
 
@@ -146,6 +241,8 @@ void activateTexture(Texture& tex)
 	glActiveTexture(GL_TEXTURE0 + tex.slot);
 	textureSlot++;
 	
+	touchTexture(tex);
+	
 	glBindTexture(tex.type, tex.id);
 }
 
@@ -6,6 +6,8 @@
 
 #include <ext.h>
 
+#include "../hdr.h"
+
 #define PATH_DELIM '/'
 #ifdef _WIN32
 	#define PATH_DELIM '\'
@@ -13,9 +15,11 @@
 
 #define USAGE "\n\
 Usage:\n\
-tcomp [HEADER_PATH] [IN_FILE1] [IN_FILE2] ...\n\
+tcomp [--hdr=FORMAT] [HEADER_PATH] [IN_FILE1] [IN_FILE2] ...\n\
 HEADER_PATH is a path to the header file to send output.\n\
-This will overwrite any existing file at the path.\n"
+This will overwrite any existing file at the path.\n\
+HDR files (.hdr) are packed as FORMAT: 9e5 (GL_RGB9_E5, default),\n\
+11f (GL_R11F_G11F_B10F), 16f (half float) or 32f.\n"
 
 #define HELP_MESSAGE "\
 tcomp - texture precompilation utility\n\
@@ -40,12 +44,33 @@ extern\n\
 #endif\n\
 HL_RES_IMAGE %sImg\n\
 #ifdef HL_COMPILE_RES\n\
-= {%sImg_BYTES,%i,%i,0,%i,GL_TEXTURE_2D}\n\
+= {%sImg_BYTES,%i,%i,0,%i,GL_TEXTURE_2D,%s}\n\
 #endif\n\
 ;\n"
 
 FILE* out;
 
+// what HDR files are packed as; see hdrInternalFormat
+unsigned int hdrFormat = GL_RGB9_E5;
+
+const char* formatName(unsigned int internal)
+{
+	switch (internal)
+	{
+		case GL_RGB9_E5: return "GL_RGB9_E5";
+		case GL_R11F_G11F_B10F: return "GL_R11F_G11F_B10F";
+		case GL_R16F: return "GL_R16F";
+		case GL_RG16F: return "GL_RG16F";
+		case GL_RGB16F: return "GL_RGB16F";
+		case GL_RGBA16F: return "GL_RGBA16F";
+		case GL_R32F: return "GL_R32F";
+		case GL_RG32F: return "GL_RG32F";
+		case GL_RGB32F: return "GL_RGB32F";
+		case GL_RGBA32F: return "GL_RGBA32F";
+	}
+	return "0";
+}
+
 char* pathGetName(char* path, char delimeter)
 {
 	uint i = 0;
@@ -114,8 +139,32 @@ void expandFile(char* path)
 	
 	uint8* data;
 	int width, height, channels;
+	unsigned int format = 0;
+	uint64 len;
+	
+	if (stbi_is_hdr_from_file(file))
+	{
+		int want = (hdrFormat == GL_RGB9_E5 || hdrFormat == GL_R11F_G11F_B10F) ? 3 : 0;
+		float* pixels = stbi_loadf_from_file(file, &width, &height, &channels, want);
+		if (!pixels)
+		{
+			fprintf(stderr, "Failed to load image '%s'\n", path);
+			return;
+		}
+		if (want) channels = want;
+		
+		format = hdrInternalFormat(hdrFormat, channels);
+		data = (uint8*) packHdr(pixels, width * height, channels, format);
+		stbi_image_free(pixels);
+		
+		len = (uint64)width * height * hdrPixelBytes(format, channels);
+	}
+	else
+	{
+		data = stbi_load_from_file(file, &width, &height, &channels, 0);
+		len = (uint64)width * height * channels;
+	}
 	
-	data = stbi_load_from_file(file, &width, &height, &channels, 0);
 	if (!data)
 	{
 		fprintf(stderr, "Failed to load image '%s'\n", path);
@@ -123,23 +172,19 @@ void expandFile(char* path)
 	}
 	
 	char* name = pathGetName(path, PATH_DELIM);
-	uint64 len = width * height * channels;
 	
 	//fprintf(out, "#ifndef HL_COMPILE_RES\nextern\n#endif\nstruct{unsigned char d[%lu];int w,h,b,c;unsigned int t;} %sImg\n#ifdef HL_COMPILE_RES\n= {\n{\n", len, name);
 	
 	fprintf(out, BYTE_DATA_START, name, len);
 
-	for (int y = 0; y < height; y++)
+	for (uint64 i = 0; i < len; i++)
 	{
-		for (int x = 0; x < width; x++)
-		{
-			char hex[5];
-			sprintf(hex, "%u", data[y * width + x]);
-			fprintf(out, "%s,", hex);
-		}
+		char hex[5];
+		sprintf(hex, "%u", data[i]);
+		fprintf(out, "%s,", hex);
 	}
 	
-	fprintf(out, BYTE_DATA_END STRUCT, name, name, width, height, channels);
+	fprintf(out, BYTE_DATA_END STRUCT, name, name, width, height, channels, formatName(format));
 	
 	//fprintf(out, "\n};\n#ifndef HL_COMPILE_RES\nextern\n#endif\nstruct{unsigned char d[%lu];int w,h,b,c;unsigned int t;} %sImg\n#ifdef HL_COMPILE_RES\n= {\n{\n"
 	
@@ -152,6 +197,23 @@ int main(int argc, char** argv)
 {
 	char* headerFile;
 	
+	if (argc > 1 && !strncmp(argv[1], "--hdr=", 6))
+	{
+		char* f = argv[1] + 6;
+		if (!strcmp(f, "9e5")) hdrFormat = GL_RGB9_E5;
+		else if (!strcmp(f, "11f")) hdrFormat = GL_R11F_G11F_B10F;
+		else if (!strcmp(f, "16f")) hdrFormat = GL_HALF_FLOAT;
+		else if (!strcmp(f, "32f")) hdrFormat = GL_FLOAT;
+		else
+		{
+			fprintf(stderr, "Unknown HDR format '%s'\n" USAGE, f);
+			return 1;
+		}
+		
+		argc--;
+		argv++;
+	}
+	
 	if (argc < 3)
 	{
 		fprintf(stderr, HELP_MESSAGE USAGE);
@@ -172,7 +234,7 @@ int main(int argc, char** argv)
 	#include <glad/glad.h>\n\
 	#include <GLFW/glfw3.h>\n\
 	//#ifdef HL_COMPILE_RES\n\
-	struct HL_RES_IMAGE {unsigned char* data; int width, height, depth; int channels; unsigned int type;};\n\
+	struct HL_RES_IMAGE {unsigned char* data; int width, height, depth; int channels; unsigned int type; unsigned int format;};\n\
 	//#endif\n");
 	
 	for (int i = 2; i < argc; i++)
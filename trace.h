@@ -0,0 +1,1170 @@
+#pragma once
+
+#include <mutex>
+
+//
+// GL capture
+//
+// startTrace swaps glad's function pointers for wrappers that call
+// the driver and then append the call, its arguments and payloads
+// to a binary trace; tracereplay plays a trace back headless and
+// times every frame, so driver and library changes can be compared
+// on a real workload
+//
+// every GL call goes through glad, so this sees all of hl's calls
+// from every thread; each record is tagged with the context it was
+// made on (the upload thread has its own), and object names, uniform
+// locations and syncs are stored as the app saw them and remapped
+// on replay
+//
+// payloads are copied as passed: buffer and texture data, shader
+// sources, uniform values; bytes written through a mapped buffer are
+// stored when that range is bound (the persistent uniform ring) or
+// when it's unmapped
+//
+// the trace has to start before the objects it draws are created:
+// call startTrace between openWindow and setup, or set HL_TRACE
+// (see setup); program binaries don't carry over to other drivers,
+// so the shader cache is skipped while tracing
+//
+// layout: TraceHeader, then records of u8 call, u8 context, u16 unused,
+// u32 bytes and the arguments; names and enums are u32, offsets, sizes
+// and syncs u64, payloads a u32 length and the data padded to 4 bytes,
+// so arrays in them stay aligned when the trace is read in one piece
+//
+
+#define HL_TRACE_VERSION 2
+#define HL_TRACE_CONTEXTS 4
+#define HL_TRACE_MAPPINGS 16
+#define HL_TRACE_FLUSH (4 << 20) // bytes buffered before writing out
+
+// what gets hooked; only GL that hl calls
+#define HL_TRACE_CALLS(X) \
+	X(ActiveTexture) \
+	X(AttachShader) \
+	X(BeginQuery) \
+	X(BindBuffer) \
+	X(BindBufferBase) \
+	X(BindBufferRange) \
+	X(BindFramebuffer) \
+	X(BindTexture) \
+	X(BindVertexArray) \
+	X(BlitFramebuffer) \
+	X(BufferData) \
+	X(BufferStorage) \
+	X(BufferSubData) \
+	X(CheckFramebufferStatus) \
+	X(Clear) \
+	X(ClearColor) \
+	X(ClientWaitSync) \
+	X(ColorMask) \
+	X(CompileShader) \
+	X(CreateProgram) \
+	X(CreateShader) \
+	X(DeleteBuffers) \
+	X(DeleteFramebuffers) \
+	X(DeleteProgram) \
+	X(DeleteShader) \
+	X(DeleteSync) \
+	X(DeleteTextures) \
+	X(DepthFunc) \
+	X(DepthMask) \
+	X(DetachShader) \
+	X(Disable) \
+	X(DrawArrays) \
+	X(DrawBuffer) \
+	X(DrawBuffers) \
+	X(DrawElements) \
+	X(Enable) \
+	X(EnableVertexAttribArray) \
+	X(EndQuery) \
+	X(FenceSync) \
+	X(Finish) \
+	X(Flush) \
+	X(FramebufferTexture2D) \
+	X(GenBuffers) \
+	X(GenFramebuffers) \
+	X(GenQueries) \
+	X(GenTextures) \
+	X(GenVertexArrays) \
+	X(GenerateMipmap) \
+	X(GetIntegerv) \
+	X(GetProgramBinary) \
+	X(GetProgramInfoLog) \
+	X(GetProgramiv) \
+	X(GetQueryObjectiv) \
+	X(GetQueryObjectui64v) \
+	X(GetShaderInfoLog) \
+	X(GetShaderiv) \
+	X(GetString) \
+	X(GetTexImage) \
+	X(GetUniformBlockIndex) \
+	X(GetUniformLocation) \
+	X(InvalidateFramebuffer) \
+	X(LinkProgram) \
+	X(MapBufferRange) \
+	X(MaxShaderCompilerThreadsKHR) \
+	X(MultiDrawElements) \
+	X(PixelStorei) \
+	X(ProgramBinary) \
+	X(ProgramParameteri) \
+	X(ReadBuffer) \
+	X(ReadPixels) \
+	X(ShaderSource) \
+	X(TexBuffer) \
+	X(TexImage2D) \
+	X(TexImage3D) \
+	X(TexParameteri) \
+	X(TexSubImage2D) \
+	X(TexSubImage3D) \
+	X(Uniform1f) \
+	X(Uniform1i) \
+	X(Uniform2f) \
+	X(Uniform3f) \
+	X(Uniform4f) \
+	X(UniformBlockBinding) \
+	X(UniformMatrix4fv) \
+	X(UnmapBuffer) \
+	X(UseProgram) \
+	X(VertexAttribIPointer) \
+	X(VertexAttribPointer) \
+	X(Viewport)
+
+enum
+{
+	HL_TRACE_FRAME, // end of a frame: u64 ns it took when captured
+	HL_TRACE_WRITE, // bytes written through a mapping: buffer, u64 offset, payload
+	#define X(name) HL_TRACE_##name,
+	HL_TRACE_CALLS(X)
+	#undef X
+	HL_TRACE_NUM_CALLS
+};
+
+struct TraceHeader
+{
+	char magic[8]; // "HLTRACE"
+	u32 version;
+	u32 width, height; // default framebuffer
+	u32 major, minor; // GL version glad loaded
+	u32 frames; // filled in by stopTrace
+};
+
+struct TraceMapping
+{
+	uint buffer; // 0 = free
+	u64 offset, length;
+	u8* pointer;
+};
+
+// buffer bindings this needs to know about, per context
+#define HL_TRACE_TARGETS 4
+inline
+int traceTargetSlot(GLenum target)
+{
+	if (target == GL_PIXEL_PACK_BUFFER) return 0;
+	if (target == GL_PIXEL_UNPACK_BUFFER) return 1;
+	if (target == GL_UNIFORM_BUFFER) return 2;
+	if (target == GL_ARRAY_BUFFER) return 3;
+	return -1;
+}
+
+struct
+{
+	FILE* file;
+	int running;
+	int frames; // stop after this many, 0 = at stopTrace
+	u32 numFrames;
+	double frameStart;
+
+	std::recursive_mutex lock; // wrappers that emit two records hold it across both
+	u8* data; // records not written out yet
+	u64 size;
+	u64 capacity;
+	u64 record; // where the open record starts
+
+	GLFWwindow* contexts[HL_TRACE_CONTEXTS];
+	int numContexts;
+	int context; // of the open record
+
+	uint bound[HL_TRACE_CONTEXTS][HL_TRACE_TARGETS];
+	int packAlignment[HL_TRACE_CONTEXTS];
+	int unpackAlignment[HL_TRACE_CONTEXTS];
+	TraceMapping mappings[HL_TRACE_MAPPINGS];
+
+	struct
+	{
+		#define X(name) decltype(glad_gl##name) name;
+		HL_TRACE_CALLS(X)
+		#undef X
+	}
+	real; // the driver's entry points while hooked
+}
+hl_trace;
+
+//
+// Records
+//
+
+void writeTraceData()
+{
+	if (hl_trace.file && hl_trace.size) fwrite(hl_trace.data, 1, hl_trace.size, hl_trace.file);
+	hl_trace.size = 0;
+}
+
+void traceBytes(const void* data, u64 size)
+{
+	if (hl_trace.size + size > hl_trace.capacity)
+	{
+		u64 capacity = (hl_trace.capacity) ? hl_trace.capacity : HL_TRACE_FLUSH;
+		while (capacity < hl_trace.size + size) capacity *= 2;
+
+		u8* grown = (u8*) realloc(hl_trace.data, capacity);
+		if (!grown)
+		{
+			fprintf(stderr, "[Trace] Out of memory\n");
+			return;
+		}
+		hl_trace.data = grown;
+		hl_trace.capacity = capacity;
+	}
+
+	if (size) memcpy(hl_trace.data + hl_trace.size, data, size);
+	hl_trace.size += size;
+}
+
+inline void traceU32(u32 value) { traceBytes(&value, 4); }
+inline void traceU64(u64 value) { traceBytes(&value, 8); }
+inline void traceF32(float value) { traceBytes(&value, 4); }
+
+inline
+void traceBlob(const void* data, u64 size)
+{
+	u32 zero = 0;
+	traceU32((data) ? size : 0);
+	if (!data) return;
+
+	traceBytes(data, size);
+	traceBytes(&zero, -size & 3);
+}
+
+// index of the calling thread's context; a new one gets the next free index
+int traceContext()
+{
+	GLFWwindow* current = glfwGetCurrentContext();
+	for (int i = 0; i < hl_trace.numContexts; i++)
+		if (hl_trace.contexts[i] == current) return i;
+
+	if (hl_trace.numContexts == HL_TRACE_CONTEXTS)
+	{
+		fprintf(stderr, "[Trace] Too many contexts, recording as the last one\n");
+		return HL_TRACE_CONTEXTS - 1;
+	}
+
+	int ret = hl_trace.numContexts++;
+	hl_trace.contexts[ret] = current;
+	hl_trace.packAlignment[ret] = 4;
+	hl_trace.unpackAlignment[ret] = 4;
+	memset(hl_trace.bound[ret], 0, sizeof(hl_trace.bound[ret]));
+	return ret;
+}
+
+// locks until traceEnd
+void traceBegin(u32 call)
+{
+	hl_trace.lock.lock();
+	hl_trace.context = traceContext();
+	hl_trace.record = hl_trace.size;
+
+	u8 head[8] = {(u8)call, (u8)hl_trace.context};
+	traceBytes(head, sizeof(head));
+}
+
+void traceEnd()
+{
+	u32 bytes = hl_trace.size - hl_trace.record - 8;
+	memcpy(hl_trace.data + hl_trace.record + 4, &bytes, 4);
+
+	if (hl_trace.size >= HL_TRACE_FLUSH) writeTraceData();
+	hl_trace.lock.unlock();
+}
+
+inline
+uint traceBound(GLenum target)
+{
+	int slot = traceTargetSlot(target);
+	return (slot < 0) ? 0 : hl_trace.bound[hl_trace.context][slot];
+}
+
+// bytes a pixel transfer touches, going by the pack/unpack alignment
+u64 tracePixelBytes(int width, int height, int depth, GLenum format, GLenum type, int alignment)
+{
+	if (width <= 0 || height <= 0 || depth <= 0) return 0;
+
+	int components = 4;
+	if (format == GL_RED || format == GL_DEPTH_COMPONENT || format == GL_STENCIL_INDEX) components = 1;
+	else if (format == GL_RG) components = 2;
+	else if (format == GL_RGB || format == GL_BGR) components = 3;
+
+	int size = 1;
+	if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT) size = 2;
+	else if (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT) size = 4;
+
+	u64 pixel = components * size;
+
+	// packed types hold a whole pixel in one value
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV || type == GL_UNSIGNED_INT_10F_11F_11F_REV
+		|| type == GL_UNSIGNED_INT_24_8 || type == GL_UNSIGNED_INT_2_10_10_10_REV
+		|| type == GL_UNSIGNED_INT_8_8_8_8 || type == GL_UNSIGNED_INT_8_8_8_8_REV) pixel = 4;
+	if (type == GL_FLOAT_32_UNSIGNED_INT_24_8_REV) pixel = 8;
+
+	u64 row = (pixel * width + alignment - 1) / alignment * alignment;
+	return row * ((u64)height * depth - 1) + pixel * width;
+}
+
+// pixels going to GL: an offset into the bound unpack buffer, or the data
+void traceUnpack(const void* pixels, u64 bytes)
+{
+	int buffer = traceBound(GL_PIXEL_UNPACK_BUFFER) != 0;
+	traceU32(buffer);
+	if (buffer) traceU64((u64)pixels);
+	else traceBlob(pixels, bytes);
+}
+
+// pixels coming back: an offset into the bound pack buffer,
+// or how much client memory the replay needs to have ready
+void tracePack(const void* pixels, u64 bytes)
+{
+	int buffer = traceBound(GL_PIXEL_PACK_BUFFER) != 0;
+	traceU32(buffer);
+	traceU64((buffer) ? (u64)pixels : bytes);
+}
+
+TraceMapping* traceMapping(uint buffer)
+{
+	for (int i = 0; i < HL_TRACE_MAPPINGS; i++)
+		if (buffer && hl_trace.mappings[i].buffer == buffer) return &hl_trace.mappings[i];
+	return 0;
+}
+
+// store what the app wrote into [offset, offset + size) of a mapped buffer
+void traceMappedWrite(uint buffer, u64 offset, u64 size)
+{
+	TraceMapping* m = traceMapping(buffer);
+	if (!m) return;
+
+	u64 end = offset + size;
+	if (offset < m->offset) offset = m->offset;
+	if (end > m->offset + m->length) end = m->offset + m->length;
+	if (end <= offset) return;
+
+	traceBegin(HL_TRACE_WRITE);
+	traceU32(buffer);
+	traceU64(offset);
+	traceBlob(m->pointer + (offset - m->offset), end - offset);
+	traceEnd();
+}
+
+//
+// Wrappers
+//
+// each calls the driver first, so names it hands out can be recorded
+//
+
+void APIENTRY traceActiveTexture(GLenum texture)
+{
+	hl_trace.real.ActiveTexture(texture);
+	traceBegin(HL_TRACE_ActiveTexture); traceU32(texture); traceEnd();
+}
+
+void APIENTRY traceAttachShader(GLuint program, GLuint shader)
+{
+	hl_trace.real.AttachShader(program, shader);
+	traceBegin(HL_TRACE_AttachShader); traceU32(program); traceU32(shader); traceEnd();
+}
+
+void APIENTRY traceBeginQuery(GLenum target, GLuint id)
+{
+	hl_trace.real.BeginQuery(target, id);
+	traceBegin(HL_TRACE_BeginQuery); traceU32(target); traceU32(id); traceEnd();
+}
+
+void APIENTRY traceBindBuffer(GLenum target, GLuint buffer)
+{
+	hl_trace.real.BindBuffer(target, buffer);
+	traceBegin(HL_TRACE_BindBuffer);
+	traceU32(target);
+	traceU32(buffer);
+
+	int slot = traceTargetSlot(target);
+	if (slot >= 0) hl_trace.bound[hl_trace.context][slot] = buffer;
+	traceEnd();
+}
+
+void APIENTRY traceBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	hl_trace.real.BindBufferBase(target, index, buffer);
+
+	std::lock_guard<std::recursive_mutex> guard(hl_trace.lock);
+	TraceMapping* m = traceMapping(buffer);
+	if (m) traceMappedWrite(buffer, m->offset, m->length);
+
+	traceBegin(HL_TRACE_BindBufferBase);
+	traceU32(target);
+	traceU32(index);
+	traceU32(buffer);
+
+	int slot = traceTargetSlot(target);
+	if (slot >= 0) hl_trace.bound[hl_trace.context][slot] = buffer;
+	traceEnd();
+}
+
+void APIENTRY traceBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	hl_trace.real.BindBufferRange(target, index, buffer, offset, size);
+
+	std::lock_guard<std::recursive_mutex> guard(hl_trace.lock);
+	traceMappedWrite(buffer, offset, size);
+
+	traceBegin(HL_TRACE_BindBufferRange);
+	traceU32(target);
+	traceU32(index);
+	traceU32(buffer);
+	traceU64(offset);
+	traceU64(size);
+
+	int slot = traceTargetSlot(target);
+	if (slot >= 0) hl_trace.bound[hl_trace.context][slot] = buffer;
+	traceEnd();
+}
+
+void APIENTRY traceBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	hl_trace.real.BindFramebuffer(target, framebuffer);
+	traceBegin(HL_TRACE_BindFramebuffer); traceU32(target); traceU32(framebuffer); traceEnd();
+}
+
+void APIENTRY traceBindTexture(GLenum target, GLuint texture)
+{
+	hl_trace.real.BindTexture(target, texture);
+	traceBegin(HL_TRACE_BindTexture); traceU32(target); traceU32(texture); traceEnd();
+}
+
+void APIENTRY traceBindVertexArray(GLuint array)
+{
+	hl_trace.real.BindVertexArray(array);
+	traceBegin(HL_TRACE_BindVertexArray); traceU32(array); traceEnd();
+}
+
+void APIENTRY traceBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+	GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+	hl_trace.real.BlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+	traceBegin(HL_TRACE_BlitFramebuffer);
+	traceU32(srcX0); traceU32(srcY0); traceU32(srcX1); traceU32(srcY1);
+	traceU32(dstX0); traceU32(dstY0); traceU32(dstX1); traceU32(dstY1);
+	traceU32(mask); traceU32(filter);
+	traceEnd();
+}
+
+void APIENTRY traceBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	hl_trace.real.BufferData(target, size, data, usage);
+	traceBegin(HL_TRACE_BufferData);
+	traceU32(target);
+	traceU64(size);
+	traceBlob(data, size);
+	traceU32(usage);
+	traceEnd();
+}
+
+void APIENTRY traceBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags)
+{
+	hl_trace.real.BufferStorage(target, size, data, flags);
+	traceBegin(HL_TRACE_BufferStorage);
+	traceU32(target);
+	traceU64(size);
+	traceBlob(data, size);
+	traceU32(flags);
+	traceEnd();
+}
+
+void APIENTRY traceBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	hl_trace.real.BufferSubData(target, offset, size, data);
+	traceBegin(HL_TRACE_BufferSubData);
+	traceU32(target);
+	traceU64(offset);
+	traceBlob(data, size);
+	traceEnd();
+}
+
+GLenum APIENTRY traceCheckFramebufferStatus(GLenum target)
+{
+	GLenum ret = hl_trace.real.CheckFramebufferStatus(target);
+	traceBegin(HL_TRACE_CheckFramebufferStatus); traceU32(target); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceClear(GLbitfield mask)
+{
+	hl_trace.real.Clear(mask);
+	traceBegin(HL_TRACE_Clear); traceU32(mask); traceEnd();
+}
+
+void APIENTRY traceClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	hl_trace.real.ClearColor(r, g, b, a);
+	traceBegin(HL_TRACE_ClearColor); traceF32(r); traceF32(g); traceF32(b); traceF32(a); traceEnd();
+}
+
+GLenum APIENTRY traceClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+	GLenum ret = hl_trace.real.ClientWaitSync(sync, flags, timeout);
+	traceBegin(HL_TRACE_ClientWaitSync); traceU64((u64)sync); traceU32(flags); traceU64(timeout); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+	hl_trace.real.ColorMask(r, g, b, a);
+	traceBegin(HL_TRACE_ColorMask); traceU32(r); traceU32(g); traceU32(b); traceU32(a); traceEnd();
+}
+
+void APIENTRY traceCompileShader(GLuint shader)
+{
+	hl_trace.real.CompileShader(shader);
+	traceBegin(HL_TRACE_CompileShader); traceU32(shader); traceEnd();
+}
+
+GLuint APIENTRY traceCreateProgram()
+{
+	GLuint ret = hl_trace.real.CreateProgram();
+	traceBegin(HL_TRACE_CreateProgram); traceU32(ret); traceEnd();
+	return ret;
+}
+
+GLuint APIENTRY traceCreateShader(GLenum type)
+{
+	GLuint ret = hl_trace.real.CreateShader(type);
+	traceBegin(HL_TRACE_CreateShader); traceU32(type); traceU32(ret); traceEnd();
+	return ret;
+}
+
+// name lists: count, then the names
+inline
+void traceNames(GLsizei n, const GLuint* names)
+{
+	traceU32(n);
+	traceBytes(names, (u64)n * sizeof(GLuint));
+}
+
+void APIENTRY traceDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	std::lock_guard<std::recursive_mutex> guard(hl_trace.lock);
+
+	// deleting a buffer unmaps it
+	for (GLsizei i = 0; i < n; i++)
+	{
+		TraceMapping* m = traceMapping(buffers[i]);
+		if (m) m->buffer = 0;
+	}
+
+	hl_trace.real.DeleteBuffers(n, buffers);
+	traceBegin(HL_TRACE_DeleteBuffers); traceNames(n, buffers); traceEnd();
+}
+
+void APIENTRY traceDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+	hl_trace.real.DeleteFramebuffers(n, framebuffers);
+	traceBegin(HL_TRACE_DeleteFramebuffers); traceNames(n, framebuffers); traceEnd();
+}
+
+void APIENTRY traceDeleteProgram(GLuint program)
+{
+	hl_trace.real.DeleteProgram(program);
+	traceBegin(HL_TRACE_DeleteProgram); traceU32(program); traceEnd();
+}
+
+void APIENTRY traceDeleteShader(GLuint shader)
+{
+	hl_trace.real.DeleteShader(shader);
+	traceBegin(HL_TRACE_DeleteShader); traceU32(shader); traceEnd();
+}
+
+void APIENTRY traceDeleteSync(GLsync sync)
+{
+	hl_trace.real.DeleteSync(sync);
+	traceBegin(HL_TRACE_DeleteSync); traceU64((u64)sync); traceEnd();
+}
+
+void APIENTRY traceDeleteTextures(GLsizei n, const GLuint* textures)
+{
+	hl_trace.real.DeleteTextures(n, textures);
+	traceBegin(HL_TRACE_DeleteTextures); traceNames(n, textures); traceEnd();
+}
+
+void APIENTRY traceDepthFunc(GLenum func)
+{
+	hl_trace.real.DepthFunc(func);
+	traceBegin(HL_TRACE_DepthFunc); traceU32(func); traceEnd();
+}
+
+void APIENTRY traceDepthMask(GLboolean flag)
+{
+	hl_trace.real.DepthMask(flag);
+	traceBegin(HL_TRACE_DepthMask); traceU32(flag); traceEnd();
+}
+
+void APIENTRY traceDetachShader(GLuint program, GLuint shader)
+{
+	hl_trace.real.DetachShader(program, shader);
+	traceBegin(HL_TRACE_DetachShader); traceU32(program); traceU32(shader); traceEnd();
+}
+
+void APIENTRY traceDisable(GLenum cap)
+{
+	hl_trace.real.Disable(cap);
+	traceBegin(HL_TRACE_Disable); traceU32(cap); traceEnd();
+}
+
+void APIENTRY traceDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	hl_trace.real.DrawArrays(mode, first, count);
+	traceBegin(HL_TRACE_DrawArrays); traceU32(mode); traceU32(first); traceU32(count); traceEnd();
+}
+
+void APIENTRY traceDrawBuffer(GLenum buf)
+{
+	hl_trace.real.DrawBuffer(buf);
+	traceBegin(HL_TRACE_DrawBuffer); traceU32(buf); traceEnd();
+}
+
+void APIENTRY traceDrawBuffers(GLsizei n, const GLenum* bufs)
+{
+	hl_trace.real.DrawBuffers(n, bufs);
+	traceBegin(HL_TRACE_DrawBuffers); traceNames(n, bufs); traceEnd();
+}
+
+// indices are always an offset into the element buffer in hl
+void APIENTRY traceDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	hl_trace.real.DrawElements(mode, count, type, indices);
+	traceBegin(HL_TRACE_DrawElements); traceU32(mode); traceU32(count); traceU32(type); traceU64((u64)indices); traceEnd();
+}
+
+void APIENTRY traceEnable(GLenum cap)
+{
+	hl_trace.real.Enable(cap);
+	traceBegin(HL_TRACE_Enable); traceU32(cap); traceEnd();
+}
+
+void APIENTRY traceEnableVertexAttribArray(GLuint index)
+{
+	hl_trace.real.EnableVertexAttribArray(index);
+	traceBegin(HL_TRACE_EnableVertexAttribArray); traceU32(index); traceEnd();
+}
+
+void APIENTRY traceEndQuery(GLenum target)
+{
+	hl_trace.real.EndQuery(target);
+	traceBegin(HL_TRACE_EndQuery); traceU32(target); traceEnd();
+}
+
+GLsync APIENTRY traceFenceSync(GLenum condition, GLbitfield flags)
+{
+	GLsync ret = hl_trace.real.FenceSync(condition, flags);
+	traceBegin(HL_TRACE_FenceSync); traceU32(condition); traceU32(flags); traceU64((u64)ret); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceFinish()
+{
+	hl_trace.real.Finish();
+	traceBegin(HL_TRACE_Finish); traceEnd();
+}
+
+void APIENTRY traceFlush()
+{
+	hl_trace.real.Flush();
+	traceBegin(HL_TRACE_Flush); traceEnd();
+}
+
+void APIENTRY traceFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+	hl_trace.real.FramebufferTexture2D(target, attachment, textarget, texture, level);
+	traceBegin(HL_TRACE_FramebufferTexture2D);
+	traceU32(target); traceU32(attachment); traceU32(textarget); traceU32(texture); traceU32(level);
+	traceEnd();
+}
+
+void APIENTRY traceGenBuffers(GLsizei n, GLuint* buffers)
+{
+	hl_trace.real.GenBuffers(n, buffers);
+	traceBegin(HL_TRACE_GenBuffers); traceNames(n, buffers); traceEnd();
+}
+
+void APIENTRY traceGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+	hl_trace.real.GenFramebuffers(n, framebuffers);
+	traceBegin(HL_TRACE_GenFramebuffers); traceNames(n, framebuffers); traceEnd();
+}
+
+void APIENTRY traceGenQueries(GLsizei n, GLuint* ids)
+{
+	hl_trace.real.GenQueries(n, ids);
+	traceBegin(HL_TRACE_GenQueries); traceNames(n, ids); traceEnd();
+}
+
+void APIENTRY traceGenTextures(GLsizei n, GLuint* textures)
+{
+	hl_trace.real.GenTextures(n, textures);
+	traceBegin(HL_TRACE_GenTextures); traceNames(n, textures); traceEnd();
+}
+
+void APIENTRY traceGenVertexArrays(GLsizei n, GLuint* arrays)
+{
+	hl_trace.real.GenVertexArrays(n, arrays);
+	traceBegin(HL_TRACE_GenVertexArrays); traceNames(n, arrays); traceEnd();
+}
+
+void APIENTRY traceGenerateMipmap(GLenum target)
+{
+	hl_trace.real.GenerateMipmap(target);
+	traceBegin(HL_TRACE_GenerateMipmap); traceU32(target); traceEnd();
+}
+
+// queries only record what was asked; the replay asks again,
+// since some of them wait on the GPU or the compiler
+
+void APIENTRY traceGetIntegerv(GLenum pname, GLint* data)
+{
+	hl_trace.real.GetIntegerv(pname, data);
+	traceBegin(HL_TRACE_GetIntegerv); traceU32(pname); traceEnd();
+}
+
+void APIENTRY traceGetProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary)
+{
+	hl_trace.real.GetProgramBinary(program, bufSize, length, binaryFormat, binary);
+	traceBegin(HL_TRACE_GetProgramBinary); traceU32(program); traceU32(bufSize); traceEnd();
+}
+
+void APIENTRY traceGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+	hl_trace.real.GetProgramInfoLog(program, bufSize, length, infoLog);
+	traceBegin(HL_TRACE_GetProgramInfoLog); traceU32(program); traceU32(bufSize); traceEnd();
+}
+
+void APIENTRY traceGetProgramiv(GLuint program, GLenum pname, GLint* params)
+{
+	hl_trace.real.GetProgramiv(program, pname, params);
+	traceBegin(HL_TRACE_GetProgramiv); traceU32(program); traceU32(pname); traceEnd();
+}
+
+void APIENTRY traceGetQueryObjectiv(GLuint id, GLenum pname, GLint* params)
+{
+	hl_trace.real.GetQueryObjectiv(id, pname, params);
+	traceBegin(HL_TRACE_GetQueryObjectiv); traceU32(id); traceU32(pname); traceEnd();
+}
+
+void APIENTRY traceGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params)
+{
+	hl_trace.real.GetQueryObjectui64v(id, pname, params);
+	traceBegin(HL_TRACE_GetQueryObjectui64v); traceU32(id); traceU32(pname); traceEnd();
+}
+
+void APIENTRY traceGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+	hl_trace.real.GetShaderInfoLog(shader, bufSize, length, infoLog);
+	traceBegin(HL_TRACE_GetShaderInfoLog); traceU32(shader); traceU32(bufSize); traceEnd();
+}
+
+void APIENTRY traceGetShaderiv(GLuint shader, GLenum pname, GLint* params)
+{
+	hl_trace.real.GetShaderiv(shader, pname, params);
+	traceBegin(HL_TRACE_GetShaderiv); traceU32(shader); traceU32(pname); traceEnd();
+}
+
+const GLubyte* APIENTRY traceGetString(GLenum name)
+{
+	const GLubyte* ret = hl_trace.real.GetString(name);
+	traceBegin(HL_TRACE_GetString); traceU32(name); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, void* pixels)
+{
+	hl_trace.real.GetTexImage(target, level, format, type, pixels);
+
+	int width = 0, height = 0, depth = 0;
+	glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(target, level, GL_TEXTURE_DEPTH, &depth);
+
+	traceBegin(HL_TRACE_GetTexImage);
+	traceU32(target); traceU32(level); traceU32(format); traceU32(type);
+	tracePack(pixels, tracePixelBytes(width, height, depth, format, type, hl_trace.packAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+GLuint APIENTRY traceGetUniformBlockIndex(GLuint program, const GLchar* name)
+{
+	GLuint ret = hl_trace.real.GetUniformBlockIndex(program, name);
+	traceBegin(HL_TRACE_GetUniformBlockIndex); traceU32(program); traceBlob(name, strlen(name) + 1); traceU32(ret); traceEnd();
+	return ret;
+}
+
+GLint APIENTRY traceGetUniformLocation(GLuint program, const GLchar* name)
+{
+	GLint ret = hl_trace.real.GetUniformLocation(program, name);
+	traceBegin(HL_TRACE_GetUniformLocation); traceU32(program); traceBlob(name, strlen(name) + 1); traceU32(ret); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceInvalidateFramebuffer(GLenum target, GLsizei numAttachments, const GLenum* attachments)
+{
+	hl_trace.real.InvalidateFramebuffer(target, numAttachments, attachments);
+	traceBegin(HL_TRACE_InvalidateFramebuffer); traceU32(target); traceNames(numAttachments, attachments); traceEnd();
+}
+
+void APIENTRY traceLinkProgram(GLuint program)
+{
+	hl_trace.real.LinkProgram(program);
+	traceBegin(HL_TRACE_LinkProgram); traceU32(program); traceEnd();
+}
+
+void* APIENTRY traceMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+	void* ret = hl_trace.real.MapBufferRange(target, offset, length, access);
+
+	traceBegin(HL_TRACE_MapBufferRange);
+	traceU32(target); traceU64(offset); traceU64(length); traceU32(access);
+
+	// remember where writes go, to pick them up later
+	uint buffer = traceBound(target);
+	if (ret && buffer && (access & GL_MAP_WRITE_BIT))
+	{
+		for (int i = 0; i < HL_TRACE_MAPPINGS; i++)
+		{
+			if (hl_trace.mappings[i].buffer) continue;
+			hl_trace.mappings[i].buffer = buffer;
+			hl_trace.mappings[i].offset = offset;
+			hl_trace.mappings[i].length = length;
+			hl_trace.mappings[i].pointer = (u8*)ret;
+			break;
+		}
+	}
+	traceEnd();
+	return ret;
+}
+
+void APIENTRY traceMaxShaderCompilerThreadsKHR(GLuint count)
+{
+	hl_trace.real.MaxShaderCompilerThreadsKHR(count);
+	traceBegin(HL_TRACE_MaxShaderCompilerThreadsKHR); traceU32(count); traceEnd();
+}
+
+void APIENTRY traceMultiDrawElements(GLenum mode, const GLsizei* count, GLenum type, const void* const* indices, GLsizei drawcount)
+{
+	hl_trace.real.MultiDrawElements(mode, count, type, indices, drawcount);
+
+	traceBegin(HL_TRACE_MultiDrawElements);
+	traceU32(mode);
+	traceU32(type);
+	traceU32(drawcount);
+	traceBytes(count, (u64)drawcount * sizeof(GLsizei));
+	for (int i = 0; i < drawcount; i++) traceU64((u64)indices[i]);
+	traceEnd();
+}
+
+void APIENTRY tracePixelStorei(GLenum pname, GLint param)
+{
+	hl_trace.real.PixelStorei(pname, param);
+	traceBegin(HL_TRACE_PixelStorei);
+	traceU32(pname);
+	traceU32(param);
+
+	if (pname == GL_PACK_ALIGNMENT) hl_trace.packAlignment[hl_trace.context] = param;
+	if (pname == GL_UNPACK_ALIGNMENT) hl_trace.unpackAlignment[hl_trace.context] = param;
+	traceEnd();
+}
+
+void APIENTRY traceProgramBinary(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length)
+{
+	hl_trace.real.ProgramBinary(program, binaryFormat, binary, length);
+	traceBegin(HL_TRACE_ProgramBinary); traceU32(program); traceU32(binaryFormat); traceBlob(binary, length); traceEnd();
+}
+
+void APIENTRY traceProgramParameteri(GLuint program, GLenum pname, GLint value)
+{
+	hl_trace.real.ProgramParameteri(program, pname, value);
+	traceBegin(HL_TRACE_ProgramParameteri); traceU32(program); traceU32(pname); traceU32(value); traceEnd();
+}
+
+void APIENTRY traceReadBuffer(GLenum src)
+{
+	hl_trace.real.ReadBuffer(src);
+	traceBegin(HL_TRACE_ReadBuffer); traceU32(src); traceEnd();
+}
+
+void APIENTRY traceReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels)
+{
+	hl_trace.real.ReadPixels(x, y, width, height, format, type, pixels);
+	traceBegin(HL_TRACE_ReadPixels);
+	traceU32(x); traceU32(y); traceU32(width); traceU32(height); traceU32(format); traceU32(type);
+	tracePack(pixels, tracePixelBytes(width, height, 1, format, type, hl_trace.packAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+// each string as one payload, whatever way its length was given
+void APIENTRY traceShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length)
+{
+	hl_trace.real.ShaderSource(shader, count, string, length);
+
+	traceBegin(HL_TRACE_ShaderSource);
+	traceU32(shader);
+	traceU32(count);
+	for (int i = 0; i < count; i++)
+		traceBlob(string[i], (length && length[i] >= 0) ? length[i] : strlen(string[i]));
+	traceEnd();
+}
+
+void APIENTRY traceTexBuffer(GLenum target, GLenum internalformat, GLuint buffer)
+{
+	hl_trace.real.TexBuffer(target, internalformat, buffer);
+	traceBegin(HL_TRACE_TexBuffer); traceU32(target); traceU32(internalformat); traceU32(buffer); traceEnd();
+}
+
+void APIENTRY traceTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+	GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	hl_trace.real.TexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+	traceBegin(HL_TRACE_TexImage2D);
+	traceU32(target); traceU32(level); traceU32(internalformat); traceU32(width); traceU32(height);
+	traceU32(border); traceU32(format); traceU32(type);
+	traceUnpack(pixels, tracePixelBytes(width, height, 1, format, type, hl_trace.unpackAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+void APIENTRY traceTexImage3D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+	GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	hl_trace.real.TexImage3D(target, level, internalformat, width, height, depth, border, format, type, pixels);
+	traceBegin(HL_TRACE_TexImage3D);
+	traceU32(target); traceU32(level); traceU32(internalformat); traceU32(width); traceU32(height);
+	traceU32(depth); traceU32(border); traceU32(format); traceU32(type);
+	traceUnpack(pixels, tracePixelBytes(width, height, depth, format, type, hl_trace.unpackAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+void APIENTRY traceTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+	hl_trace.real.TexParameteri(target, pname, param);
+	traceBegin(HL_TRACE_TexParameteri); traceU32(target); traceU32(pname); traceU32(param); traceEnd();
+}
+
+void APIENTRY traceTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+	GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+{
+	hl_trace.real.TexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+	traceBegin(HL_TRACE_TexSubImage2D);
+	traceU32(target); traceU32(level); traceU32(xoffset); traceU32(yoffset);
+	traceU32(width); traceU32(height); traceU32(format); traceU32(type);
+	traceUnpack(pixels, tracePixelBytes(width, height, 1, format, type, hl_trace.unpackAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+void APIENTRY traceTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+	GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels)
+{
+	hl_trace.real.TexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels);
+	traceBegin(HL_TRACE_TexSubImage3D);
+	traceU32(target); traceU32(level); traceU32(xoffset); traceU32(yoffset); traceU32(zoffset);
+	traceU32(width); traceU32(height); traceU32(depth); traceU32(format); traceU32(type);
+	traceUnpack(pixels, tracePixelBytes(width, height, depth, format, type, hl_trace.unpackAlignment[hl_trace.context]));
+	traceEnd();
+}
+
+void APIENTRY traceUniform1f(GLint location, GLfloat v0)
+{
+	hl_trace.real.Uniform1f(location, v0);
+	traceBegin(HL_TRACE_Uniform1f); traceU32(location); traceF32(v0); traceEnd();
+}
+
+void APIENTRY traceUniform1i(GLint location, GLint v0)
+{
+	hl_trace.real.Uniform1i(location, v0);
+	traceBegin(HL_TRACE_Uniform1i); traceU32(location); traceU32(v0); traceEnd();
+}
+
+void APIENTRY traceUniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+	hl_trace.real.Uniform2f(location, v0, v1);
+	traceBegin(HL_TRACE_Uniform2f); traceU32(location); traceF32(v0); traceF32(v1); traceEnd();
+}
+
+void APIENTRY traceUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	hl_trace.real.Uniform3f(location, v0, v1, v2);
+	traceBegin(HL_TRACE_Uniform3f); traceU32(location); traceF32(v0); traceF32(v1); traceF32(v2); traceEnd();
+}
+
+void APIENTRY traceUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+{
+	hl_trace.real.Uniform4f(location, v0, v1, v2, v3);
+	traceBegin(HL_TRACE_Uniform4f); traceU32(location); traceF32(v0); traceF32(v1); traceF32(v2); traceF32(v3); traceEnd();
+}
+
+void APIENTRY traceUniformBlockBinding(GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding)
+{
+	hl_trace.real.UniformBlockBinding(program, uniformBlockIndex, uniformBlockBinding);
+	traceBegin(HL_TRACE_UniformBlockBinding); traceU32(program); traceU32(uniformBlockIndex); traceU32(uniformBlockBinding); traceEnd();
+}
+
+void APIENTRY traceUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	hl_trace.real.UniformMatrix4fv(location, count, transpose, value);
+	traceBegin(HL_TRACE_UniformMatrix4fv); traceU32(location); traceU32(transpose); traceBlob(value, (u64)count * 64); traceEnd();
+}
+
+GLboolean APIENTRY traceUnmapBuffer(GLenum target)
+{
+	// what was written has to be picked up before the pointer goes away
+	std::lock_guard<std::recursive_mutex> guard(hl_trace.lock);
+	hl_trace.context = traceContext();
+
+	uint buffer = traceBound(target);
+	TraceMapping* m = traceMapping(buffer);
+	if (m)
+	{
+		traceMappedWrite(buffer, m->offset, m->length);
+		m->buffer = 0;
+	}
+
+	GLboolean ret = hl_trace.real.UnmapBuffer(target);
+	traceBegin(HL_TRACE_UnmapBuffer); traceU32(target); traceEnd();
+	return ret;
+}
+
+void APIENTRY traceUseProgram(GLuint program)
+{
+	hl_trace.real.UseProgram(program);
+	traceBegin(HL_TRACE_UseProgram); traceU32(program); traceEnd();
+}
+
+void APIENTRY traceVertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer)
+{
+	hl_trace.real.VertexAttribIPointer(index, size, type, stride, pointer);
+	traceBegin(HL_TRACE_VertexAttribIPointer);
+	traceU32(index); traceU32(size); traceU32(type); traceU32(stride); traceU64((u64)pointer);
+	traceEnd();
+}
+
+void APIENTRY traceVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+{
+	hl_trace.real.VertexAttribPointer(index, size, type, normalized, stride, pointer);
+	traceBegin(HL_TRACE_VertexAttribPointer);
+	traceU32(index); traceU32(size); traceU32(type); traceU32(normalized); traceU32(stride); traceU64((u64)pointer);
+	traceEnd();
+}
+
+void APIENTRY traceViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	hl_trace.real.Viewport(x, y, width, height);
+	traceBegin(HL_TRACE_Viewport); traceU32(x); traceU32(y); traceU32(width); traceU32(height); traceEnd();
+}
+
+//
+// Control
+//
+
+void writeTraceHeader()
+{
+	TraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "HLTRACE", 8);
+	header.version = HL_TRACE_VERSION;
+
+	int width, height;
+	glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
+	header.width = width;
+	header.height = height;
+	header.major = GLVersion.major;
+	header.minor = GLVersion.minor;
+	header.frames = hl_trace.numFrames;
+
+	fseek(hl_trace.file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, hl_trace.file);
+	fseek(hl_trace.file, 0, SEEK_END);
+}
+
+// record every GL call into 'path' for 'frames' frames (0 = until
+// stopTrace); from the drawing thread, with its context current
+int startTrace(const char* path, int frames = 0)
+{
+	if (hl_trace.running) return 0;
+
+	hl_trace.file = fopen(path, "wb");
+	if (!hl_trace.file)
+	{
+		fprintf(stderr, "[Trace] Failed to open '%s'\n", path);
+		return 0;
+	}
+
+	hl_trace.frames = frames;
+	hl_trace.numFrames = 0;
+	hl_trace.frameStart = glfwGetTime();
+	hl_trace.size = 0;
+	hl_trace.numContexts = 0;
+	memset(hl_trace.mappings, 0, sizeof(hl_trace.mappings));
+	writeTraceHeader();
+
+	// the drawing thread's context is 0
+	traceContext();
+
+	// entry points the driver doesn't have stay null, so checks like
+	// 'if (glBufferStorage)' still see that
+	#define X(name) \
+		hl_trace.real.name = glad_gl##name; \
+		if (glad_gl##name) glad_gl##name = trace##name;
+	HL_TRACE_CALLS(X)
+	#undef X
+
+	hl_trace.running = 1;
+	fprintf(stderr, "[Trace] Recording to '%s'\n", path);
+	return 1;
+}
+
+void stopTrace()
+{
+	if (!hl_trace.running) return;
+
+	#define X(name) glad_gl##name = hl_trace.real.name;
+	HL_TRACE_CALLS(X)
+	#undef X
+
+	std::lock_guard<std::recursive_mutex> guard(hl_trace.lock);
+	hl_trace.running = 0;
+
+	writeTraceData();
+	writeTraceHeader();
+	fclose(hl_trace.file);
+	hl_trace.file = 0;
+
+	fprintf(stderr, "[Trace] Recorded %u frames\n", hl_trace.numFrames);
+}
+
+// called once per frame from presentFrame, before the swap
+void updateTrace()
+{
+	if (!hl_trace.running) return;
+
+	double now = glfwGetTime();
+	traceBegin(HL_TRACE_FRAME);
+	traceU64((u64)((now - hl_trace.frameStart) * 1e9));
+	traceEnd();
+
+	hl_trace.frameStart = now;
+	hl_trace.numFrames++;
+
+	if (hl_trace.frames && hl_trace.numFrames >= (u32)hl_trace.frames) stopTrace();
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+clang++ -O2 main.cc -o treplay -isystem ~/include -lglad -lglfw
+RETURN=$?
+
+[[ -z "$RETURN" ]] && treplay
\ No newline at end of file
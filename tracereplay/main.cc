@@ -0,0 +1,837 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#define uint unsigned int
+
+#define u8 unsigned char
+#define u16 unsigned short
+#define u32 unsigned int
+#define u64 unsigned long
+
+#include "../trace.h"
+
+#define USAGE "\n\
+Usage:\n\
+treplay [--finish] [--summary] [TRACE_FILE]\n\
+--finish waits for the GPU at the end of every frame,\n\
+so the CPU times include it.\n\
+--summary leaves out the per-frame lines.\n"
+
+#define HELP_MESSAGE "\
+treplay - GL trace replay utility\n\
+Plays back a trace recorded with startTrace (or HL_TRACE)\n\
+in a hidden window, as fast as it can, and reports how long\n\
+every frame took on the CPU and the GPU.\n"
+
+//
+// Reading
+//
+
+u8* at;
+u8* end;
+
+u32 readU32()
+{
+	u32 ret;
+	memcpy(&ret, at, 4);
+	at += 4;
+	return ret;
+}
+
+u64 readU64()
+{
+	u64 ret;
+	memcpy(&ret, at, 8);
+	at += 8;
+	return ret;
+}
+
+float readF32()
+{
+	float ret;
+	memcpy(&ret, at, 4);
+	at += 4;
+	return ret;
+}
+
+// null for an empty payload
+u8* readBlob(u32* size = 0)
+{
+	u32 length = readU32();
+	u8* ret = (length) ? at : 0;
+	at += (length + 3) & ~3;
+	if (size) *size = length;
+	return ret;
+}
+
+//
+// Remapping
+//
+
+// names as the app saw them -> names here; 0 stays 0
+struct Names
+{
+	std::vector<uint> map;
+
+	uint get(uint captured)
+	{
+		return (captured < map.size()) ? map[captured] : 0;
+	}
+
+	void set(uint captured, uint name)
+	{
+		if (captured >= map.size()) map.resize(captured + 1, 0);
+		map[captured] = name;
+	}
+};
+
+Names buffers, textures, arrays, framebuffers, queries;
+Names programs; // shaders and programs share one namespace
+
+std::unordered_map<u64, GLsync> syncs;
+std::unordered_map<u64, GLint> locations; // program << 32 | captured location
+std::unordered_map<u64, GLuint> blocks; // program << 32 | captured index
+
+struct Mapping
+{
+	u64 offset;
+	u8* pointer;
+};
+std::unordered_map<uint, Mapping> mappings; // by replay buffer name
+
+GLFWwindow* contexts[HL_TRACE_CONTEXTS];
+int current;
+uint bound[HL_TRACE_CONTEXTS][HL_TRACE_TARGETS]; // captured names
+uint program[HL_TRACE_CONTEXTS]; // captured program in use
+
+std::vector<u8> scratch;
+
+inline
+u64 programKey(uint program, u32 value)
+{
+	return ((u64)program << 32) | value;
+}
+
+GLint location(u32 captured)
+{
+	if ((GLint)captured < 0) return -1;
+
+	auto found = locations.find(programKey(program[current], captured));
+	return (found == locations.end()) ? -1 : found->second;
+}
+
+void genNames(Names* names, PFNGLGENBUFFERSPROC gen)
+{
+	u32 n = readU32();
+	uint* made = (uint*) malloc(n * sizeof(uint));
+	gen(n, made);
+	for (u32 i = 0; i < n; i++) names->set(readU32(), made[i]);
+	free(made);
+}
+
+void deleteNames(Names* names, PFNGLDELETETEXTURESPROC del)
+{
+	u32 n = readU32();
+	uint* list = (uint*) malloc(n * sizeof(uint));
+	for (u32 i = 0; i < n; i++) list[i] = names->get(readU32());
+	del(n, list);
+	free(list);
+}
+
+void bindSlot(GLenum target, uint captured)
+{
+	int slot = traceTargetSlot(target);
+	if (slot >= 0) bound[current][slot] = captured;
+}
+
+uint boundBuffer(GLenum target)
+{
+	int slot = traceTargetSlot(target);
+	return (slot < 0) ? 0 : buffers.get(bound[current][slot]);
+}
+
+const void* readUnpack()
+{
+	if (readU32()) return (const void*)readU64();
+	return readBlob();
+}
+
+void* readPack()
+{
+	if (readU32()) return (void*)readU64();
+
+	u64 size = readU64();
+	if (scratch.size() < size) scratch.resize(size);
+	return scratch.data();
+}
+
+u32* readList(u32* n)
+{
+	*n = readU32();
+	u32* ret = (u32*)at;
+	at += *n * 4;
+	return ret;
+}
+
+void makeCurrent(int context)
+{
+	if (context >= HL_TRACE_CONTEXTS) context = HL_TRACE_CONTEXTS - 1;
+
+	// other contexts share objects with the first, like the upload thread's
+	if (!contexts[context])
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		contexts[context] = glfwCreateWindow(1, 1, "", 0, contexts[0]);
+		if (!contexts[context])
+		{
+			fprintf(stderr, "Failed to create context %i, using the first\n", context);
+			contexts[context] = contexts[0];
+		}
+
+		for (int i = 0; i < HL_TRACE_TARGETS; i++) bound[context][i] = 0;
+		program[context] = 0;
+	}
+
+	glfwMakeContextCurrent(contexts[context]);
+	current = context;
+}
+
+//
+// Replay
+//
+
+void replayRecord(u8 call)
+{
+	switch (call)
+	{
+		case HL_TRACE_WRITE:
+		{
+			uint buffer = buffers.get(readU32());
+			u64 offset = readU64();
+			u32 size;
+			u8* data = readBlob(&size);
+
+			auto found = mappings.find(buffer);
+			if (found != mappings.end()) memcpy(found->second.pointer + (offset - found->second.offset), data, size);
+			else
+			{
+				glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+				glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+			}
+			break;
+		}
+
+		case HL_TRACE_ActiveTexture: glActiveTexture(readU32()); break;
+		case HL_TRACE_AttachShader: { uint p = programs.get(readU32()); glAttachShader(p, programs.get(readU32())); break; }
+		case HL_TRACE_BeginQuery: { GLenum target = readU32(); glBeginQuery(target, queries.get(readU32())); break; }
+
+		case HL_TRACE_BindBuffer:
+		{
+			GLenum target = readU32();
+			uint buffer = readU32();
+			bindSlot(target, buffer);
+			glBindBuffer(target, buffers.get(buffer));
+			break;
+		}
+
+		case HL_TRACE_BindBufferBase:
+		{
+			GLenum target = readU32();
+			uint index = readU32();
+			uint buffer = readU32();
+			bindSlot(target, buffer);
+			glBindBufferBase(target, index, buffers.get(buffer));
+			break;
+		}
+
+		case HL_TRACE_BindBufferRange:
+		{
+			GLenum target = readU32();
+			uint index = readU32();
+			uint buffer = readU32();
+			u64 offset = readU64();
+			u64 size = readU64();
+			bindSlot(target, buffer);
+			glBindBufferRange(target, index, buffers.get(buffer), offset, size);
+			break;
+		}
+
+		case HL_TRACE_BindFramebuffer: { GLenum target = readU32(); glBindFramebuffer(target, framebuffers.get(readU32())); break; }
+		case HL_TRACE_BindTexture: { GLenum target = readU32(); glBindTexture(target, textures.get(readU32())); break; }
+		case HL_TRACE_BindVertexArray: glBindVertexArray(arrays.get(readU32())); break;
+
+		case HL_TRACE_BlitFramebuffer:
+		{
+			GLint v[8];
+			for (int i = 0; i < 8; i++) v[i] = readU32();
+			GLbitfield mask = readU32();
+			glBlitFramebuffer(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], mask, readU32());
+			break;
+		}
+
+		case HL_TRACE_BufferData:
+		{
+			GLenum target = readU32();
+			u64 size = readU64();
+			u8* data = readBlob();
+			glBufferData(target, size, data, readU32());
+			break;
+		}
+
+		case HL_TRACE_BufferStorage:
+		{
+			GLenum target = readU32();
+			u64 size = readU64();
+			u8* data = readBlob();
+			glBufferStorage(target, size, data, readU32());
+			break;
+		}
+
+		case HL_TRACE_BufferSubData:
+		{
+			GLenum target = readU32();
+			u64 offset = readU64();
+			u32 size;
+			u8* data = readBlob(&size);
+			glBufferSubData(target, offset, size, data);
+			break;
+		}
+
+		case HL_TRACE_CheckFramebufferStatus: glCheckFramebufferStatus(readU32()); break;
+		case HL_TRACE_Clear: glClear(readU32()); break;
+		case HL_TRACE_ClearColor: { float c[4]; for (int i = 0; i < 4; i++) c[i] = readF32(); glClearColor(c[0], c[1], c[2], c[3]); break; }
+
+		case HL_TRACE_ClientWaitSync:
+		{
+			u64 sync = readU64();
+			GLbitfield flags = readU32();
+			u64 timeout = readU64();
+
+			auto found = syncs.find(sync);
+			if (found != syncs.end()) glClientWaitSync(found->second, flags, timeout);
+			break;
+		}
+
+		case HL_TRACE_ColorMask: { u32 c[4]; for (int i = 0; i < 4; i++) c[i] = readU32(); glColorMask(c[0], c[1], c[2], c[3]); break; }
+		case HL_TRACE_CompileShader: glCompileShader(programs.get(readU32())); break;
+		case HL_TRACE_CreateProgram: programs.set(readU32(), glCreateProgram()); break;
+		case HL_TRACE_CreateShader: { GLenum type = readU32(); programs.set(readU32(), glCreateShader(type)); break; }
+		case HL_TRACE_DeleteBuffers:
+		{
+			u32 n;
+			u32* list = readList(&n);
+			std::vector<uint> names(n);
+			for (u32 i = 0; i < n; i++)
+			{
+				names[i] = buffers.get(list[i]);
+				mappings.erase(names[i]); // deleting a buffer unmaps it
+			}
+			glDeleteBuffers(n, names.data());
+			break;
+		}
+		case HL_TRACE_DeleteFramebuffers: deleteNames(&framebuffers, glDeleteFramebuffers); break;
+		case HL_TRACE_DeleteProgram: glDeleteProgram(programs.get(readU32())); break;
+		case HL_TRACE_DeleteShader: glDeleteShader(programs.get(readU32())); break;
+
+		case HL_TRACE_DeleteSync:
+		{
+			auto found = syncs.find(readU64());
+			if (found == syncs.end()) break;
+			glDeleteSync(found->second);
+			syncs.erase(found);
+			break;
+		}
+
+		case HL_TRACE_DeleteTextures: deleteNames(&textures, glDeleteTextures); break;
+		case HL_TRACE_DepthFunc: glDepthFunc(readU32()); break;
+		case HL_TRACE_DepthMask: glDepthMask(readU32()); break;
+		case HL_TRACE_DetachShader: { uint p = programs.get(readU32()); glDetachShader(p, programs.get(readU32())); break; }
+		case HL_TRACE_Disable: glDisable(readU32()); break;
+		case HL_TRACE_DrawArrays: { GLenum mode = readU32(); GLint first = readU32(); glDrawArrays(mode, first, readU32()); break; }
+		case HL_TRACE_DrawBuffer: glDrawBuffer(readU32()); break;
+		case HL_TRACE_DrawBuffers: { u32 n; u32* list = readList(&n); glDrawBuffers(n, list); break; }
+
+		case HL_TRACE_DrawElements:
+		{
+			GLenum mode = readU32();
+			GLsizei count = readU32();
+			GLenum type = readU32();
+			glDrawElements(mode, count, type, (const void*)readU64());
+			break;
+		}
+
+		case HL_TRACE_Enable: glEnable(readU32()); break;
+		case HL_TRACE_EnableVertexAttribArray: glEnableVertexAttribArray(readU32()); break;
+		case HL_TRACE_EndQuery: glEndQuery(readU32()); break;
+
+		case HL_TRACE_FenceSync:
+		{
+			GLenum condition = readU32();
+			GLbitfield flags = readU32();
+			syncs[readU64()] = glFenceSync(condition, flags);
+			break;
+		}
+
+		case HL_TRACE_Finish: glFinish(); break;
+		case HL_TRACE_Flush: glFlush(); break;
+
+		case HL_TRACE_FramebufferTexture2D:
+		{
+			GLenum target = readU32();
+			GLenum attachment = readU32();
+			GLenum textarget = readU32();
+			uint texture = textures.get(readU32());
+			glFramebufferTexture2D(target, attachment, textarget, texture, readU32());
+			break;
+		}
+
+		case HL_TRACE_GenBuffers: genNames(&buffers, glGenBuffers); break;
+		case HL_TRACE_GenFramebuffers: genNames(&framebuffers, glGenFramebuffers); break;
+		case HL_TRACE_GenQueries: genNames(&queries, glGenQueries); break;
+		case HL_TRACE_GenTextures: genNames(&textures, glGenTextures); break;
+		case HL_TRACE_GenVertexArrays: genNames(&arrays, glGenVertexArrays); break;
+		case HL_TRACE_GenerateMipmap: glGenerateMipmap(readU32()); break;
+
+		// queries are asked again for whatever waiting they do; answers are dropped
+		case HL_TRACE_GetIntegerv: { GLint v[256]; glGetIntegerv(readU32(), v); break; }
+
+		case HL_TRACE_GetProgramBinary:
+		{
+			uint p = programs.get(readU32());
+			GLsizei size = readU32();
+			GLsizei length;
+			GLenum format;
+			if (scratch.size() < (u64)size) scratch.resize(size);
+			glGetProgramBinary(p, size, &length, &format, scratch.data());
+			break;
+		}
+
+		case HL_TRACE_GetProgramInfoLog:
+		case HL_TRACE_GetShaderInfoLog:
+		{
+			uint object = programs.get(readU32());
+			GLsizei size = readU32();
+			if (scratch.size() < (u64)size) scratch.resize(size);
+			if (call == HL_TRACE_GetProgramInfoLog) glGetProgramInfoLog(object, size, 0, (GLchar*)scratch.data());
+			else glGetShaderInfoLog(object, size, 0, (GLchar*)scratch.data());
+			break;
+		}
+
+		case HL_TRACE_GetProgramiv: { GLint v; uint p = programs.get(readU32()); glGetProgramiv(p, readU32(), &v); break; }
+		case HL_TRACE_GetQueryObjectiv: { GLint v; uint q = queries.get(readU32()); glGetQueryObjectiv(q, readU32(), &v); break; }
+		case HL_TRACE_GetQueryObjectui64v: { GLuint64 v; uint q = queries.get(readU32()); glGetQueryObjectui64v(q, readU32(), &v); break; }
+		case HL_TRACE_GetShaderiv: { GLint v; uint s = programs.get(readU32()); glGetShaderiv(s, readU32(), &v); break; }
+		case HL_TRACE_GetString: glGetString(readU32()); break;
+
+		case HL_TRACE_GetTexImage:
+		{
+			GLenum target = readU32();
+			GLint level = readU32();
+			GLenum format = readU32();
+			GLenum type = readU32();
+			glGetTexImage(target, level, format, type, readPack());
+			break;
+		}
+
+		case HL_TRACE_GetUniformBlockIndex:
+		case HL_TRACE_GetUniformLocation:
+		{
+			uint captured = readU32();
+			const char* name = (const char*)readBlob();
+			u32 result = readU32();
+
+			uint p = programs.get(captured);
+			if (call == HL_TRACE_GetUniformLocation) locations[programKey(captured, result)] = glGetUniformLocation(p, name);
+			else blocks[programKey(captured, result)] = glGetUniformBlockIndex(p, name);
+			break;
+		}
+
+		case HL_TRACE_InvalidateFramebuffer: { GLenum target = readU32(); u32 n; u32* list = readList(&n); glInvalidateFramebuffer(target, n, list); break; }
+		case HL_TRACE_LinkProgram: glLinkProgram(programs.get(readU32())); break;
+
+		case HL_TRACE_MapBufferRange:
+		{
+			GLenum target = readU32();
+			u64 offset = readU64();
+			u64 length = readU64();
+			GLbitfield access = readU32();
+
+			void* pointer = glMapBufferRange(target, offset, length, access);
+			if (pointer && (access & GL_MAP_WRITE_BIT))
+			{
+				Mapping m = {offset, (u8*)pointer};
+				mappings[boundBuffer(target)] = m;
+			}
+			break;
+		}
+
+		case HL_TRACE_MaxShaderCompilerThreadsKHR: if (glMaxShaderCompilerThreadsKHR) glMaxShaderCompilerThreadsKHR(readU32()); break;
+
+		case HL_TRACE_MultiDrawElements:
+		{
+			GLenum mode = readU32();
+			GLenum type = readU32();
+			GLsizei count = readU32();
+
+			std::vector<GLsizei> counts(count);
+			std::vector<const void*> offsets(count);
+			for (int i = 0; i < count; i++) counts[i] = readU32();
+			for (int i = 0; i < count; i++) offsets[i] = (const void*)readU64();
+
+			glMultiDrawElements(mode, counts.data(), type, offsets.data(), count);
+			break;
+		}
+
+		case HL_TRACE_PixelStorei: { GLenum pname = readU32(); glPixelStorei(pname, readU32()); break; }
+
+		case HL_TRACE_ProgramBinary:
+		{
+			uint p = programs.get(readU32());
+			GLenum format = readU32();
+			u32 size;
+			u8* binary = readBlob(&size);
+			glProgramBinary(p, format, binary, size);
+			break;
+		}
+
+		case HL_TRACE_ProgramParameteri:
+		{
+			uint p = programs.get(readU32());
+			GLenum pname = readU32();
+			glProgramParameteri(p, pname, readU32());
+			break;
+		}
+
+		case HL_TRACE_ReadBuffer: glReadBuffer(readU32()); break;
+
+		case HL_TRACE_ReadPixels:
+		{
+			GLint v[6];
+			for (int i = 0; i < 6; i++) v[i] = readU32();
+			glReadPixels(v[0], v[1], v[2], v[3], v[4], v[5], readPack());
+			break;
+		}
+
+		case HL_TRACE_ShaderSource:
+		{
+			uint shader = programs.get(readU32());
+			u32 count = readU32();
+
+			std::vector<const GLchar*> strings(count);
+			std::vector<GLint> lengths(count);
+			for (u32 i = 0; i < count; i++)
+			{
+				u32 length;
+				strings[i] = (const GLchar*)readBlob(&length);
+				lengths[i] = length;
+			}
+			glShaderSource(shader, count, strings.data(), lengths.data());
+			break;
+		}
+
+		case HL_TRACE_TexBuffer:
+		{
+			GLenum target = readU32();
+			GLenum format = readU32();
+			glTexBuffer(target, format, buffers.get(readU32()));
+			break;
+		}
+
+		case HL_TRACE_TexImage2D:
+		{
+			GLint v[8];
+			for (int i = 0; i < 8; i++) v[i] = readU32();
+			glTexImage2D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], readUnpack());
+			break;
+		}
+
+		case HL_TRACE_TexImage3D:
+		{
+			GLint v[9];
+			for (int i = 0; i < 9; i++) v[i] = readU32();
+			glTexImage3D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], readUnpack());
+			break;
+		}
+
+		case HL_TRACE_TexParameteri: { GLenum target = readU32(); GLenum pname = readU32(); glTexParameteri(target, pname, readU32()); break; }
+
+		case HL_TRACE_TexSubImage2D:
+		{
+			GLint v[8];
+			for (int i = 0; i < 8; i++) v[i] = readU32();
+			glTexSubImage2D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], readUnpack());
+			break;
+		}
+
+		case HL_TRACE_TexSubImage3D:
+		{
+			GLint v[10];
+			for (int i = 0; i < 10; i++) v[i] = readU32();
+			glTexSubImage3D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], readUnpack());
+			break;
+		}
+
+		case HL_TRACE_Uniform1f: { GLint l = location(readU32()); glUniform1f(l, readF32()); break; }
+		case HL_TRACE_Uniform1i: { GLint l = location(readU32()); glUniform1i(l, readU32()); break; }
+		case HL_TRACE_Uniform2f: { GLint l = location(readU32()); float x = readF32(); glUniform2f(l, x, readF32()); break; }
+		case HL_TRACE_Uniform3f: { GLint l = location(readU32()); float x = readF32(), y = readF32(); glUniform3f(l, x, y, readF32()); break; }
+		case HL_TRACE_Uniform4f: { GLint l = location(readU32()); float x = readF32(), y = readF32(), z = readF32(); glUniform4f(l, x, y, z, readF32()); break; }
+
+		case HL_TRACE_UniformBlockBinding:
+		{
+			uint captured = readU32();
+			u32 index = readU32();
+			u32 binding = readU32();
+
+			auto found = blocks.find(programKey(captured, index));
+			glUniformBlockBinding(programs.get(captured), (found == blocks.end()) ? index : found->second, binding);
+			break;
+		}
+
+		case HL_TRACE_UniformMatrix4fv:
+		{
+			GLint l = location(readU32());
+			GLboolean transpose = readU32();
+			u32 size;
+			const GLfloat* value = (const GLfloat*)readBlob(&size);
+			glUniformMatrix4fv(l, size / 64, transpose, value);
+			break;
+		}
+
+		case HL_TRACE_UnmapBuffer:
+		{
+			GLenum target = readU32();
+			mappings.erase(boundBuffer(target));
+			glUnmapBuffer(target);
+			break;
+		}
+
+		case HL_TRACE_UseProgram:
+			program[current] = readU32();
+			glUseProgram(programs.get(program[current]));
+			break;
+
+		case HL_TRACE_VertexAttribIPointer:
+		{
+			GLuint index = readU32();
+			GLint size = readU32();
+			GLenum type = readU32();
+			GLsizei stride = readU32();
+			glVertexAttribIPointer(index, size, type, stride, (const void*)readU64());
+			break;
+		}
+
+		case HL_TRACE_VertexAttribPointer:
+		{
+			GLuint index = readU32();
+			GLint size = readU32();
+			GLenum type = readU32();
+			GLboolean normalized = readU32();
+			GLsizei stride = readU32();
+			glVertexAttribPointer(index, size, type, normalized, stride, (const void*)readU64());
+			break;
+		}
+
+		case HL_TRACE_Viewport: { GLint v[4]; for (int i = 0; i < 4; i++) v[i] = readU32(); glViewport(v[0], v[1], v[2], v[3]); break; }
+
+		default:
+			fprintf(stderr, "Unknown call %u in trace\n", call);
+	}
+}
+
+//
+// Timing
+//
+
+struct FrameTime
+{
+	double cpu; // ms from the previous frame's end
+	double gpu; // ms between the GPU timestamps at either end
+	double captured; // ms the frame took in the app
+};
+
+double percentile(std::vector<double>& values, double p)
+{
+	std::sort(values.begin(), values.end());
+	u64 i = (u64)(p * (values.size() - 1) + 0.5);
+	return values[i];
+}
+
+void reportTimes(const char* name, std::vector<FrameTime>& frames, double FrameTime::* field)
+{
+	// frame 0 holds the loading, so it's left out when there are others
+	u64 first = (frames.size() > 1) ? 1 : 0;
+
+	std::vector<double> values;
+	double sum = 0;
+	for (u64 i = first; i < frames.size(); i++)
+	{
+		values.push_back(frames[i].*field);
+		sum += frames[i].*field;
+	}
+	if (values.empty()) return;
+
+	printf("%-9s mean %8.3f  median %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+		sum / values.size(), percentile(values, 0.5), percentile(values, 0.95),
+		percentile(values, 0.99), values.back());
+}
+
+int main(int argc, char** argv)
+{
+	int finish = 0;
+	int summary = 0;
+	char* path = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--finish")) finish = 1;
+		else if (!strcmp(argv[i], "--summary")) summary = 1;
+		else path = argv[i];
+	}
+
+	if (!path)
+	{
+		fprintf(stderr, HELP_MESSAGE USAGE);
+		return 1;
+	}
+
+	// the whole trace goes in memory, so reading it doesn't show in the times
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open '%s'\n", path);
+		return 1;
+	}
+	fseek(file, 0, SEEK_END);
+	u64 size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	u8* data = (u8*) malloc(size);
+	if (!data || fread(data, 1, size, file) != size)
+	{
+		fprintf(stderr, "Failed to read '%s'\n", path);
+		return 1;
+	}
+	fclose(file);
+
+	TraceHeader header;
+	if (size < sizeof(header) || (memcpy(&header, data, sizeof(header)), memcmp(header.magic, "HLTRACE", 8)))
+	{
+		fprintf(stderr, "'%s' is not a trace\n", path);
+		return 1;
+	}
+	if (header.version != HL_TRACE_VERSION)
+	{
+		fprintf(stderr, "Trace version %u, expected %u\n", header.version, HL_TRACE_VERSION);
+		return 1;
+	}
+
+	if (!glfwInit())
+	{
+		fprintf(stderr, "Failed to initialize GLFW\n");
+		return 1;
+	}
+
+	// same context the app had, without a visible window or vsync
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, header.major);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, header.minor);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	contexts[0] = glfwCreateWindow(header.width, header.height, "treplay", 0, 0);
+	if (!contexts[0])
+	{
+		fprintf(stderr, "Failed to create a GL %u.%u context\n", header.major, header.minor);
+		return 1;
+	}
+	glfwMakeContextCurrent(contexts[0]);
+	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	glfwSwapInterval(0);
+
+	printf("%s: %ux%u, GL %u.%u, %u frames\n", path, header.width, header.height, header.major, header.minor, header.frames);
+
+	std::vector<FrameTime> frames;
+	std::vector<GLuint> stamps;
+
+	auto stamp = [&]()
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		glQueryCounter(query, GL_TIMESTAMP);
+		stamps.push_back(query);
+	};
+
+	stamp();
+	auto start = std::chrono::steady_clock::now();
+
+	at = data + sizeof(header);
+	end = data + size;
+	while (at + 8 <= end)
+	{
+		u8 call = at[0];
+		u8 context = at[1];
+		u32 bytes;
+		memcpy(&bytes, at + 4, 4);
+		at += 8;
+
+		u8* next = at + bytes;
+		if (next > end) break; // cut short, e.g. the app crashed
+
+		if (call == HL_TRACE_FRAME)
+		{
+			FrameTime frame;
+			frame.captured = readU64() / 1e6;
+
+			if (current != 0) makeCurrent(0);
+			if (finish) glFinish();
+			stamp();
+			glfwSwapBuffers(contexts[0]);
+
+			auto now = std::chrono::steady_clock::now();
+			frame.cpu = std::chrono::duration<double, std::milli>(now - start).count();
+			frame.gpu = 0;
+			frames.push_back(frame);
+			start = now;
+		}
+		else
+		{
+			if (context != current) makeCurrent(context);
+			replayRecord(call);
+		}
+
+		at = next;
+	}
+
+	if (current != 0) makeCurrent(0);
+	glFinish();
+
+	for (u64 i = 0; i < frames.size(); i++)
+	{
+		GLuint64 from, to;
+		glGetQueryObjectui64v(stamps[i], GL_QUERY_RESULT, &from);
+		glGetQueryObjectui64v(stamps[i + 1], GL_QUERY_RESULT, &to);
+		frames[i].gpu = (to - from) / 1e6;
+
+		if (!summary)
+			printf("frame %5lu  cpu %8.3f ms  gpu %8.3f ms  captured %8.3f ms\n",
+				i, frames[i].cpu, frames[i].gpu, frames[i].captured);
+	}
+
+	printf("%lu frames replayed\n", frames.size());
+	reportTimes("cpu", frames, &FrameTime::cpu);
+	reportTimes("gpu", frames, &FrameTime::gpu);
+	reportTimes("captured", frames, &FrameTime::captured);
+
+	glfwTerminate();
+	free(data);
+	return 0;
+}
\ No newline at end of file
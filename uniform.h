@@ -0,0 +1,329 @@
+#pragma once
+
+//
+// Uniform buffers
+//
+// pairs with the block structs shadercomp generates:
+// fill the struct on the CPU, upload it in one call
+// and bind it to the block's binding index
+//
+
+struct UniformBuffer
+{
+	uint id;
+	uint size;
+};
+
+UniformBuffer createUniformBuffer(uint size, void* data = 0, uint usage = GL_DYNAMIC_DRAW)
+{
+	UniformBuffer ret;
+	ret.size = size;
+
+	glGenBuffers(1, &ret.id);
+	glBindBuffer(GL_UNIFORM_BUFFER, ret.id);
+	glBufferData(GL_UNIFORM_BUFFER, size, data, usage);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	return ret;
+}
+
+void updateUniformBuffer(UniformBuffer buffer, void* data, uint size, uint offset = 0)
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer.id);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+inline
+void bindUniformBuffer(UniformBuffer buffer, uint binding)
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.id);
+}
+
+// GL 3.3 has no 'layout(binding = N)' for blocks,
+// so the generated binding is assigned here after linking;
+// on a pending program it's held until the program is resolved
+// (finishShader, or the first useShader), so the compile isn't waited on
+// e.g. bindUniformBlock(&shader, "Material", MaterialBinding)
+void bindUniformBlock(Shader* shader, const char* block, uint binding)
+{
+	if (shader->status == HL_SHADER_PENDING && shader->numPendingBlocks < HL_SHADER_PENDING_BLOCKS)
+	{
+		int n = shader->numPendingBlocks++;
+		snprintf(shader->pendingBlocks[n], sizeof(shader->pendingBlocks[n]), "%s", block);
+		shader->pendingBindings[n] = binding;
+		return;
+	}
+
+	if (shader->status == HL_SHADER_PENDING) finishShader(shader);
+	setUniformBlockBinding(shader, block, binding);
+}
+
+//
+// Uniform ring
+//
+// per-draw and per-frame data is pushed into one big buffer
+// and bound with glBindBufferRange, instead of going through
+// individual glUniform calls
+//
+// with ARB_buffer_storage the buffer is persistently mapped and split
+// into one region per frame in flight, each guarded by a fence;
+// otherwise the buffer is orphaned every frame and filled
+// with glBufferSubData
+//
+
+#define HL_UNIFORM_RING_FRAMES 3
+
+// bindings used by hl itself; shadercomp hands out indices after these
+#define HL_DRAW_BINDING 0
+#define HL_MATERIAL_BINDING 1
+
+struct UniformRange
+{
+	uint offset;
+	uint size; // 0 if the allocation failed
+};
+
+struct
+{
+	uint id;
+	uint frameSize; // bytes per frame region
+	uint align; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+	int persistent;
+	u8* mapped;
+	GLsync fences[HL_UNIFORM_RING_FRAMES];
+
+	uint frame; // current region
+	uint head; // next free byte in the region
+
+	int overflowed;
+	uint wanted; // bytes asked for this frame, including what didn't fit
+}
+hl_uniformRing;
+
+// queried on first use, so material buffers built before setup()
+// agree with the ring about strides
+inline
+uint alignUniform(uint size)
+{
+	if (!hl_uniformRing.align)
+	{
+		int align = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		hl_uniformRing.align = (align > 0) ? align : 256;
+	}
+
+	uint a = hl_uniformRing.align;
+	return (size + a - 1) / a * a;
+}
+
+void setupUniformRing(uint frameSize = 1 << 20)
+{
+	hl_uniformRing.frameSize = alignUniform(frameSize);
+
+	hl_uniformRing.frame = 0;
+	hl_uniformRing.head = 0;
+	hl_uniformRing.overflowed = 0;
+	hl_uniformRing.wanted = 0;
+	hl_uniformRing.persistent = 0;
+	for (int i = 0; i < HL_UNIFORM_RING_FRAMES; i++) hl_uniformRing.fences[i] = 0;
+
+	glGenBuffers(1, &hl_uniformRing.id);
+	glBindBuffer(GL_UNIFORM_BUFFER, hl_uniformRing.id);
+
+	if (glBufferStorage)
+	{
+		uint flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		u64 total = (u64)hl_uniformRing.frameSize * HL_UNIFORM_RING_FRAMES;
+
+		glBufferStorage(GL_UNIFORM_BUFFER, total, 0, flags);
+		hl_uniformRing.mapped = (u8*) glMapBufferRange(GL_UNIFORM_BUFFER, 0, total, flags);
+		hl_uniformRing.persistent = hl_uniformRing.mapped != 0;
+	}
+
+	if (!hl_uniformRing.persistent)
+	{
+		hl_uniformRing.mapped = 0;
+		glBufferData(GL_UNIFORM_BUFFER, hl_uniformRing.frameSize, 0, GL_STREAM_DRAW);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// copy data into the current frame's region
+// when the region is full the range comes back empty and the ring
+// grows at the next advanceUniformRing
+UniformRange pushUniforms(const void* data, uint size)
+{
+	UniformRange ret = {0, 0};
+	hl_uniformRing.wanted += alignUniform(size);
+
+	if (hl_uniformRing.head + size > hl_uniformRing.frameSize)
+	{
+		if (!hl_uniformRing.overflowed)
+			fprintf(stderr, "[Uniform] Ring full (%u bytes per frame), skipping draws\n", hl_uniformRing.frameSize);
+		hl_uniformRing.overflowed = 1;
+		return ret;
+	}
+
+	ret.offset = hl_uniformRing.head;
+	ret.size = size;
+	hl_uniformRing.head += alignUniform(size);
+
+	if (hl_uniformRing.persistent)
+	{
+		ret.offset += hl_uniformRing.frame * hl_uniformRing.frameSize;
+		memcpy(hl_uniformRing.mapped + ret.offset, data, size);
+	}
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, hl_uniformRing.id);
+		glBufferSubData(GL_UNIFORM_BUFFER, ret.offset, size, data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	return ret;
+}
+
+// returns 0 if nothing was bound; skip the draw, it would see stale data
+inline
+int bindUniforms(UniformRange range, uint binding)
+{
+	if (!range.size) return 0;
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, hl_uniformRing.id, range.offset, range.size);
+	return 1;
+}
+
+// move on to the next region
+// called once per frame from presentFrame
+void advanceUniformRing()
+{
+	if (!hl_uniformRing.id) return;
+
+	// make room for everything last frame asked for; the GPU
+	// keeps the old buffer alive until it's done with it
+	if (hl_uniformRing.overflowed)
+	{
+		uint size = hl_uniformRing.frameSize * 2;
+		if (size < hl_uniformRing.wanted) size = hl_uniformRing.wanted;
+		fprintf(stderr, "[Uniform] Growing ring to %u bytes per frame\n", size);
+
+		for (int i = 0; i < HL_UNIFORM_RING_FRAMES; i++)
+			if (hl_uniformRing.fences[i]) glDeleteSync(hl_uniformRing.fences[i]);
+
+		if (hl_uniformRing.persistent)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, hl_uniformRing.id);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &hl_uniformRing.id);
+
+		setupUniformRing(size);
+		return;
+	}
+
+	hl_uniformRing.head = 0;
+	hl_uniformRing.wanted = 0;
+
+	if (!hl_uniformRing.persistent)
+	{
+		// orphan: the driver hands us fresh storage while
+		// last frame's draws keep reading the old one
+		glBindBuffer(GL_UNIFORM_BUFFER, hl_uniformRing.id);
+		glBufferData(GL_UNIFORM_BUFFER, hl_uniformRing.frameSize, 0, GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		return;
+	}
+
+	uint frame = hl_uniformRing.frame;
+	if (hl_uniformRing.fences[frame]) glDeleteSync(hl_uniformRing.fences[frame]);
+	hl_uniformRing.fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	frame = (frame + 1) % HL_UNIFORM_RING_FRAMES;
+	hl_uniformRing.frame = frame;
+
+	// the GPU may still be reading this region from frames ago
+	if (hl_uniformRing.fences[frame])
+	{
+		glClientWaitSync(hl_uniformRing.fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(hl_uniformRing.fences[frame]);
+		hl_uniformRing.fences[frame] = 0;
+	}
+}
+
+//
+// Per-draw data of the built-in texture shader ('hlDraw' block)
+//
+
+struct DrawBlock
+{
+	mat4 transform;
+	vec4 diffuse;
+};
+static_assert(sizeof(DrawBlock) == 80, "DrawBlock size");
+
+//
+// Material constants
+//
+// matches the 'hlMaterial' block:
+//
+// layout(std140) uniform hlMaterial
+// {
+//     vec4 diffuseColor;
+//     vec4 specularColor;
+//     vec4 emissionColor;
+//     vec4 factors; // diffuse, specular, rough, emission
+//     ivec4 layers; // diffuse, specular, normal, rough
+//     ivec4 layers2; // emission
+// };
+//
+// layers are (array << 16 | layer) into hlTextureArray0..N
+// for models created with packTextures, -1 otherwise
+//
+
+struct MaterialBlock
+{
+	vec4 diffuseColor;
+	vec4 specularColor;
+	vec4 emissionColor;
+	vec4 factors;
+	ivec4 layers;
+	ivec4 layers2;
+};
+static_assert(sizeof(MaterialBlock) == 96, "MaterialBlock size");
+
+#define HL_MAX_TEXTURE_ARRAYS 8
+
+// GLSL helper for packed materials:
+// sampleMaterial(layers.x, uv) samples the diffuse layer
+// (GL 3.3 can't index sampler arrays dynamically, hence the switch;
+// the value is the same for the whole draw so the branch is coherent)
+#define HL_MATERIAL_ARRAYS_GLSL "\
+\n uniform sampler2DArray hlTextureArray0;\
+\n uniform sampler2DArray hlTextureArray1;\
+\n uniform sampler2DArray hlTextureArray2;\
+\n uniform sampler2DArray hlTextureArray3;\
+\n uniform sampler2DArray hlTextureArray4;\
+\n uniform sampler2DArray hlTextureArray5;\
+\n uniform sampler2DArray hlTextureArray6;\
+\n uniform sampler2DArray hlTextureArray7;\
+\n \
+\n vec4 sampleMaterial(int slot, vec2 uv)\
+\n {\
+\n 	if (slot < 0) return vec4(1.0);\
+\n 	vec3 coord = vec3(uv, float(slot & 0xFFFF));\
+\n 	switch (slot >> 16)\
+\n 	{\
+\n 	case 0: return texture(hlTextureArray0, coord);\
+\n 	case 1: return texture(hlTextureArray1, coord);\
+\n 	case 2: return texture(hlTextureArray2, coord);\
+\n 	case 3: return texture(hlTextureArray3, coord);\
+\n 	case 4: return texture(hlTextureArray4, coord);\
+\n 	case 5: return texture(hlTextureArray5, coord);\
+\n 	case 6: return texture(hlTextureArray6, coord);\
+\n 	default: return texture(hlTextureArray7, coord);\
+\n 	}\
+\n }\
+"
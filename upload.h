@@ -0,0 +1,330 @@
+#pragma once
+
+//
+// Upload thread
+//
+// a hidden window whose context shares objects with the main one,
+// current on a thread of its own; buffer and texture uploads queued
+// here are decoded and copied on that thread so the drawing thread
+// never stalls on them
+//
+// every job ends in a fence; updateUploads (from presentFrame) checks
+// them in order and runs each job's 'done' on the drawing thread once
+// the GPU has the data, so finished objects are only ever bound there
+//
+// only buffers, textures, shaders and syncs are shared: vertex arrays
+// and framebuffers are containers that stay with the context that made
+// them, so those are created in 'done' (see bindMeshArrays), and
+// createFrame stays on the drawing thread
+//
+// call startUploadThread from the main thread after openWindow and
+// before startRenderThread; without it, queueUpload runs both halves
+// right away
+//
+
+#define HL_UPLOAD_QUEUE 256 // jobs queued or waiting on their fence
+#define HL_UPLOAD_REQUEST 128 // bytes per helper request
+
+// runs on the upload thread, with its context current
+typedef void (*UploadFunc)(void* user);
+// runs on the drawing thread once the upload is visible there
+typedef void (*UploadDoneFunc)(void* user);
+
+struct UploadJob
+{
+	UploadFunc upload;
+	UploadDoneFunc done;
+	void* user;
+	GLsync fence;
+};
+
+struct
+{
+	GLFWwindow* context; // hidden, shares objects with hl.window
+
+	std::thread worker;
+	std::mutex lock; // guards the counters, fences and 'requests'
+	std::condition_variable wake; // work for the worker
+	std::condition_variable uploaded; // a job got its fence
+	int running;
+
+	// one ring, in order: [completed, numUploaded) wait on fences,
+	// [numUploaded, numQueued) wait for the worker
+	UploadJob jobs[HL_UPLOAD_QUEUE];
+	u32 numQueued;
+	u32 numUploaded;
+	u32 numCompleted;
+
+	Pool requests; // state of uploadMeshAsync/createTextureAsync calls
+}
+hl_upload;
+
+void uploadWorker()
+{
+	glfwMakeContextCurrent(hl_upload.context);
+
+	while (1)
+	{
+		UploadJob job;
+		{
+			std::unique_lock<std::mutex> guard(hl_upload.lock);
+			hl_upload.wake.wait(guard, []{ return hl_upload.numUploaded != hl_upload.numQueued || !hl_upload.running; });
+
+			// what's queued still goes through before stopping
+			if (hl_upload.numUploaded == hl_upload.numQueued) break;
+			job = hl_upload.jobs[hl_upload.numUploaded % HL_UPLOAD_QUEUE];
+		}
+
+		job.upload(job.user);
+
+		// the flush gets the fence to the GPU, so other contexts can wait on it
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		{
+			std::lock_guard<std::mutex> guard(hl_upload.lock);
+			hl_upload.jobs[hl_upload.numUploaded % HL_UPLOAD_QUEUE].fence = fence;
+			hl_upload.numUploaded++;
+		}
+		hl_upload.uploaded.notify_all();
+	}
+
+	glFinish();
+	glfwMakeContextCurrent(0);
+}
+
+void startUploadThread()
+{
+	if (hl_upload.running) return;
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	hl_upload.context = glfwCreateWindow(1, 1, "", 0, hl.window);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	if (!hl_upload.context)
+	{
+		fprintf(stderr, "[Upload] Failed to create shared context, uploading on the main thread\n");
+		return;
+	}
+
+	hl_upload.numQueued = 0;
+	hl_upload.numUploaded = 0;
+	hl_upload.numCompleted = 0;
+
+	hl_upload.running = 1;
+	hl_upload.worker = std::thread(uploadWorker);
+}
+
+// run the 'done' of every finished job whose fence has signaled;
+// 'wait' blocks on the oldest one instead of skipping it
+void completeUploads(int wait)
+{
+	while (1)
+	{
+		UploadJob job;
+		{
+			std::unique_lock<std::mutex> guard(hl_upload.lock);
+			if (hl_upload.numCompleted == hl_upload.numQueued) return;
+
+			if (hl_upload.numCompleted == hl_upload.numUploaded)
+			{
+				if (!wait) return;
+				hl_upload.uploaded.wait(guard, []{ return hl_upload.numCompleted != hl_upload.numUploaded; });
+			}
+			job = hl_upload.jobs[hl_upload.numCompleted % HL_UPLOAD_QUEUE];
+		}
+
+		GLuint64 timeout = (wait) ? GL_TIMEOUT_IGNORED : 0;
+		GLenum status = glClientWaitSync(job.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED) return;
+
+		glDeleteSync(job.fence);
+		if (job.done) job.done(job.user);
+
+		std::lock_guard<std::mutex> guard(hl_upload.lock);
+		hl_upload.numCompleted++;
+	}
+}
+
+// called once per frame from presentFrame
+void updateUploads()
+{
+	if (hl_upload.running) completeUploads(false);
+}
+
+// block until everything queued so far is uploaded and done
+void finishUploads()
+{
+	if (hl_upload.running) completeUploads(true);
+}
+
+// drawing thread; finishes what's queued first
+void stopUploadThread()
+{
+	if (!hl_upload.running) return;
+
+	{
+		std::lock_guard<std::mutex> guard(hl_upload.lock);
+		hl_upload.running = 0;
+	}
+	hl_upload.wake.notify_one();
+	hl_upload.worker.join();
+
+	// the worker is gone, so only fences are left to wait on
+	completeUploads(true);
+
+	glfwDestroyWindow(hl_upload.context);
+	hl_upload.context = 0;
+	freePool(&hl_upload.requests);
+}
+
+// from the thread that queues uploads (one at a time);
+// a full queue is drained before anything more goes in
+void queueUpload(UploadFunc upload, UploadDoneFunc done, void* user)
+{
+	if (!hl_upload.running)
+	{
+		upload(user);
+		if (done) done(user);
+		return;
+	}
+
+	while (1)
+	{
+		{
+			std::lock_guard<std::mutex> guard(hl_upload.lock);
+			if (hl_upload.numQueued - hl_upload.numCompleted < HL_UPLOAD_QUEUE)
+			{
+				UploadJob* job = &hl_upload.jobs[hl_upload.numQueued % HL_UPLOAD_QUEUE];
+				job->upload = upload;
+				job->done = done;
+				job->user = user;
+				job->fence = 0;
+				hl_upload.numQueued++;
+				break;
+			}
+		}
+
+		// with a render thread, it's the one completing jobs
+		if (hl.renderThread) std::this_thread::sleep_for(std::chrono::microseconds(100));
+		else completeUploads(true);
+	}
+	hl_upload.wake.notify_one();
+}
+
+void* uploadRequest()
+{
+	std::lock_guard<std::mutex> guard(hl_upload.lock);
+	if (!hl_upload.requests.objectSize) hl_upload.requests = createPool(HL_UPLOAD_REQUEST);
+	return poolAlloc(&hl_upload.requests);
+}
+
+void freeUploadRequest(void* request)
+{
+	std::lock_guard<std::mutex> guard(hl_upload.lock);
+	poolFree(&hl_upload.requests, request);
+}
+
+//
+// Meshes
+//
+
+struct MeshUpload
+{
+	Mesh* mesh;
+	int positionStream;
+	UploadDoneFunc done;
+	void* user;
+};
+
+void uploadMeshBuffersJob(void* user)
+{
+	MeshUpload* u = (MeshUpload*)user;
+	uploadMeshBuffers(*u->mesh, u->positionStream);
+}
+
+void uploadMeshDone(void* user)
+{
+	MeshUpload u = *(MeshUpload*)user;
+	freeUploadRequest(user);
+
+	bindMeshArrays(*u.mesh);
+	if (u.done) u.done(u.user);
+}
+
+// 'mesh' has to stay where it is until 'done'; until then
+// it has no vertex array and drawing it does nothing
+void uploadMeshAsync(Mesh* mesh, int positionStream = false, UploadDoneFunc done = 0, void* user = 0)
+{
+	static_assert(sizeof(MeshUpload) <= HL_UPLOAD_REQUEST, "upload request too big for its pool");
+
+	MeshUpload* u = (MeshUpload*) uploadRequest();
+	u->mesh = mesh;
+	u->positionStream = positionStream;
+	u->done = done;
+	u->user = user;
+
+	mesh->vao = 0;
+	mesh->positionVao = 0;
+	queueUpload(uploadMeshBuffersJob, uploadMeshDone, u);
+}
+
+//
+// Textures
+//
+
+struct TextureUpload
+{
+	const char* path;
+	Texture* out;
+	Texture texture;
+	int width, height, channels;
+	UploadDoneFunc done;
+	void* user;
+};
+
+void createTextureJob(void* user)
+{
+	TextureUpload* u = (TextureUpload*)user;
+
+	Image image = createImage(u->path);
+	if (!image.data) return;
+
+	u->texture = createTexture(&image, false);
+	u->width = image.width;
+	u->height = image.height;
+	u->channels = image.channels;
+	unloadImage(image);
+}
+
+void createTextureDone(void* user)
+{
+	TextureUpload u = *(TextureUpload*)user;
+	freeUploadRequest(user);
+
+	if (u.width)
+	{
+		u.texture.residency = trackTexture(&u.texture, u.width, u.height, 1, u.channels, true);
+		setTextureSource(u.texture, u.path);
+		*u.out = u.texture;
+	}
+	if (u.done) u.done(u.user);
+}
+
+// decode and upload on the upload thread; '*out' is the blank
+// texture until 'done', and stays blank if loading failed
+// 'path' and 'out' have to live until then
+void createTextureAsync(const char* path, Texture* out, UploadDoneFunc done = 0, void* user = 0)
+{
+	static_assert(sizeof(TextureUpload) <= HL_UPLOAD_REQUEST, "upload request too big for its pool");
+
+	TextureUpload* u = (TextureUpload*) uploadRequest();
+	memset(u, 0, sizeof(TextureUpload));
+	u->path = path;
+	u->out = out;
+	u->done = done;
+	u->user = user;
+
+	*out = hl_blankTexture;
+	queueUpload(createTextureJob, createTextureDone, u);
+}
\ No newline at end of file
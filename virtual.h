@@ -0,0 +1,462 @@
+#pragma once
+
+//
+// Virtual texturing
+//
+// a texture far larger than we can keep on the GPU is split into
+// pages; only the pages something on screen actually samples are
+// kept in a physical page cache texture, and a page table texture
+// maps virtual pages to their slot in the cache
+//
+// which pages are needed comes from a low resolution feedback pass
+// that writes page ids, read back through readFrameAsync so it never
+// stalls; missing pages fall back to their nearest resident ancestor,
+// so the top level is always resident
+//
+// the page cache has no mips of its own, so sampling is bilinear
+// within the chosen level; plain GL 3.3, no sparse texture extensions
+//
+
+#define HL_VT_PAGE 128 // physical page size in texels, border included
+#define HL_VT_BORDER 4 // texels of neighbour data around each page for filtering
+#define HL_VT_PAYLOAD (HL_VT_PAGE - 2 * HL_VT_BORDER)
+#define HL_VT_UPLOADS 8 // pages uploaded per update
+
+// fill 'out' (w*h*4 bytes) with texels [x, x+w) x [y, y+h) of the given mip,
+// clamping coordinates outside the texture
+typedef void (*PageSourceFunc)(int mip, int x, int y, int w, int h, u8* out, void* user);
+
+struct VirtualTexture
+{
+	int width, height; // virtual size in texels
+	int pagesX, pagesY; // pages at mip 0, powers of two
+	int mips;
+
+	int cacheX, cacheY; // cache size in pages
+	Texture cache;
+	Texture pageTable;
+
+	u8** table; // CPU copy of each page table level, RGBA per page
+	int* levelStart; // first page index of each mip
+	int numPages;
+
+	int* pageSlot; // cache slot per page, -1 if not resident
+	uint* pageWanted; // last frame the page was requested
+	int* slotPage; // page per cache slot, -1 if free
+	uint* slotUsed; // last frame the slot was requested
+
+	PageSourceFunc source;
+	void* user;
+
+	Frame feedback;
+	int feedbackScale;
+	uint ticket; // readback in flight, 0 if none
+
+	uint frame;
+	int dirty; // page table needs rebuilding
+};
+
+inline
+int pagesAt(int pages, int mip)
+{
+	pages >>= mip;
+	return (pages < 1) ? 1 : pages;
+}
+
+inline
+int pageIndex(VirtualTexture* vt, int mip, int x, int y)
+{
+	return vt->levelStart[mip] + y * pagesAt(vt->pagesX, mip) + x;
+}
+
+//
+// Page source backed by an image in memory
+// (mips are built once on the CPU)
+//
+
+struct ImagePageSource
+{
+	u8** levels;
+	int* widths;
+	int* heights;
+	int mips;
+};
+
+void imagePageSource(int mip, int x, int y, int w, int h, u8* out, void* user)
+{
+	ImagePageSource* src = (ImagePageSource*)user;
+	if (mip >= src->mips) mip = src->mips - 1;
+
+	int lw = src->widths[mip];
+	int lh = src->heights[mip];
+	u8* level = src->levels[mip];
+
+	for (int j = 0; j < h; j++)
+	{
+		int sy = y + j;
+		sy = (sy < 0) ? 0 : (sy >= lh) ? lh - 1 : sy;
+
+		for (int i = 0; i < w; i++)
+		{
+			int sx = x + i;
+			sx = (sx < 0) ? 0 : (sx >= lw) ? lw - 1 : sx;
+			memcpy(&out[(j * w + i) * 4], &level[(sy * lw + sx) * 4], 4);
+		}
+	}
+}
+
+// 'data' is RGBA and is kept, not copied
+ImagePageSource* createImagePageSource(u8* data, int width, int height)
+{
+	ImagePageSource* ret = (ImagePageSource*) malloc(sizeof(ImagePageSource));
+
+	int mips = 1;
+	for (int s = (width > height) ? width : height; s > 1; s >>= 1) mips++;
+
+	ret->mips = mips;
+	ret->levels = (u8**) malloc(mips * sizeof(u8*));
+	ret->widths = (int*) malloc(mips * sizeof(int));
+	ret->heights = (int*) malloc(mips * sizeof(int));
+
+	ret->levels[0] = data;
+	ret->widths[0] = width;
+	ret->heights[0] = height;
+
+	for (int m = 1; m < mips; m++)
+	{
+		int w = ret->widths[m-1], h = ret->heights[m-1];
+		ret->widths[m] = (w > 1) ? w / 2 : 1;
+		ret->heights[m] = (h > 1) ? h / 2 : 1;
+		ret->levels[m] = (u8*) malloc((u64)ret->widths[m] * ret->heights[m] * 4);
+		downsample(ret->levels[m-1], w, h, 4, ret->levels[m]);
+	}
+
+	return ret;
+}
+
+//
+// Virtual texture
+//
+
+int nextPow2(int x)
+{
+	int ret = 1;
+	while (ret < x) ret <<= 1;
+	return ret;
+}
+
+VirtualTexture createVirtualTexture(int width, int height, PageSourceFunc source, void* user, int cachePages = 32, int feedbackScale = 8)
+{
+	VirtualTexture ret;
+	memset(&ret, 0, sizeof(ret));
+
+	ret.width = width;
+	ret.height = height;
+	ret.pagesX = nextPow2((width + HL_VT_PAYLOAD - 1) / HL_VT_PAYLOAD);
+	ret.pagesY = nextPow2((height + HL_VT_PAYLOAD - 1) / HL_VT_PAYLOAD);
+	ret.source = source;
+	ret.user = user;
+
+	ret.mips = 1;
+	while (pagesAt(ret.pagesX, ret.mips - 1) > 1 || pagesAt(ret.pagesY, ret.mips - 1) > 1) ret.mips++;
+
+	ret.levelStart = (int*) malloc((ret.mips + 1) * sizeof(int));
+	ret.table = (u8**) malloc(ret.mips * sizeof(u8*));
+	ret.numPages = 0;
+	for (int m = 0; m < ret.mips; m++)
+	{
+		int count = pagesAt(ret.pagesX, m) * pagesAt(ret.pagesY, m);
+		ret.levelStart[m] = ret.numPages;
+		ret.numPages += count;
+		ret.table[m] = (u8*) calloc(count, 4);
+	}
+	ret.levelStart[ret.mips] = ret.numPages;
+
+	ret.pageSlot = (int*) malloc(ret.numPages * sizeof(int));
+	ret.pageWanted = (uint*) calloc(ret.numPages, sizeof(uint));
+	for (int i = 0; i < ret.numPages; i++) ret.pageSlot[i] = -1;
+
+	// cache slots are addressed with 8 bits per axis in the page table
+	if (cachePages > 256) cachePages = 256;
+	ret.cacheX = cachePages;
+	ret.cacheY = cachePages;
+
+	int slots = ret.cacheX * ret.cacheY;
+	ret.slotPage = (int*) malloc(slots * sizeof(int));
+	ret.slotUsed = (uint*) calloc(slots, sizeof(uint));
+	for (int i = 0; i < slots; i++) ret.slotPage[i] = -1;
+
+	// physical cache
+	ret.cache.type = GL_TEXTURE_2D;
+	ret.cache.format = GL_RGBA;
+	ret.cache.residency = -1;
+	ret.cache.stream = -1;
+	glGenTextures(1, &ret.cache.id);
+	glBindTexture(GL_TEXTURE_2D, ret.cache.id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ret.cacheX * HL_VT_PAGE, ret.cacheY * HL_VT_PAGE, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	ret.cache.residency = trackResource(HL_RES_TEXTURE, ret.cache.id, (u64)ret.cacheX * ret.cacheY * HL_VT_PAGE * HL_VT_PAGE * 4);
+
+	// page table, one level per virtual mip, point sampled
+	ret.pageTable.type = GL_TEXTURE_2D;
+	ret.pageTable.format = GL_RGBA;
+	ret.pageTable.residency = -1;
+	ret.pageTable.stream = -1;
+	glGenTextures(1, &ret.pageTable.id);
+	glBindTexture(GL_TEXTURE_2D, ret.pageTable.id);
+	for (int m = 0; m < ret.mips; m++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, m, GL_RGBA, pagesAt(ret.pagesX, m), pagesAt(ret.pagesY, m), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ret.mips - 1);
+
+	ret.feedbackScale = feedbackScale;
+	ret.feedback = createFrame(1, 1, hl.fwidth / feedbackScale, hl.fheight / feedbackScale, 1, 1, 0, GL_NEAREST, GL_NEAREST);
+
+	ret.dirty = 1;
+	return ret;
+}
+
+void uploadPage(VirtualTexture* vt, int mip, int x, int y, int slot, u8* scratch)
+{
+	vt->source(mip, x * HL_VT_PAYLOAD - HL_VT_BORDER, y * HL_VT_PAYLOAD - HL_VT_BORDER,
+		HL_VT_PAGE, HL_VT_PAGE, scratch, vt->user);
+
+	int sx = slot % vt->cacheX;
+	int sy = slot / vt->cacheX;
+
+	glBindTexture(GL_TEXTURE_2D, vt->cache.id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, sx * HL_VT_PAGE, sy * HL_VT_PAGE, HL_VT_PAGE, HL_VT_PAGE,
+		GL_RGBA, GL_UNSIGNED_BYTE, scratch);
+}
+
+// least recently requested slot; the top mip's page is never given up
+int findSlot(VirtualTexture* vt)
+{
+	int slots = vt->cacheX * vt->cacheY;
+	int ret = -1;
+
+	for (int i = 0; i < slots; i++)
+	{
+		if (vt->slotPage[i] < 0) return i;
+		if (vt->slotPage[i] >= vt->levelStart[vt->mips - 1]) continue;
+
+		// don't evict anything asked for this frame
+		if (vt->slotUsed[i] == vt->frame) continue;
+		if (ret < 0 || vt->slotUsed[i] < vt->slotUsed[ret]) ret = i;
+	}
+	return ret;
+}
+
+// every entry points at its own page if resident,
+// otherwise at whatever its parent points at
+void rebuildPageTable(VirtualTexture* vt)
+{
+	for (int m = vt->mips - 1; m >= 0; m--)
+	{
+		int w = pagesAt(vt->pagesX, m);
+		int h = pagesAt(vt->pagesY, m);
+
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				u8* entry = &vt->table[m][(y * w + x) * 4];
+				int slot = vt->pageSlot[pageIndex(vt, m, x, y)];
+
+				if (slot >= 0)
+				{
+					entry[0] = slot % vt->cacheX;
+					entry[1] = slot / vt->cacheX;
+					entry[2] = m;
+					entry[3] = 255;
+				}
+				else if (m + 1 < vt->mips)
+				{
+					int pw = pagesAt(vt->pagesX, m + 1);
+					memcpy(entry, &vt->table[m + 1][((y >> 1) * pw + (x >> 1)) * 4], 4);
+				}
+				else memset(entry, 0, 4);
+			}
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, vt->pageTable.id);
+	for (int m = 0; m < vt->mips; m++)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, m, 0, 0, pagesAt(vt->pagesX, m), pagesAt(vt->pagesY, m),
+			GL_RGBA, GL_UNSIGNED_BYTE, vt->table[m]);
+	}
+
+	vt->dirty = 0;
+}
+
+void requestPage(VirtualTexture* vt, int mip, int x, int y)
+{
+	// ancestors too, so a fallback is always close by
+	for (; mip < vt->mips; mip++, x >>= 1, y >>= 1)
+	{
+		int page = pageIndex(vt, mip, x, y);
+		if (vt->pageWanted[page] == vt->frame) return;
+
+		vt->pageWanted[page] = vt->frame;
+		if (vt->pageSlot[page] >= 0) vt->slotUsed[vt->pageSlot[page]] = vt->frame;
+	}
+}
+
+// parse a feedback readback: RGBA = page x low, page y low,
+// (x high | y high << 4), mip + 1 (0 where nothing was drawn)
+void readFeedback(VirtualTexture* vt, const u8* pixels, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const u8* p = &pixels[i * 4];
+		if (!p[3]) continue;
+
+		int mip = p[3] - 1;
+		int x = p[0] | ((p[2] & 0xF) << 8);
+		int y = p[1] | ((p[2] >> 4) << 8);
+
+		if (mip >= vt->mips) continue;
+		if (x >= pagesAt(vt->pagesX, mip) || y >= pagesAt(vt->pagesY, mip)) continue;
+
+		requestPage(vt, mip, x, y);
+	}
+}
+
+// bind the feedback frame; render the scene with a shader writing
+// virtualFeedback(uv) (see HL_VIRTUAL_TEXTURE_GLSL), then call updateVirtualTexture
+void beginVirtualFeedback(VirtualTexture* vt)
+{
+	enableFrame(&vt->feedback);
+	glViewport(0, 0, vt->feedback.width, vt->feedback.height);
+	clearFrame(0, 0, 0, 0);
+}
+
+// collect the last finished feedback, load missing pages and
+// queue a readback of this frame's feedback
+void updateVirtualTexture(VirtualTexture* vt)
+{
+	vt->frame++;
+
+	// the top page backs every lookup, keep it in from the start
+	int top = pageIndex(vt, vt->mips - 1, 0, 0);
+	vt->pageWanted[top] = vt->frame;
+
+	if (vt->ticket)
+	{
+		const u8* pixels = mapReadback(vt->ticket);
+		if (pixels)
+		{
+			readFeedback(vt, pixels, vt->feedback.width * vt->feedback.height);
+			unmapReadback(vt->ticket);
+			vt->ticket = 0;
+		}
+	}
+
+	if (!vt->ticket) vt->ticket = readFrameAsync(&vt->feedback, 4);
+
+	// load wanted pages, coarse first so fallbacks improve evenly
+	u8* scratch = 0;
+	int uploads = 0;
+
+	for (int m = vt->mips - 1; m >= 0 && uploads < HL_VT_UPLOADS; m--)
+	{
+		for (int page = vt->levelStart[m]; page < vt->levelStart[m + 1] && uploads < HL_VT_UPLOADS; page++)
+		{
+			if (vt->pageWanted[page] != vt->frame || vt->pageSlot[page] >= 0) continue;
+
+			int slot = findSlot(vt);
+			if (slot < 0) break; // everything resident is in use
+
+			if (vt->slotPage[slot] >= 0) vt->pageSlot[vt->slotPage[slot]] = -1;
+			vt->slotPage[slot] = page;
+			vt->slotUsed[slot] = vt->frame;
+			vt->pageSlot[page] = slot;
+
+			int local = page - vt->levelStart[m];
+			int w = pagesAt(vt->pagesX, m);
+
+			if (!scratch) scratch = (u8*) malloc(HL_VT_PAGE * HL_VT_PAGE * 4);
+			uploadPage(vt, m, local % w, local / w, slot, scratch);
+
+			uploads++;
+			vt->dirty = 1;
+		}
+	}
+
+	free(scratch);
+
+	if (vt->dirty) rebuildPageTable(vt);
+}
+
+void deleteVirtualTexture(VirtualTexture* vt)
+{
+	if (vt->ticket) unmapReadback(vt->ticket);
+	deleteFrame(&vt->feedback);
+
+	untrackResource(vt->cache.residency);
+	glDeleteTextures(1, &vt->cache.id);
+	glDeleteTextures(1, &vt->pageTable.id);
+
+	for (int m = 0; m < vt->mips; m++) free(vt->table[m]);
+	free(vt->table);
+	free(vt->levelStart);
+	free(vt->pageSlot);
+	free(vt->pageWanted);
+	free(vt->slotPage);
+	free(vt->slotUsed);
+}
+
+// set the uniforms HL_VIRTUAL_TEXTURE_GLSL expects on the active shader
+void useVirtualTexture(VirtualTexture* vt)
+{
+	Shader* shader = activeShader;
+
+	shader->setTexture("hlPageTable", vt->pageTable);
+	shader->setTexture("hlPageCache", vt->cache);
+	shader->setVec4("hlVtPages", vec4(vt->pagesX, vt->pagesY, vt->cacheX, vt->cacheY));
+	shader->setVec4("hlVtParams", vec4(HL_VT_PAGE, HL_VT_BORDER, vt->mips - 1, log2((float)vt->feedbackScale)));
+	shader->setVec2("hlVtUvScale", vec2((float)vt->width / (vt->pagesX * HL_VT_PAYLOAD), (float)vt->height / (vt->pagesY * HL_VT_PAYLOAD)));
+}
+
+#define HL_VIRTUAL_TEXTURE_GLSL "\
+\n uniform sampler2D hlPageTable;\
+\n uniform sampler2D hlPageCache;\
+\n uniform vec4 hlVtPages; // virtual pages x, y, cache pages x, y\
+\n uniform vec4 hlVtParams; // page size, border, max mip, feedback bias\
+\n uniform vec2 hlVtUvScale; // texture size over padded virtual size\
+\n \
+\n float virtualMip(vec2 uv, float bias)\
+\n {\
+\n 	vec2 texels = uv * hlVtPages.xy * (hlVtParams.x - 2.0 * hlVtParams.y);\
+\n 	vec2 dx = dFdx(texels), dy = dFdy(texels);\
+\n 	float mip = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + bias;\
+\n 	return clamp(floor(mip), 0.0, hlVtParams.z);\
+\n }\
+\n \
+\n vec4 sampleVirtual(vec2 uv)\
+\n {\
+\n 	uv *= hlVtUvScale;\
+\n 	float mip = virtualMip(uv, 0.0);\
+\n 	vec4 entry = textureLod(hlPageTable, uv, mip) * 255.0;\
+\n 	vec2 pages = max(floor(hlVtPages.xy / exp2(entry.b)), vec2(1.0));\
+\n 	vec2 inPage = fract(uv * pages);\
+\n 	float payload = hlVtParams.x - 2.0 * hlVtParams.y;\
+\n 	vec2 texel = entry.rg * hlVtParams.x + hlVtParams.y + inPage * payload;\
+\n 	return textureLod(hlPageCache, texel / (hlVtPages.zw * hlVtParams.x), 0.0);\
+\n }\
+\n \
+\n vec4 virtualFeedback(vec2 uv)\
+\n {\
+\n 	uv *= hlVtUvScale;\
+\n 	float mip = virtualMip(uv, -hlVtParams.w);\
+\n 	vec2 pages = max(floor(hlVtPages.xy / exp2(mip)), vec2(1.0));\
+\n 	ivec2 page = ivec2(clamp(floor(fract(uv) * pages), vec2(0.0), pages - 1.0));\
+\n 	return vec4(page.x & 255, page.y & 255, (page.x >> 8) | ((page.y >> 8) << 4), mip + 1.0) / 255.0;\
+\n }\
+"
\ No newline at end of file